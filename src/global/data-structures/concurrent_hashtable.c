@@ -0,0 +1,540 @@
+#include "concurrent_hashtable.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * This is an implementation for a hashtable safe to share between threads.
+ *
+ * Writers lock the stripe owning a bucket. Stripes are picked from the same mixed hash bits as the
+ * bucket, and tables never have fewer buckets than stripes, so a chain is only ever modified under
+ * one lock. Growing takes every stripe and publishes a new bucket array holding copies of the
+ * nodes, so readers already walking the old array are never redirected.
+ *
+ * Readers take no locks. They bump a counter for the current epoch parity, walk the chains with
+ * acquire loads and drop the counter again. Unlinked nodes, replaced values and old bucket arrays
+ * are retired and released in batches: the releasing thread flips the epoch and waits until the
+ * counters of the previous parity drain, after which no reader can still hold a reference.
+ *
+ * A batch is detached under retire_lock and waited for under sync_lock, so writers retiring more
+ * objects meanwhile never queue behind readers. Only writers with a batch of their own wait, as
+ * grace periods run one at a time.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../errstack.h"
+
+#define CACHE_LINE (64)
+/* Writer lock stripes. A power of two no larger than the smallest table. */
+#define CHT_STRIPES  (64)
+#define CHT_MIN_LOG2 (6)
+/* Threads are spread over this many reader counters per parity */
+#define CHT_READER_SLOTS (64)
+/* Retired objects released per grace period */
+#define CHT_RETIRE_BATCH (128)
+#define CHT_DENSITY_UP   (2)
+
+typedef struct _node_s
+{
+	size_t hash;
+	void *key;
+	_Atomic(void *) value;
+	_Atomic(struct _node_s *) next;
+} _node_t;
+
+typedef struct _table_s
+{
+	size_t log2;
+	_Atomic(_node_t *) buckets[];
+} _table_t;
+
+enum _retire_kind_e
+{
+	/* An unlinked node, releases its key and value too */
+	RETIRE_NODE,
+	/* A value replaced by cht_set */
+	RETIRE_VALUE,
+	/* A bucket array replaced by a resize, only the node copies in it are freed */
+	RETIRE_TABLE,
+};
+
+typedef struct _retired_s
+{
+	struct _retired_s *next;
+	enum _retire_kind_e kind;
+	void *ptr;
+} _retired_t;
+
+typedef struct _stripe_s
+{
+	pthread_mutex_t lock;
+} __attribute__((aligned(CACHE_LINE))) _stripe_t;
+
+typedef struct _counter_s
+{
+	atomic_size_t count;
+} __attribute__((aligned(CACHE_LINE))) _counter_t;
+
+struct cht_s
+{
+	size_t key_size;
+	ht_alloc_func_t key_copy;
+	ht_free_func_t key_free;
+
+	size_t value_size;
+	ht_alloc_func_t value_copy;
+	ht_free_func_t value_free;
+
+	ht_hash_func_t hash;
+	ht_cmp_func_t cmp;
+
+	_Atomic(_table_t *) table;
+	atomic_size_t n_nodes;
+	_stripe_t stripes[CHT_STRIPES];
+
+	atomic_size_t epoch;
+	_counter_t readers[2][CHT_READER_SLOTS];
+
+	pthread_mutex_t retire_lock;
+	_retired_t *retired;
+	size_t n_retired;
+	/* Serializes _synchronize, concurrent epoch flips could skip a parity */
+	pthread_mutex_t sync_lock;
+};
+
+static atomic_size_t _next_slot;
+static __thread size_t _slot = SIZE_MAX;
+/* Read sections this thread is in, across all tables. Waiting for readers inside one deadlocks. */
+static __thread size_t _read_depth;
+
+static inline size_t _mix(size_t h)
+{
+	h ^= h >> 33;
+	h *= UINT64_C(0xff51afd7ed558ccd);
+	h ^= h >> 33;
+	h *= UINT64_C(0xc4ceb9fe1a85ec53);
+	h ^= h >> 33;
+	return h;
+}
+
+static inline size_t _reader_slot(void)
+{
+	if (_slot == SIZE_MAX)
+		_slot = atomic_fetch_add(&_next_slot, 1) % CHT_READER_SLOTS;
+	return _slot;
+}
+
+static inline _stripe_t *_stripe_of(cht_st *ht, size_t hash)
+{
+	return &ht->stripes[_mix(hash) & (CHT_STRIPES - 1)];
+}
+
+static inline _Atomic(_node_t *) *_bucket_of(_table_t *table, size_t hash)
+{
+	return &table->buckets[_mix(hash) & (((size_t) 1 << table->log2) - 1)];
+}
+
+static _table_t *_table_alloc(size_t log2)
+{
+	return calloc(1, sizeof(_table_t) + ((size_t) 1 << log2) * sizeof(_Atomic(_node_t *)));
+}
+
+static void _free_key(cht_st *ht, void *key)
+{
+	if (ht->key_free)
+		ht->key_free(key);
+	else if (ht->key_size)
+		free(key);
+}
+
+static void _free_value(cht_st *ht, void *value)
+{
+	if (ht->value_free)
+		ht->value_free(value);
+	else if (ht->value_size)
+		free(value);
+}
+
+static int _copy_key(cht_st *ht, void **dst, void *key)
+{
+	if (ht->key_copy) {
+		ES_NEW_INT_NM(ht->key_copy(dst, key));
+	} else if (ht->key_size) {
+		ES_NEW_ASRT_NM(*dst = malloc(ht->key_size));
+		memcpy(*dst, key, ht->key_size);
+	} else {
+		*dst = key;
+	}
+	return 1;
+}
+
+static int _copy_value(cht_st *ht, void **dst, void *value)
+{
+	if (ht->value_copy) {
+		ES_FWD_INT_NM(ht->value_copy(dst, value));
+	} else if (ht->value_size && value != NULL) {
+		ES_NEW_ASRT_NM(*dst = malloc(ht->value_size));
+		memcpy(*dst, value, ht->value_size);
+	} else {
+		*dst = value;
+	}
+	return 1;
+}
+
+static void _free_chains(cht_st *ht, _table_t *table, bool with_kv)
+{
+	size_t i;
+	for (i = 0; i < ((size_t) 1 << table->log2); i++) {
+		_node_t *node = atomic_load_explicit(&table->buckets[i], memory_order_relaxed);
+		while (node) {
+			_node_t *next = atomic_load_explicit(&node->next, memory_order_relaxed);
+			if (with_kv) {
+				_free_key(ht, node->key);
+				_free_value(ht, atomic_load_explicit(&node->value, memory_order_relaxed));
+			}
+			free(node);
+			node = next;
+		}
+	}
+	free(table);
+}
+
+static void _release(cht_st *ht, enum _retire_kind_e kind, void *ptr)
+{
+	_node_t *node;
+	switch (kind) {
+	case RETIRE_NODE:
+		node = ptr;
+		_free_key(ht, node->key);
+		_free_value(ht, atomic_load_explicit(&node->value, memory_order_relaxed));
+		free(node);
+		break;
+	case RETIRE_VALUE:
+		_free_value(ht, ptr);
+		break;
+	case RETIRE_TABLE:
+		_free_chains(ht, ptr, false);
+		break;
+	}
+}
+
+/* Wait until every reader that might have entered before this call has left. */
+static void _synchronize(cht_st *ht)
+{
+	size_t parity, i;
+	pthread_mutex_lock(&ht->sync_lock);
+	parity = atomic_fetch_add(&ht->epoch, 1) & 1;
+	for (i = 0; i < CHT_READER_SLOTS; i++) {
+		while (atomic_load(&ht->readers[parity][i].count)) {
+			sched_yield();
+		}
+	}
+	pthread_mutex_unlock(&ht->sync_lock);
+}
+
+/* Release retired objects once a batch has built up (or always when forced) */
+static void _reclaim(cht_st *ht, bool force)
+{
+	_retired_t *list;
+	if (_read_depth)
+		return;
+	pthread_mutex_lock(&ht->retire_lock);
+	if (!ht->retired || (!force && ht->n_retired < CHT_RETIRE_BATCH)) {
+		pthread_mutex_unlock(&ht->retire_lock);
+		return;
+	}
+	list          = MOVE_PZ(ht->retired);
+	ht->n_retired = 0;
+	pthread_mutex_unlock(&ht->retire_lock);
+	_synchronize(ht);
+	while (list) {
+		_retired_t *next = list->next;
+		_release(ht, list->kind, list->ptr);
+		free(list);
+		list = next;
+	}
+}
+
+static void _retire(cht_st *ht, enum _retire_kind_e kind, void *ptr)
+{
+	_retired_t *r = malloc(sizeof(*r));
+	if (!r) {
+		/* Inside a read section waiting would deadlock, leaking is the only safe option */
+		if (_read_depth)
+			return;
+		_synchronize(ht);
+		_release(ht, kind, ptr);
+		return;
+	}
+	r->kind = kind;
+	r->ptr  = ptr;
+	pthread_mutex_lock(&ht->retire_lock);
+	r->next     = ht->retired;
+	ht->retired = r;
+	ht->n_retired++;
+	pthread_mutex_unlock(&ht->retire_lock);
+}
+
+unsigned cht_read_lock(cht_st *ht)
+{
+	size_t slot = _reader_slot();
+	for (;;) {
+		size_t epoch = atomic_load(&ht->epoch);
+		atomic_fetch_add(&ht->readers[epoch & 1][slot].count, 1);
+		/* A flip in between means the writer may already be past our counter, retry */
+		if (atomic_load(&ht->epoch) == epoch) {
+			_read_depth++;
+			return epoch & 1;
+		}
+		atomic_fetch_sub(&ht->readers[epoch & 1][slot].count, 1);
+	}
+}
+
+void cht_read_unlock(cht_st *ht, unsigned token)
+{
+	_read_depth--;
+	atomic_fetch_sub_explicit(
+	    &ht->readers[token & 1][_reader_slot()].count, 1, memory_order_release);
+}
+
+int cht_alloc(cht_st **dst,
+              ht_hash_func_t hash,
+              ht_cmp_func_t cmp,
+              size_t key_size,
+              ht_alloc_func_t key_copy,
+              ht_free_func_t key_free,
+              size_t value_size,
+              ht_alloc_func_t value_copy,
+              ht_free_func_t value_free)
+{
+	CLEANUP(cht_free) cht_st *tmp = NULL;
+	size_t i;
+	ES_NEW_ASRT_NM(dst);
+	*dst = NULL;
+	ES_NEW_ASRT_NM(hash && cmp);
+	ES_NEW_ASRT_NM(tmp = aligned_alloc(CACHE_LINE, sizeof(cht_st)));
+	memset(tmp, 0, sizeof(*tmp));
+	for (i = 0; i < CHT_STRIPES; i++) {
+		pthread_mutex_init(&tmp->stripes[i].lock, NULL);
+	}
+	pthread_mutex_init(&tmp->retire_lock, NULL);
+	pthread_mutex_init(&tmp->sync_lock, NULL);
+	ES_NEW_ASRT_NM(tmp->table = _table_alloc(CHT_MIN_LOG2));
+	tmp->table->log2 = CHT_MIN_LOG2;
+	tmp->hash        = hash;
+	tmp->cmp         = cmp;
+	tmp->key_size    = key_size;
+	tmp->key_copy    = key_copy;
+	tmp->key_free    = key_free;
+	tmp->value_size  = value_size;
+	tmp->value_copy  = value_copy;
+	tmp->value_free  = value_free;
+	*dst             = MOVE_PZ(tmp);
+	return 1;
+}
+
+void cht_free(cht_st **to_free)
+{
+	cht_st *ht;
+	size_t i;
+	if (!to_free || !*to_free)
+		return;
+	ht = *to_free;
+	while (ht->retired) {
+		_retired_t *next = ht->retired->next;
+		_release(ht, ht->retired->kind, ht->retired->ptr);
+		free(ht->retired);
+		ht->retired = next;
+	}
+	if (ht->table)
+		_free_chains(ht, ht->table, true);
+	for (i = 0; i < CHT_STRIPES; i++) {
+		pthread_mutex_destroy(&ht->stripes[i].lock);
+	}
+	pthread_mutex_destroy(&ht->retire_lock);
+	pthread_mutex_destroy(&ht->sync_lock);
+	free(ht);
+	*to_free = NULL;
+}
+
+static _node_t *_chain_find(cht_st *ht, _node_t *node, const void *key, size_t hash)
+{
+	while (node && (node->hash != hash || ht->cmp(node->key, key))) {
+		node = atomic_load_explicit(&node->next, memory_order_acquire);
+	}
+	return node;
+}
+
+/* Double the bucket array once the density threshold is crossed. Takes every stripe. */
+static void _maybe_grow(cht_st *ht)
+{
+	_table_t *old = atomic_load_explicit(&ht->table, memory_order_acquire);
+	_table_t *new = NULL;
+	size_t i;
+	if (atomic_load(&ht->n_nodes) < CHT_DENSITY_UP * ((size_t) 1 << old->log2))
+		return;
+	for (i = 0; i < CHT_STRIPES; i++) {
+		pthread_mutex_lock(&ht->stripes[i].lock);
+	}
+	old = atomic_load_explicit(&ht->table, memory_order_relaxed);
+	if (atomic_load(&ht->n_nodes) < CHT_DENSITY_UP * ((size_t) 1 << old->log2))
+		goto out;
+	if (!(new = _table_alloc(old->log2 + 1)))
+		goto out;
+	new->log2 = old->log2 + 1;
+	for (i = 0; i < ((size_t) 1 << old->log2); i++) {
+		_node_t *node = atomic_load_explicit(&old->buckets[i], memory_order_relaxed);
+		for (; node; node = atomic_load_explicit(&node->next, memory_order_relaxed)) {
+			_Atomic(_node_t *) *head = _bucket_of(new, node->hash);
+			_node_t *copy            = malloc(sizeof(*copy));
+			if (!copy) {
+				_free_chains(ht, MOVE_PZ(new), false);
+				goto out;
+			}
+			copy->hash = node->hash;
+			copy->key  = node->key;
+			atomic_init(&copy->value, atomic_load_explicit(&node->value, memory_order_relaxed));
+			atomic_init(&copy->next, atomic_load_explicit(head, memory_order_relaxed));
+			atomic_store_explicit(head, copy, memory_order_relaxed);
+		}
+	}
+	atomic_store_explicit(&ht->table, new, memory_order_release);
+out:
+	for (i = 0; i < CHT_STRIPES; i++) {
+		pthread_mutex_unlock(&ht->stripes[i].lock);
+	}
+	if (new)
+		_retire(ht, RETIRE_TABLE, old);
+}
+
+int cht_set(cht_st *ht, void *key, void *value)
+{
+	size_t hash;
+	_stripe_t *stripe;
+	_Atomic(_node_t *) *head;
+	_node_t *node;
+	void *new_value = NULL;
+	int ret         = 1;
+	ES_NEW_ASRT_NM(ht);
+	hash = ht->hash(key);
+	ES_FWD_INT_NM(_copy_value(ht, &new_value, value));
+	stripe = _stripe_of(ht, hash);
+	pthread_mutex_lock(&stripe->lock);
+	head = _bucket_of(atomic_load_explicit(&ht->table, memory_order_acquire), hash);
+	node = _chain_find(ht, atomic_load_explicit(head, memory_order_acquire), key, hash);
+	if (node) {
+		void *old = atomic_exchange_explicit(&node->value, new_value, memory_order_acq_rel);
+		pthread_mutex_unlock(&stripe->lock);
+		if (ht->value_free || ht->value_size)
+			_retire(ht, RETIRE_VALUE, old);
+		ret = 0;
+	} else {
+		if (!(node = calloc(1, sizeof(*node))) || _copy_key(ht, &node->key, key) < 0) {
+			pthread_mutex_unlock(&stripe->lock);
+			free(node);
+			_free_value(ht, new_value);
+			ES_NEW_ASRT_NM(false);
+		}
+		node->hash = hash;
+		atomic_init(&node->value, new_value);
+		atomic_init(&node->next, atomic_load_explicit(head, memory_order_relaxed));
+		atomic_store_explicit(head, node, memory_order_release);
+		atomic_fetch_add(&ht->n_nodes, 1);
+		pthread_mutex_unlock(&stripe->lock);
+		_maybe_grow(ht);
+	}
+	_reclaim(ht, false);
+	return ret;
+}
+
+void cht_delete(cht_st *ht, void *key)
+{
+	size_t hash = ht->hash(key);
+	_stripe_t *stripe;
+	_Atomic(_node_t *) *prev;
+	_node_t *node;
+	stripe = _stripe_of(ht, hash);
+	pthread_mutex_lock(&stripe->lock);
+	prev = _bucket_of(atomic_load_explicit(&ht->table, memory_order_acquire), hash);
+	while ((node = atomic_load_explicit(prev, memory_order_acquire)) &&
+	       (node->hash != hash || ht->cmp(node->key, key))) {
+		prev = &node->next;
+	}
+	if (node) {
+		/* node->next stays intact so readers standing on node can carry on */
+		atomic_store_explicit(
+		    prev, atomic_load_explicit(&node->next, memory_order_relaxed), memory_order_release);
+		atomic_fetch_sub(&ht->n_nodes, 1);
+	}
+	pthread_mutex_unlock(&stripe->lock);
+	if (node) {
+		_retire(ht, RETIRE_NODE, node);
+		_reclaim(ht, false);
+	}
+}
+
+/* Caller must be inside a read section */
+static _node_t *_lookup(cht_st *ht, const void *key, size_t hash)
+{
+	_table_t *table = atomic_load_explicit(&ht->table, memory_order_acquire);
+	_node_t *head   = atomic_load_explicit(_bucket_of(table, hash), memory_order_acquire);
+	return _chain_find(ht, head, key, hash);
+}
+
+void *cht_get(cht_st *ht, const void *key)
+{
+	size_t hash = ht->hash(key);
+	unsigned token;
+	_node_t *node;
+	void *value = NULL;
+	token       = cht_read_lock(ht);
+	if ((node = _lookup(ht, key, hash)))
+		value = atomic_load_explicit(&node->value, memory_order_acquire);
+	cht_read_unlock(ht, token);
+	return value;
+}
+
+bool cht_has(cht_st *ht, const void *key)
+{
+	size_t hash = ht->hash(key);
+	unsigned token;
+	bool found;
+	token = cht_read_lock(ht);
+	found = _lookup(ht, key, hash) != NULL;
+	cht_read_unlock(ht, token);
+	return found;
+}
+
+int cht_foreach(cht_st *ht, cht_foreach_func_t body, void *data)
+{
+	unsigned token;
+	_table_t *table;
+	size_t i;
+	int ret = 1;
+	ES_NEW_ASRT_NM(ht);
+	token = cht_read_lock(ht);
+	table = atomic_load_explicit(&ht->table, memory_order_acquire);
+	for (i = 0; i < ((size_t) 1 << table->log2) && ret > 0; i++) {
+		_node_t *node = atomic_load_explicit(&table->buckets[i], memory_order_acquire);
+		while (node && ret > 0) {
+			void *value = atomic_load_explicit(&node->value, memory_order_acquire);
+			ret         = body(ht, node->key, value, data);
+			node = atomic_load_explicit(&node->next, memory_order_acquire);
+		}
+	}
+	cht_read_unlock(ht, token);
+	_reclaim(ht, false);
+	ES_FWD_INT_NM(ret);
+	return ret;
+}
+
+size_t cht_size(cht_st *ht)
+{
+	return atomic_load(&ht->n_nodes);
+}
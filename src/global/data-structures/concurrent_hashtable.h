@@ -0,0 +1,80 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * This is an implementation for a hashtable safe to share between threads. Writers serialize on
+ * striped locks, readers never lock: they only announce themselves in an epoch counter so memory
+ * unlinked by writers is released once no reader can still see it.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "../util.h"
+#include "hashtable.h"
+
+struct cht_s;
+typedef struct cht_s cht_st;
+
+typedef int (*cht_foreach_func_t)(const cht_st *ht, void *key, void *value, void *data);
+
+/**
+ * Allocate a new concurrent table. Parameters follow ht_alloc.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int cht_alloc(cht_st **dst,
+              ht_hash_func_t hash,
+              ht_cmp_func_t cmp,
+              size_t key_size,
+              ht_alloc_func_t key_copy,
+              ht_free_func_t key_free,
+              size_t value_size,
+              ht_alloc_func_t value_copy,
+              ht_free_func_t value_free);
+/**
+ * Free the table and everything it owns. No other thread may be using the table.
+ */
+void cht_free(cht_st **to_free);
+
+/**
+ * Insert or replace a k/v pair. Replaced values are released once no reader can see them.
+ *
+ * @returns 1 if the key is new, 0 if it was replaced, negative on failure
+ */
+int cht_set(cht_st *ht, void *key, void *value);
+bool cht_has(cht_st *ht, const void *key);
+/**
+ * Lock free lookup. When the table owns its values (value_size/value_copy) the returned pointer
+ * may be released by a concurrent cht_set/cht_delete, hold cht_read_lock while using it.
+ */
+void *cht_get(cht_st *ht, const void *key);
+void cht_delete(cht_st *ht, void *key);
+/**
+ * Iterate over a snapshot of the table. The body may call cht_set/cht_delete.
+ */
+int cht_foreach(cht_st *ht, cht_foreach_func_t body, void *data);
+size_t cht_size(cht_st *ht);
+
+/**
+ * Enter a read side section. Nothing reachable from the table is released until the matching
+ * cht_read_unlock. Sections nest. Writers don't wait for them, except a writer whose call releases
+ * a batch of retired objects, which waits for the sections open when the batch was taken.
+ *
+ * @returns a token to pass to cht_read_unlock
+ */
+unsigned cht_read_lock(cht_st *ht);
+void cht_read_unlock(cht_st *ht, unsigned token);
+
+/* Allocate an int -> user defined data concurrent hash table */
+#define cht_int_alloc(dst, value_size, value_copy, value_free)                                     \
+	cht_alloc(dst, ht_int_hash, ht_int_cmp, 0, NULL, NULL, value_size, value_copy, value_free)
+#define cht_int_set(ht, key, value) cht_set((ht), (void *) (uint64_t) (key), (void *) (value))
+#define cht_int_get(ht, key)        cht_get((ht), (void *) (uint64_t) (key))
+#define cht_int_delete(ht, key)     cht_delete(ht, (void *) (uint64_t) (key))
+
+#define CHT_CLEANUP CLEANUP(cht_free)
@@ -0,0 +1,326 @@
+#include "filter.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * This is an implementation for approximate membership filters.
+ *
+ * Bloom blocks are picked from the high half of the mixed hash by a multiply-shift, so any block
+ * count works. The low half, multiplied by a different odd salt per word, picks one bit in each of
+ * the block's eight words (split block Bloom filter).
+ *
+ * Cuckoo buckets are one 64-bit word holding four 16-bit fingerprints, 0 marks a free slot. The
+ * alternate bucket is the current one xor a hash of the fingerprint, so either bucket finds the
+ * other without the key. An insert that finds both buckets full moves a random resident to its
+ * alternate bucket, for at most CUCKOO_MAX_KICKS moves. If that runs out the last displaced
+ * fingerprint is parked in a single victim slot, and the filter reports full until a removal
+ * makes room for it.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../errstack.h"
+
+#define CACHE_LINE (64)
+
+#define BLOOM_WORDS (8)
+
+#define CUCKOO_SLOTS     (4)
+#define CUCKOO_MAX_KICKS (500)
+/* Fill the buckets to at most 95% of their slots */
+#define CUCKOO_LOAD(slots) ((slots) - (slots) / 20)
+#define CUCKOO_LANES       UINT64_C(0x0001000100010001)
+#define CUCKOO_HIGHS       UINT64_C(0x8000800080008000)
+
+typedef struct _block_s
+{
+	uint64_t words[BLOOM_WORDS];
+} __attribute__((aligned(CACHE_LINE))) _block_t;
+
+struct bloom_s
+{
+	size_t n_blocks;
+	_block_t *blocks;
+};
+
+struct cuckoo_s
+{
+	size_t mask;
+	size_t count;
+	uint64_t *buckets;
+	uint64_t rng;
+
+	bool has_victim;
+	uint16_t victim_fp;
+	size_t victim_bucket;
+};
+
+static const uint32_t _salts[BLOOM_WORDS] = {
+    0x47b6137bU,
+    0x44974d91U,
+    0x8824ad5bU,
+    0xa2b7289dU,
+    0x705495c7U,
+    0x2df1424bU,
+    0x9efc4947U,
+    0x5c6bfb31U,
+};
+
+static inline uint64_t _mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= UINT64_C(0xff51afd7ed558ccd);
+	h ^= h >> 33;
+	h *= UINT64_C(0xc4ceb9fe1a85ec53);
+	h ^= h >> 33;
+	return h;
+}
+
+int bloom_alloc(bloom_st **dst, size_t capacity, size_t bits_per_key)
+{
+	BLOOM_CLEANUP bloom_st *tmp = NULL;
+	size_t bits;
+	ES_NEW_ASRT_NM(dst);
+	*dst = NULL;
+	ES_NEW_ASRT(bits_per_key > 0, "Bloom filter needs bits per key");
+	ES_NEW_ASRT(capacity <= SIZE_MAX / bits_per_key, "Capacity %zu too large", capacity);
+	bits = MAX(capacity * bits_per_key, (size_t) 1);
+	ES_NEW_ASRT_NM(tmp = calloc(1, sizeof(*tmp)));
+	tmp->n_blocks = (bits + sizeof(_block_t) * 8 - 1) / (sizeof(_block_t) * 8);
+	ES_NEW_ASRT(tmp->n_blocks <= UINT32_MAX, "Capacity %zu too large", capacity);
+	ES_NEW_ASRT_NM(tmp->blocks = aligned_alloc(CACHE_LINE, tmp->n_blocks * sizeof(_block_t)));
+	bloom_clear(tmp);
+	*dst = MOVE_PZ(tmp);
+	return 1;
+}
+
+void bloom_free(bloom_st **to_free)
+{
+	if (!to_free || !*to_free)
+		return;
+	free((*to_free)->blocks);
+	free(*to_free);
+	*to_free = NULL;
+}
+
+static inline _block_t *_bloom_block(const bloom_st *bf, uint64_t h)
+{
+	return &bf->blocks[((h >> 32) * bf->n_blocks) >> 32];
+}
+
+static inline uint64_t _bloom_bit(uint64_t h, size_t word)
+{
+	return (uint64_t) 1 << (((uint32_t) h * _salts[word]) >> 26);
+}
+
+void bloom_add(bloom_st *bf, uint64_t hash)
+{
+	uint64_t h      = _mix(hash);
+	_block_t *block = _bloom_block(bf, h);
+	size_t i;
+	for (i = 0; i < BLOOM_WORDS; i++) {
+		block->words[i] |= _bloom_bit(h, i);
+	}
+}
+
+bool bloom_may_contain(const bloom_st *bf, uint64_t hash)
+{
+	uint64_t h       = _mix(hash);
+	_block_t *block  = _bloom_block(bf, h);
+	uint64_t missing = 0;
+	size_t i;
+	/* No early exit, the eight tests compile to straight line code */
+	for (i = 0; i < BLOOM_WORDS; i++) {
+		missing |= _bloom_bit(h, i) & ~block->words[i];
+	}
+	return !missing;
+}
+
+void bloom_clear(bloom_st *bf)
+{
+	memset(bf->blocks, 0, bf->n_blocks * sizeof(_block_t));
+}
+
+size_t bloom_bytes(const bloom_st *bf)
+{
+	return sizeof(*bf) + bf->n_blocks * sizeof(_block_t);
+}
+
+int cuckoo_alloc(cuckoo_st **dst, size_t capacity)
+{
+	CUCKOO_CLEANUP cuckoo_st *tmp = NULL;
+	size_t n_buckets              = CACHE_LINE / sizeof(uint64_t);
+	ES_NEW_ASRT_NM(dst);
+	*dst = NULL;
+	/* From one cache line of buckets up */
+	while (CUCKOO_LOAD(n_buckets * CUCKOO_SLOTS) < capacity) {
+		ES_NEW_ASRT(n_buckets < SIZE_MAX / 16, "Capacity %zu too large", capacity);
+		n_buckets *= 2;
+	}
+	ES_NEW_ASRT_NM(tmp = calloc(1, sizeof(*tmp)));
+	ES_NEW_ASRT_NM(tmp->buckets = aligned_alloc(CACHE_LINE, n_buckets * sizeof(uint64_t)));
+	tmp->mask = n_buckets - 1;
+	tmp->rng  = UINT64_C(0x9e3779b97f4a7c15);
+	cuckoo_clear(tmp);
+	*dst = MOVE_PZ(tmp);
+	return 1;
+}
+
+void cuckoo_free(cuckoo_st **to_free)
+{
+	if (!to_free || !*to_free)
+		return;
+	free((*to_free)->buckets);
+	free(*to_free);
+	*to_free = NULL;
+}
+
+/* Fingerprint from the high bits, bucket from the low ones, so the two stay independent */
+static inline uint16_t _fingerprint(uint64_t h)
+{
+	uint16_t fp = h >> 48;
+	return fp ? fp : 1;
+}
+
+/* The offset is odd, so the alternate bucket is never the bucket itself */
+static inline size_t _alt_bucket(const cuckoo_st *cf, size_t bucket, uint16_t fp)
+{
+	return (bucket ^ (fp * UINT64_C(0x5bd1e995) | 1)) & cf->mask;
+}
+
+/* Lanes equal to fp have their high bit set (SWAR zero lane test on the xor) */
+static inline uint64_t _lanes_equal(uint64_t bucket, uint16_t fp)
+{
+	uint64_t x = bucket ^ (fp * CUCKOO_LANES);
+	return (x - CUCKOO_LANES) & ~x & CUCKOO_HIGHS;
+}
+
+static inline unsigned _lane_of(uint64_t lanes)
+{
+	return __builtin_ctzll(lanes) / 16;
+}
+
+static inline uint16_t _lane_get(uint64_t bucket, unsigned lane)
+{
+	return bucket >> (lane * 16);
+}
+
+static inline void _lane_set(uint64_t *bucket, unsigned lane, uint16_t fp)
+{
+	*bucket &= ~(UINT64_C(0xFFFF) << (lane * 16));
+	*bucket |= (uint64_t) fp << (lane * 16);
+}
+
+static bool _bucket_insert(cuckoo_st *cf, size_t bucket, uint16_t fp)
+{
+	uint64_t free_lanes = _lanes_equal(cf->buckets[bucket], 0);
+	if (!free_lanes)
+		return false;
+	_lane_set(&cf->buckets[bucket], _lane_of(free_lanes), fp);
+	return true;
+}
+
+static bool _bucket_remove(cuckoo_st *cf, size_t bucket, uint16_t fp)
+{
+	uint64_t lanes = _lanes_equal(cf->buckets[bucket], fp);
+	if (!lanes)
+		return false;
+	_lane_set(&cf->buckets[bucket], _lane_of(lanes), 0);
+	return true;
+}
+
+/* Place fp in bucket or its alternate, kicking residents out. Parks the leftover in the victim. */
+static void _cuckoo_place(cuckoo_st *cf, size_t bucket, uint16_t fp)
+{
+	size_t kicks;
+	if (_bucket_insert(cf, bucket, fp) || _bucket_insert(cf, _alt_bucket(cf, bucket, fp), fp))
+		return;
+	for (kicks = 0; kicks < CUCKOO_MAX_KICKS; kicks++) {
+		unsigned lane;
+		uint16_t kicked;
+		cf->rng ^= cf->rng << 13;
+		cf->rng ^= cf->rng >> 7;
+		cf->rng ^= cf->rng << 17;
+		lane   = cf->rng % CUCKOO_SLOTS;
+		kicked = _lane_get(cf->buckets[bucket], lane);
+		_lane_set(&cf->buckets[bucket], lane, fp);
+		fp     = kicked;
+		bucket = _alt_bucket(cf, bucket, fp);
+		if (_bucket_insert(cf, bucket, fp))
+			return;
+	}
+	cf->has_victim    = true;
+	cf->victim_fp     = fp;
+	cf->victim_bucket = bucket;
+}
+
+int cuckoo_add(cuckoo_st *cf, uint64_t hash)
+{
+	uint64_t h = _mix(hash);
+	if (cf->has_victim)
+		return 0;
+	_cuckoo_place(cf, h & cf->mask, _fingerprint(h));
+	cf->count++;
+	return 1;
+}
+
+bool cuckoo_may_contain(const cuckoo_st *cf, uint64_t hash)
+{
+	uint64_t h     = _mix(hash);
+	uint16_t fp    = _fingerprint(h);
+	size_t bucket  = h & cf->mask;
+	size_t alt     = _alt_bucket(cf, bucket, fp);
+	bool in_victim = cf->has_victim && cf->victim_fp == fp &&
+	                 (cf->victim_bucket == bucket || cf->victim_bucket == alt);
+	return _lanes_equal(cf->buckets[bucket], fp) || _lanes_equal(cf->buckets[alt], fp) ||
+	       in_victim;
+}
+
+bool cuckoo_remove(cuckoo_st *cf, uint64_t hash)
+{
+	uint64_t h    = _mix(hash);
+	uint16_t fp   = _fingerprint(h);
+	size_t bucket = h & cf->mask;
+	size_t alt    = _alt_bucket(cf, bucket, fp);
+	if (_bucket_remove(cf, bucket, fp) || _bucket_remove(cf, alt, fp)) {
+		cf->count--;
+		/* The freed slot may give the victim a home again */
+		if (cf->has_victim) {
+			cf->has_victim = false;
+			_cuckoo_place(cf, cf->victim_bucket, cf->victim_fp);
+		}
+		return true;
+	}
+	if (cf->has_victim && cf->victim_fp == fp &&
+	    (cf->victim_bucket == bucket || cf->victim_bucket == alt)) {
+		cf->has_victim = false;
+		cf->count--;
+		return true;
+	}
+	return false;
+}
+
+void cuckoo_clear(cuckoo_st *cf)
+{
+	memset(cf->buckets, 0, (cf->mask + 1) * sizeof(uint64_t));
+	cf->count      = 0;
+	cf->has_victim = false;
+}
+
+size_t cuckoo_size(const cuckoo_st *cf)
+{
+	return cf->count;
+}
+
+size_t cuckoo_capacity(const cuckoo_st *cf)
+{
+	return CUCKOO_LOAD((cf->mask + 1) * CUCKOO_SLOTS);
+}
+
+size_t cuckoo_bytes(const cuckoo_st *cf)
+{
+	return sizeof(*cf) + (cf->mask + 1) * sizeof(uint64_t);
+}
@@ -0,0 +1,82 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * This is an implementation for approximate membership filters over 64-bit hashes. Both answer
+ * "definitely absent" or "maybe present", so a miss can be rejected before a table is touched.
+ *
+ * The blocked Bloom filter keeps every key in one 64 byte block (one cache line) and sets one bit
+ * in each of its eight words. Entries can't be removed.
+ *
+ * The cuckoo filter stores a 16-bit fingerprint in one of two 4 slot buckets and supports
+ * removal. A lookup reads both buckets.
+ *
+ * Hashes are mixed again internally, so weak hashes (identity, djb2) are fine. The same hash must
+ * be passed for the same key every time.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "../util.h"
+
+struct bloom_s;
+typedef struct bloom_s bloom_st;
+struct cuckoo_s;
+typedef struct cuckoo_s cuckoo_st;
+
+/**
+ * Allocate a blocked Bloom filter sized for capacity keys at bits_per_key bits each. The false
+ * positive rate is about 3% at 8 bits per key, 0.4% at 12 and 0.1% at 16, and rises past
+ * capacity keys.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int bloom_alloc(bloom_st **dst, size_t capacity, size_t bits_per_key);
+void bloom_free(bloom_st **to_free);
+void bloom_add(bloom_st *bf, uint64_t hash);
+/* @returns false if hash was never added */
+bool bloom_may_contain(const bloom_st *bf, uint64_t hash);
+void bloom_clear(bloom_st *bf);
+size_t bloom_bytes(const bloom_st *bf);
+
+/**
+ * Allocate a cuckoo filter holding at least capacity fingerprints. Bucket counts are powers of two
+ * filled to at most 95%. Lookups have a false positive rate below 0.013%.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int cuckoo_alloc(cuckoo_st **dst, size_t capacity);
+void cuckoo_free(cuckoo_st **to_free);
+/**
+ * Add hash, which cuckoo_may_contain then reports. When both its buckets are full, up to 500
+ * other fingerprints are moved to their alternate buckets. If that finds no room, the last one
+ * moved is parked in a single victim slot and the call still succeeds, but the filter is full
+ * from then on: adds return 0 and change nothing until cuckoo_remove makes room. The two buckets
+ * of a fingerprint are always distinct and fit it eight times, so its ninth copy fills the victim
+ * slot and the tenth add fails.
+ *
+ * @returns 1 if added, 0 if the filter is full
+ */
+int cuckoo_add(cuckoo_st *cf, uint64_t hash);
+/* @returns false if hash isn't in the filter */
+bool cuckoo_may_contain(const cuckoo_st *cf, uint64_t hash);
+/**
+ * Remove one copy of hash. Removing a hash that was never added may remove a different key that
+ * shares its fingerprint, which later reads as absent.
+ *
+ * @returns true if a matching fingerprint was removed
+ */
+bool cuckoo_remove(cuckoo_st *cf, uint64_t hash);
+void cuckoo_clear(cuckoo_st *cf);
+size_t cuckoo_size(const cuckoo_st *cf);
+/* Fingerprints it holds at its target load, at least the capacity it was allocated with */
+size_t cuckoo_capacity(const cuckoo_st *cf);
+size_t cuckoo_bytes(const cuckoo_st *cf);
+
+#define BLOOM_CLEANUP  CLEANUP(bloom_free)
+#define CUCKOO_CLEANUP CLEANUP(cuckoo_free)
@@ -8,13 +8,50 @@
  * This is an implementation for a hashtable.
  */
 
+#include <fcntl.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#	include <emmintrin.h>
+#endif
 
 #include "../errstack.h"
+#include "../util.h"
+#include "filter.h"
 
 #define DENSITY_THRESHOLD_UP   (2.0)
 #define DENSITY_THRESHOLD_DOWN (0.25)
+/* Old buckets moved per operation while an HT_INCREMENTAL resize is in flight */
+#define MIGRATE_STEP (16)
+/* Smallest and largest log2 bucket counts of HT_POW2 tables */
+#define POW2_MIN_LOG2 (4)
+#define POW2_MAX_LOG2 (62)
+/* Node slabs start small and double up to this many nodes */
+#define SLAB_MIN_NODES ((size_t) 16)
+#define SLAB_MAX_NODES ((size_t) 4096)
+/* Alignment of HT_INLINE keys and values, and so of every node */
+#define INLINE_ALIGN     (16)
+#define INLINE_ROUND(sz) (((sz) + INLINE_ALIGN - 1) & ~(size_t) (INLINE_ALIGN - 1))
+/* Keys hashed and prefetched per round by the batched calls */
+#define BATCH_CHUNK (16)
+
+/* Filters are sized for twice the entries on every rebuild, and never below FILTER_MIN */
+#define FILTER_MIN          ((size_t) 64)
+#define FILTER_BITS_PER_KEY (10)
+#define FILTER_TRIES        (4)
+
+/* Hot path counters of ht_stats, compiled out unless built with HT_STATS */
+#ifdef HT_STATS
+#	define STAT(statement) (statement)
+#else
+#	define STAT(statement) ((void) 0)
+#endif
 
 static size_t _primes[] = {
     13,
@@ -91,16 +128,37 @@ char *strdup(const char *c)
 };
 #endif
 
+/* hash caches the user hash: resizes never rehash, and most mismatches skip cmp */
 typedef struct _node_s
 {
-	ht_st *owner;
+	size_t hash;
 	void *key;
 	void *value;
 	struct _node_s *next;
 } _node_t;
 
+typedef struct _slab_s
+{
+	struct _slab_s *next;
+	size_t capacity;
+	size_t used;
+	/* Nodes are ht->node_size apart, room for inline keys/values follows each header */
+	uint8_t nodes[] __attribute__((aligned(INLINE_ALIGN)));
+} _slab_t;
+
+/* Key, value and mixed hash share a slot so a hit costs one line past the control bytes */
+typedef struct _slot_s
+{
+	size_t hash;
+	void *key;
+	void *value;
+} _slot_t;
+
 struct ht_s
 {
+	uint32_t flags;
+	size_t iterating;
+
 	size_t key_size;
 	ht_alloc_func_t key_copy;
 	ht_free_func_t key_free;
@@ -109,362 +167,2218 @@ struct ht_s
 	ht_alloc_func_t value_copy;
 	ht_free_func_t value_free;
 
+	/* Exactly one of hash/seeded_hash is set */
 	ht_hash_func_t hash;
+	ht_seeded_hash_func_t seeded_hash;
+	uint64_t seed;
 	ht_cmp_func_t cmp;
 	size_t n_nodes;
 	size_t buckets;
 	_node_t **nodes;
+
+	/* Resize policy. Never shrinks below min_buckets, never when shrink_at is 0 */
+	double grow_at;
+	double shrink_at;
+	size_t min_buckets;
+
+	/*
+	 * Chained nodes are carved out of per table slabs, released nodes are kept for reuse. Slabs
+	 * are only freed by ht_purge/ht_free, so a table going between empty and one entry doesn't
+	 * allocate every time.
+	 */
+	_slab_t *slabs;
+	_node_t *free_nodes;
+	size_t node_size;
+
+	/* HT_INLINE only. Sides stored in the node, key right after the header and value after it */
+	bool inline_key;
+	bool inline_value;
+	size_t value_offset;
+
+	/* HT_INCREMENTAL only. Buckets [migrated, _n_buckets(old_buckets)) still live in old_nodes */
+	_node_t **old_nodes;
+	size_t old_buckets;
+	size_t migrated;
+
+	/* HT_FLAT only. `buckets` holds log2 of the slot count */
+	uint8_t *ctrl;
+	_slot_t *slots;
+	size_t growth_left;
+
+	/*
+	 * HT_FILTER_* only, NULL once dropped. filter_adds counts hashes added since the last
+	 * rebuild (HT_FILTER_CUCKOO: hashes held), the next rebuild is due past filter_capacity.
+	 */
+	bloom_st *bloom;
+	cuckoo_st *cuckoo;
+	size_t filter_adds;
+	size_t filter_capacity;
+
+	/* ht_snapshot_map only. Read only, lookups are served from the mapped file */
+	const struct _snap_header_s *snap;
+	size_t snap_len;
+
+#ifdef HT_STATS
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t filtered;
+	uint64_t probes;
+	uint64_t compares;
+	uint64_t resizes;
+	uint64_t resize_ns;
+#endif
 };
 
-int ht_alloc(ht_st **dst,
-             ht_hash_func_t hash,
-             ht_cmp_func_t cmp,
-             size_t key_size,
-             ht_alloc_func_t key_copy,
-             ht_free_func_t key_free,
-             size_t value_size,
-             ht_alloc_func_t value_copy,
-             ht_free_func_t value_free)
+#define FLAT_GROUP     (16)
+#define FLAT_MIN_LOG2  (4)
+#define FLAT_EMPTY     ((uint8_t) 0x80)
+#define FLAT_DELETED   ((uint8_t) 0xFE)
+#define FLAT_MAX_LOAD(cap) ((cap) - (cap) / 8)
+
+static inline size_t _hash(const ht_st *ht, const void *key)
 {
-	CLEANUP(ht_free) ht_st *tmp;
-	ES_NEW_ASRT_NM(dst);
-	*dst = NULL;
-	ES_NEW_ASRT_NM(hash && cmp);
-	ES_NEW_ASRT_NM(tmp = calloc(1, sizeof(ht_st)));
-	ES_NEW_ASRT_NM(tmp->nodes = calloc(_primes[0], sizeof(_node_t *)));
-	tmp->hash       = hash;
-	tmp->cmp        = cmp;
-	tmp->key_size   = key_size;
-	tmp->key_copy   = key_copy;
-	tmp->key_free   = key_free;
-	tmp->value_size = value_size;
-	tmp->value_copy = value_copy;
-	tmp->value_free = value_free;
-	*dst            = tmp;
-	tmp             = NULL;
-	return 1;
+	if (ht->seeded_hash)
+		return ht->seeded_hash(key, ht->seed);
+	return ht->hash(key);
 }
 
-static void _cleanup_node_key(_node_t **tmp)
+static const void *_snap_find(const ht_st *ht, const void *key);
+static void *_snap_value(const ht_st *ht, const void *rec);
+static void _filter_add(ht_st *ht, size_t hash);
+static void _filter_rebuild(ht_st *ht, size_t capacity);
+
+static inline uint64_t _stat_clock(void)
 {
-	if ((*tmp)->owner->key_free)
-		(*tmp)->owner->key_free((*tmp)->key);
-	else if ((*tmp)->owner->key_size)
-		free((*tmp)->key);
+#ifdef HT_STATS
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+	return 0;
+#endif
 }
 
-static void _cleanup_node_value(_node_t **tmp)
+/* Account time spent moving entries since start, and count a new resize if it began one */
+static inline void _stat_resize(UNUSED ht_st *ht, UNUSED uint64_t start, UNUSED bool began)
 {
-	if ((*tmp)->owner->value_free)
-		(*tmp)->owner->value_free((*tmp)->value);
-	else if ((*tmp)->owner->value_size)
-		free((*tmp)->value);
+	STAT(ht->resize_ns += _stat_clock() - start);
+	STAT(ht->resizes += began);
 }
 
-static void _cleanup_node_util(_node_t **tmp, bool skip_value)
+static inline bool _is_mapped(const ht_st *ht)
 {
-	_node_t *to_del = *tmp;
-	if (*tmp == NULL)
-		return;
+	return ht->snap != NULL;
+}
 
-	_cleanup_node_key(tmp);
-	if (!skip_value) {
-		_cleanup_node_value(tmp);
-	}
+static inline bool _is_flat(const ht_st *ht)
+{
+	return ht->flags & HT_FLAT;
+}
 
-	(*tmp)->owner->n_nodes--;
-	*tmp = (*tmp)->next;
-	free(to_del);
+static inline bool _is_migrating(const ht_st *ht)
+{
+	return ht->old_nodes != NULL;
 }
 
-static void _cleanup_node(_node_t **tmp)
+static inline bool _wants_filter(const ht_st *ht)
 {
-	_cleanup_node_util(tmp, false);
+	return ht->flags & (HT_FILTER_BLOOM | HT_FILTER_CUCKOO);
 }
 
-void ht_purge(ht_st *ht)
+static inline bool _has_filter(const ht_st *ht)
 {
-	size_t i;
-	for (i = 0; i < ht_buckets(ht); i++) {
-		_node_t *next = NULL;
-		while (ht->nodes[i]) {
-			next = ht->nodes[i]->next;
-			_cleanup_node(&(ht->nodes[i]));
-			ht->nodes[i] = next;
-		}
-	}
+	return ht->bloom || ht->cuckoo;
 }
 
-void ht_free(ht_st **to_free)
+/* Final avalanche so weak user hashes still spread over the low and high bits */
+static inline size_t _mix(size_t h)
 {
-	if (to_free && *to_free) {
-		if ((*to_free)->nodes) {
-			ht_purge(*to_free);
-			free((*to_free)->nodes);
-		}
-		free(*to_free);
-		*to_free = NULL;
-	}
+	h ^= h >> 33;
+	h *= UINT64_C(0xff51afd7ed558ccd);
+	h ^= h >> 33;
+	h *= UINT64_C(0xc4ceb9fe1a85ec53);
+	h ^= h >> 33;
+	return h;
+}
+
+/*
+ * Bucket count and bucket index for a chained table at a given size level. Levels index _primes by
+ * default, or are log2 of the bucket count for HT_POW2 where the modulo becomes a mask over the
+ * mixed hash.
+ */
+static inline size_t _n_buckets(const ht_st *ht, size_t level)
+{
+	if (ht->flags & HT_POW2)
+		return (size_t) 1 << level;
+	return _primes[level];
 }
 
-_node_t **_find_node(ht_st *ht, void *key)
+static inline size_t _bucket_of(const ht_st *ht, size_t hash, size_t level)
 {
-	size_t hash    = ht->hash(key) % _primes[ht->buckets];
-	_node_t **head = &(ht->nodes[hash]);
-	while (*head && ht->cmp((*head)->key, key)) {
-		head = &((*head)->next);
-	}
-	return head;
+	if (ht->flags & HT_POW2)
+		return _mix(hash) & (((size_t) 1 << level) - 1);
+	return hash % _primes[level];
 }
 
-void _adjust_by_density(ht_st *ht)
+static void _flat_free_arrays(ht_st *ht)
 {
-	size_t new_bucks    = ht->buckets;
-	_node_t **new_nodes = NULL;
-	size_t i;
+	free(ht->ctrl);
+	free(ht->slots);
+	ht->ctrl  = NULL;
+	ht->slots = NULL;
+}
 
-	if (new_bucks > 0 && ht_density(ht) <= DENSITY_THRESHOLD_DOWN) {
-		new_bucks--;
-	} else if (new_bucks < (ARRAY_SIZE(_primes) - 1) && ht_density(ht) >= DENSITY_THRESHOLD_UP) {
-		new_bucks++;
-	} else {
-		return;
-	}
-	new_nodes = calloc(_primes[new_bucks], sizeof(*new_nodes));
-	if (!new_nodes)
-		return;
-	for (i = 0; i < ht_buckets(ht); i++) {
-		while (ht->nodes[i]) {
-			size_t hash           = ht->hash(ht->nodes[i]->key) % _primes[new_bucks];
-			_node_t *new_next     = new_nodes[hash];
-			new_nodes[hash]       = ht->nodes[i];
-			ht->nodes[i]          = ht->nodes[i]->next;
-			new_nodes[hash]->next = new_next;
-		}
+static int _flat_alloc_arrays(ht_st *ht, size_t log2)
+{
+	size_t cap     = (size_t) 1 << log2;
+	uint8_t *ctrl  = aligned_alloc(FLAT_GROUP, cap);
+	_slot_t *slots = malloc(cap * sizeof(*slots));
+	if (!ctrl || !slots) {
+		free(ctrl);
+		free(slots);
+		ES_NEW_ASRT_NM(false);
 	}
-	free(ht->nodes);
-	ht->nodes   = new_nodes;
-	ht->buckets = new_bucks;
+	memset(ctrl, FLAT_EMPTY, cap);
+	ht->ctrl        = ctrl;
+	ht->slots       = slots;
+	ht->buckets     = log2;
+	ht->growth_left = FLAT_MAX_LOAD(cap) - ht->n_nodes;
+	return 1;
 }
 
-int _new_node(_node_t **cur_node, ht_st *ht, void *key, void *value)
+/* Node stride and value offset for the inline sides chosen */
+static void _node_layout(ht_st *ht)
 {
-	CLEANUP(_cleanup_node) _node_t *tmp = NULL;
-	if (*cur_node) {
-		tmp = *cur_node;
-		_cleanup_node_value(cur_node);
+	ht->value_offset = sizeof(_node_t) + (ht->inline_key ? INLINE_ROUND(ht->key_size) : 0);
+	ht->node_size    = INLINE_ROUND(ht->value_offset + (ht->inline_value ? ht->value_size : 0));
+}
+
+/* Fresh random seed, falls back on clock and address entropy if getrandom is unavailable */
+static uint64_t _random_seed(void)
+{
+	uint64_t seed;
+	struct timespec ts;
+	if (getrandom(&seed, sizeof(seed), GRND_NONBLOCK) == sizeof(seed))
+		return seed;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return _mix((uint64_t) ts.tv_nsec ^ ((uint64_t) ts.tv_sec << 32) ^ (uintptr_t) &ts);
+}
+
+static uint64_t _process_seed;
+
+/* Seeds ht_str_hash/ht_arb_hash_util so key sets flooding one bucket can't be precomputed */
+__attribute__((constructor)) static void _process_seed_init(void)
+{
+	_process_seed = _random_seed();
+}
+
+static int _alloc_util(ht_st **dst,
+                       uint32_t flags,
+                       ht_hash_func_t hash,
+                       ht_seeded_hash_func_t seeded_hash,
+                       ht_cmp_func_t cmp,
+                       size_t key_size,
+                       ht_alloc_func_t key_copy,
+                       ht_free_func_t key_free,
+                       size_t value_size,
+                       ht_alloc_func_t value_copy,
+                       ht_free_func_t value_free)
+{
+	CLEANUP(ht_free) ht_st *tmp = NULL;
+	ES_NEW_ASRT_NM(dst);
+	*dst = NULL;
+	ES_NEW_ASRT_NM((hash || seeded_hash) && cmp);
+	ES_NEW_ASRT((flags & (HT_FLAT | HT_INCREMENTAL)) != (HT_FLAT | HT_INCREMENTAL),
+	            "HT_INCREMENTAL requires the chained layout");
+	ES_NEW_ASRT((flags & (HT_FLAT | HT_INLINE)) != (HT_FLAT | HT_INLINE),
+	            "HT_INLINE requires the chained layout");
+	ES_NEW_ASRT((flags & (HT_FILTER_BLOOM | HT_FILTER_CUCKOO)) !=
+	                (HT_FILTER_BLOOM | HT_FILTER_CUCKOO),
+	            "Only one filter per table");
+	ES_NEW_ASRT_NM(tmp = calloc(1, sizeof(ht_st)));
+	tmp->flags = flags;
+	if (_is_flat(tmp)) {
+		ES_FWD_INT_NM(_flat_alloc_arrays(tmp, FLAT_MIN_LOG2));
 	} else {
-		ES_NEW_ASRT_NM(tmp = calloc(1, sizeof(*tmp)));
-		if (ht->key_copy) {
-			ES_NEW_INT_NM(ht->key_copy(&tmp->key, key));
-		} else if (ht->key_size) {
-			ES_NEW_ASRT_NM(tmp->key = malloc(ht->key_size));
-			memcpy(tmp->key, key, ht->key_size);
-		} else {
-			tmp->key = key;
-		}
+		if (flags & HT_POW2)
+			tmp->buckets = POW2_MIN_LOG2;
+		ES_NEW_ASRT_NM(tmp->nodes = calloc(_n_buckets(tmp, tmp->buckets), sizeof(_node_t *)));
 	}
-	if (ht->value_copy) {
-		ES_FWD_INT_NM(ht->value_copy(&tmp->value, value));
-	} else if (ht->value_size && value != NULL) {
-		/*NULL can't be copied but is still a valid mapping*/
-		ES_NEW_ASRT_NM(tmp->value = malloc(ht->value_size));
-		memcpy(tmp->value, value, ht->value_size);
-	} else {
-		tmp->value = value;
+	if (seeded_hash)
+		tmp->seed = _random_seed();
+	tmp->grow_at     = DENSITY_THRESHOLD_UP;
+	tmp->shrink_at   = DENSITY_THRESHOLD_DOWN;
+	tmp->min_buckets = tmp->buckets;
+	tmp->hash        = hash;
+	tmp->seeded_hash = seeded_hash;
+	tmp->cmp         = cmp;
+	tmp->key_size    = key_size;
+	tmp->key_copy    = key_copy;
+	tmp->key_free    = key_free;
+	tmp->value_size  = value_size;
+	tmp->value_copy  = value_copy;
+	tmp->value_free  = value_free;
+	if (flags & HT_INLINE) {
+		tmp->inline_key   = key_size && !key_copy && !key_free;
+		tmp->inline_value = value_size && !value_copy && !value_free;
 	}
-	*cur_node          = MOVE_PZ(tmp);
-	(*cur_node)->owner = ht;
-	(*cur_node)->owner->n_nodes++;
+	_node_layout(tmp);
+	if (_wants_filter(tmp)) {
+		_filter_rebuild(tmp, 0);
+		ES_NEW_ASRT_NM(_has_filter(tmp));
+	}
+	*dst = tmp;
+	tmp  = NULL;
 	return 1;
 }
 
-int ht_set(ht_st *ht, void *key, void *value)
+int ht_alloc_flags(ht_st **dst,
+                   uint32_t flags,
+                   ht_hash_func_t hash,
+                   ht_cmp_func_t cmp,
+                   size_t key_size,
+                   ht_alloc_func_t key_copy,
+                   ht_free_func_t key_free,
+                   size_t value_size,
+                   ht_alloc_func_t value_copy,
+                   ht_free_func_t value_free)
 {
-	_node_t **head = NULL;
-	int new_node   = false;
-	ES_NEW_ASRT_NM(ht);
-	head     = _find_node(ht, key);
-	new_node = !*head;
-	ES_NEW_INT_NM(_new_node(head, ht, key, value));
-	if (new_node)
-		_adjust_by_density(ht);
-	return new_node;
+	return ES_FWD_INT_NM(_alloc_util(dst,
+	                                 flags,
+	                                 hash,
+	                                 NULL,
+	                                 cmp,
+	                                 key_size,
+	                                 key_copy,
+	                                 key_free,
+	                                 value_size,
+	                                 value_copy,
+	                                 value_free));
 }
 
-/**
- * Expose the underlying value pointer for the given key. This value will follow the same semantics
- * as all other values. User must obey freeing semantics. i.e., value created must be safe to pass
- * to `value_free` if applicable, else must be able to `free` it if applicable, else always safe.
- *
- * @returns a pointer to the value in the k/v pair. NULL on allocation failure.
- */
-void **ht_emplace(ht_st *ht, void *key)
+int ht_alloc_seeded(ht_st **dst,
+                    uint32_t flags,
+                    ht_seeded_hash_func_t hash,
+                    ht_cmp_func_t cmp,
+                    size_t key_size,
+                    ht_alloc_func_t key_copy,
+                    ht_free_func_t key_free,
+                    size_t value_size,
+                    ht_alloc_func_t value_copy,
+                    ht_free_func_t value_free)
 {
-	_node_t **head = NULL;
-	int new_node   = false;
-	if (!ht) {
-		return NULL;
-	}
-	head     = _find_node(ht, key);
-	new_node = !*head;
-	if (_new_node(head, ht, key, NULL) < 0) {
-		return NULL;
-	}
-	if (new_node)
-		_adjust_by_density(ht);
-	return &(*head)->value;
+	return ES_FWD_INT_NM(_alloc_util(dst,
+	                                 flags,
+	                                 NULL,
+	                                 hash,
+	                                 cmp,
+	                                 key_size,
+	                                 key_copy,
+	                                 key_free,
+	                                 value_size,
+	                                 value_copy,
+	                                 value_free));
 }
 
-bool ht_has(ht_st *ht, const void *key)
+int ht_alloc(ht_st **dst,
+             ht_hash_func_t hash,
+             ht_cmp_func_t cmp,
+             size_t key_size,
+             ht_alloc_func_t key_copy,
+             ht_free_func_t key_free,
+             size_t value_size,
+             ht_alloc_func_t value_copy,
+             ht_free_func_t value_free)
 {
-	size_t hash;
-	_node_t **head = NULL;
-	hash           = ht->hash(key) % _primes[ht->buckets];
-	head           = &(ht->nodes[hash]);
-	while (*head && ht->cmp((*head)->key, key)) {
-		head = &((*head)->next);
-	}
-	return !!*head;
+	return ht_alloc_flags(dst,
+	                      HT_DEFAULT,
+	                      hash,
+	                      cmp,
+	                      key_size,
+	                      key_copy,
+	                      key_free,
+	                      value_size,
+	                      value_copy,
+	                      value_free);
 }
 
-void *ht_get(ht_st *ht, const void *key)
+static void _free_key(ht_st *ht, void *key)
 {
-	size_t hash;
-	_node_t **head = NULL;
-	hash           = ht->hash(key) % _primes[ht->buckets];
-	head           = &(ht->nodes[hash]);
-	while (*head && ht->cmp((*head)->key, key)) {
-		head = &((*head)->next);
+	if (ht->inline_key) {
+		/* Only what the key owns, its storage belongs to the node */
+		if (ht->key_free)
+			ht->key_free(key);
+		return;
 	}
-	if (!*head)
-		return NULL;
-	return (*head)->value;
+	if (ht->key_free)
+		ht->key_free(key);
+	else if (ht->key_size)
+		free(key);
 }
 
-void *ht_take(ht_st *ht, void *key)
+static void _free_value(ht_st *ht, void *value)
 {
-	_node_t **head    = _find_node(ht, key);
-	_node_t *ret_node = *head;
-	if (ret_node) {
-		void *ret = ret_node->value;
-		*head     = ret_node->next;
-		_cleanup_node_util(head, true);
-		_adjust_by_density(ht);
-		return ret;
+	if (ht->inline_value)
+		return;
+	if (ht->value_free)
+		ht->value_free(value);
+	else if (ht->value_size)
+		free(value);
+}
+
+/* Inline sides copy into the storage *dst already points at */
+static int _copy_key(ht_st *ht, void **dst, void *key)
+{
+	if (ht->inline_key && ht->key_copy) {
+		ES_NEW_INT_NM(ht->key_copy(dst, key));
+	} else if (ht->inline_key) {
+		memcpy(*dst, key, ht->key_size);
+	} else if (ht->key_copy) {
+		ES_NEW_INT_NM(ht->key_copy(dst, key));
+	} else if (ht->key_size) {
+		ES_NEW_ASRT_NM(*dst = malloc(ht->key_size));
+		memcpy(*dst, key, ht->key_size);
+	} else {
+		*dst = key;
 	}
-	return NULL;
+	return 1;
 }
 
-void ht_delete(ht_st *ht, void *key)
+static int _copy_value(ht_st *ht, void **dst, void *value)
 {
-	_node_t **head = _find_node(ht, key);
-	if (*head) {
-		_cleanup_node(head);
-		_adjust_by_density(ht);
+	if (ht->inline_value) {
+		if (value)
+			memcpy(*dst, value, ht->value_size);
+		else
+			memset(*dst, 0, ht->value_size);
+	} else if (ht->value_copy) {
+		ES_FWD_INT_NM(ht->value_copy(dst, value));
+	} else if (ht->value_size && value != NULL) {
+		/*NULL can't be copied but is still a valid mapping*/
+		ES_NEW_ASRT_NM(*dst = malloc(ht->value_size));
+		memcpy(*dst, value, ht->value_size);
+	} else {
+		*dst = value;
 	}
-	return;
+	return 1;
 }
 
-/* Self deletion safe. NOT arbitrary deletion safe.*/
-int ht_foreach(ht_st *ht, ht_foreach_func_t body, void *data)
+/* Does any key or value need to be released when its node goes away */
+static inline bool _owns_kv(const ht_st *ht)
 {
-	size_t i;
+	return ht->key_free || (ht->key_size && !ht->inline_key) || ht->value_free ||
+	       (ht->value_size && !ht->inline_value);
+}
 
-	ES_NEW_ASRT_NM(ht);
-	for (i = 0; i < ht_buckets(ht); i++) {
-		_node_t **head = &(ht->nodes[i]);
-		while (*head) {
-			int ret;
-			_node_t *post;
-			_node_t *pre = *head;
-			ES_NEW_INT_NM(ret = body(ht, (*head)->key, (*head)->value, data));
-			post = *head;
-			if (ret == 0)
-				return 0;
-			/* Case when body didn't delete the iterated node*/
-			if (pre == post)
-				head = &(*head)->next;
+static _node_t *_node_alloc(ht_st *ht)
+{
+	_node_t *node = ht->free_nodes;
+	if (node) {
+		ht->free_nodes = node->next;
+	} else {
+		if (!ht->slabs || ht->slabs->used == ht->slabs->capacity) {
+			size_t cap = SLAB_MIN_NODES;
+			_slab_t *slab;
+			if (ht->slabs)
+				cap = MIN(ht->slabs->capacity * 2, SLAB_MAX_NODES);
+			slab = aligned_alloc(INLINE_ALIGN, sizeof(*slab) + cap * ht->node_size);
+			if (!slab)
+				return NULL;
+			slab->next     = ht->slabs;
+			slab->capacity = cap;
+			slab->used     = 0;
+			ht->slabs      = slab;
 		}
+		node = (_node_t *) &ht->slabs->nodes[ht->slabs->used++ * ht->node_size];
 	}
-	return 1;
+	memset(node, 0, sizeof(*node));
+	if (ht->inline_key)
+		node->key = (uint8_t *) node + sizeof(_node_t);
+	if (ht->inline_value)
+		node->value = (uint8_t *) node + ht->value_offset;
+	return node;
 }
 
-size_t ht_buckets(ht_st *ht)
+static void _node_release(ht_st *ht, _node_t *node)
 {
-	return _primes[ht->buckets];
+	node->next     = ht->free_nodes;
+	ht->free_nodes = node;
 }
 
-size_t ht_size(ht_st *ht)
+static void _slabs_free(ht_st *ht)
 {
-	return ht->n_nodes;
+	while (ht->slabs) {
+		_slab_t *next = ht->slabs->next;
+		free(ht->slabs);
+		ht->slabs = next;
+	}
+	ht->free_nodes = NULL;
 }
 
-double ht_density(ht_st *ht)
+static void _cleanup_node_key(ht_st *ht, _node_t **tmp)
 {
-	return (double) ht->n_nodes / _primes[ht->buckets];
+	_free_key(ht, (*tmp)->key);
 }
 
-size_t ht_int_hash(const void *key)
+static void _cleanup_node_value(ht_st *ht, _node_t **tmp)
 {
-	uint64_t x = (uint64_t) key;
-	x          = (x ^ (x >> 31) ^ (x >> 62)) * UINT64_C(0x319642b2d24d8ec3);
-	x          = (x ^ (x >> 27) ^ (x >> 54)) * UINT64_C(0x96de1b173f119089);
-	x          = x ^ (x >> 30) ^ (x >> 60);
-	return x;
+	_free_value(ht, (*tmp)->value);
 }
 
-int64_t ht_int_cmp(const void *key1, const void *key2)
+static void _cleanup_node_util(ht_st *ht, _node_t **tmp, bool skip_value)
 {
-	return key2 - key1;
+	_node_t *to_del = *tmp;
+	if (*tmp == NULL)
+		return;
+
+	_cleanup_node_key(ht, tmp);
+	if (!skip_value) {
+		_cleanup_node_value(ht, tmp);
+	}
+
+	ht->n_nodes--;
+	*tmp = (*tmp)->next;
+	_node_release(ht, to_del);
 }
 
-size_t ht_str_hash(const void *k)
+static void _cleanup_node(ht_st *ht, _node_t **tmp)
 {
-	uint64_t hash = 5381UL;
-	int c;
-	const char *key = k;
+	_cleanup_node_util(ht, tmp, false);
+}
 
-	while ((c = *key++))
-		hash = ((hash << 5) + hash) + c;
+/*
+ * Open addressing (HT_FLAT)
+ *
+ * Slots are split into aligned groups of FLAT_GROUP control bytes. A control byte is either
+ * FLAT_EMPTY, FLAT_DELETED or the low 7 bits of the (mixed) hash for a full slot, so one SSE2
+ * compare filters a whole group before any key is touched. Groups are probed triangularly, which
+ * visits every group once for power of two group counts. A probe stops at the first group holding
+ * an empty slot.
+ */
 
-	return hash;
+static inline uint32_t _group_match(const uint8_t *group, uint8_t byte)
+{
+#ifdef __SSE2__
+	__m128i ctrl = _mm_load_si128((const __m128i *) group);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(byte)));
+#else
+	uint32_t mask = 0;
+	size_t i;
+	for (i = 0; i < FLAT_GROUP; i++) {
+		mask |= (uint32_t) (group[i] == byte) << i;
+	}
+	return mask;
+#endif
 }
 
-int64_t ht_str_cmp(const void *k1, const void *k2)
+/* Empty or deleted slots are exactly the ones with the high bit set */
+static inline uint32_t _group_match_free(const uint8_t *group)
 {
-	const char *key1 = k1, *key2 = k2;
-	return strcmp(key1, key2);
+#ifdef __SSE2__
+	return _mm_movemask_epi8(_mm_load_si128((const __m128i *) group));
+#else
+	uint32_t mask = 0;
+	size_t i;
+	for (i = 0; i < FLAT_GROUP; i++) {
+		mask |= (uint32_t) (group[i] >> 7) << i;
+	}
+	return mask;
+#endif
 }
 
-int ht_str_copy(void **dst, void *key)
+static inline size_t _flat_cap(const ht_st *ht)
 {
-	if (key == NULL) {
-		*dst = NULL;
-		return 1;
-	}
-	char *new_key = strdup((char *) key);
-	ES_NEW_ASRT_NM(new_key);
-	*dst = new_key;
-	return 1;
+	return (size_t) 1 << ht->buckets;
 }
 
-void ht_str_free(void *key)
+static inline size_t _flat_group_mask(const ht_st *ht)
 {
-	if (key)
-		free(key);
+	return (_flat_cap(ht) / FLAT_GROUP) - 1;
 }
 
-size_t ht_arb_hash_util(void *key, size_t size)
+static size_t _flat_find(ht_st *ht, const void *key, size_t hash)
 {
-	size_t hash   = 5381;
-	uint8_t *data = key;
-	for (; size != 0; size--, data++) {
-		hash = ((hash << 5) + hash) ^ *data;
+	const size_t mask = _flat_group_mask(ht);
+	const uint8_t h2  = hash & 0x7F;
+	size_t group      = (hash >> 7) & mask;
+	size_t step;
+	for (step = 1; step <= mask + 1; step++) {
+		const uint8_t *ctrl = &ht->ctrl[group * FLAT_GROUP];
+		uint32_t match      = _group_match(ctrl, h2);
+		STAT(ht->probes++);
+		while (match) {
+			size_t slot = group * FLAT_GROUP + __builtin_ctz(match);
+			if (ht->slots[slot].hash == hash) {
+				STAT(ht->compares++);
+				if (!ht->cmp(ht->slots[slot].key, key)) {
+					STAT(ht->hits++);
+					return slot;
+				}
+			}
+			match &= match - 1;
+		}
+		if (_group_match(ctrl, FLAT_EMPTY)) {
+			break;
+		}
+		group = (group + step) & mask;
 	}
-	return hash;
+	STAT(ht->misses++);
+	return SIZE_MAX;
 }
-int64_t ht_arb_cmp_util(void *key1, void *key2, size_t size)
+
+/* First free slot on the probe sequence of hash. The table always holds at least one. */
+static size_t _flat_find_free(const ht_st *ht, size_t hash)
 {
-	return memcmp(key1, key2, size);
+	const size_t mask = _flat_group_mask(ht);
+	size_t group      = (hash >> 7) & mask;
+	size_t step;
+	for (step = 1;; step++) {
+		uint32_t match = _group_match_free(&ht->ctrl[group * FLAT_GROUP]);
+		if (match) {
+			return group * FLAT_GROUP + __builtin_ctz(match);
+		}
+		group = (group + step) & mask;
+	}
+}
+
+static int _flat_resize(ht_st *ht, size_t new_log2)
+{
+	uint8_t *old_ctrl  = ht->ctrl;
+	_slot_t *old_slots = ht->slots;
+	size_t old_cap     = _flat_cap(ht);
+	uint64_t start     = _stat_clock();
+	size_t i;
+
+	ES_FWD_INT_NM(_flat_alloc_arrays(ht, new_log2));
+	for (i = 0; i < old_cap; i++) {
+		size_t hash, slot;
+		if (old_ctrl[i] & 0x80)
+			continue;
+		hash            = old_slots[i].hash;
+		slot            = _flat_find_free(ht, hash);
+		ht->ctrl[slot]  = hash & 0x7F;
+		ht->slots[slot] = old_slots[i];
+	}
+	free(old_ctrl);
+	free(old_slots);
+	_stat_resize(ht, start, true);
+	return 1;
+}
+
+/* Make room for one more entry: drop tombstones if they hold at least half the load, else grow */
+static int _flat_reserve_one(ht_st *ht)
+{
+	size_t cap = _flat_cap(ht);
+	if (ht->growth_left > 0)
+		return 1;
+	if (ht->n_nodes <= FLAT_MAX_LOAD(cap) / 2) {
+		ES_FWD_INT_NM(_flat_resize(ht, ht->buckets));
+	} else {
+		ES_FWD_INT_NM(_flat_resize(ht, ht->buckets + 1));
+	}
+	return 1;
+}
+
+/* Find or insert the slot for key given its mixed hash. Returns the slot, and if it was created */
+static int _flat_upsert(ht_st *ht, void *key, void *value, size_t hash, size_t *slot_out)
+{
+	size_t slot = _flat_find(ht, key, hash);
+	void *new_value;
+
+	if (slot != SIZE_MAX) {
+		ES_FWD_INT_NM(_copy_value(ht, &new_value, value));
+		_free_value(ht, ht->slots[slot].value);
+		ht->slots[slot].value = new_value;
+		*slot_out             = slot;
+		return 0;
+	}
+	ES_FWD_INT_NM(_flat_reserve_one(ht));
+	slot = _flat_find_free(ht, hash);
+	ES_FWD_INT_NM(_copy_key(ht, &ht->slots[slot].key, key));
+	if (_copy_value(ht, &ht->slots[slot].value, value) < 0) {
+		_free_key(ht, ht->slots[slot].key);
+		ES_FWD_INT_NM(-1);
+	}
+	if (ht->ctrl[slot] == FLAT_EMPTY)
+		ht->growth_left--;
+	ht->slots[slot].hash = hash;
+	ht->ctrl[slot]       = hash & 0x7F;
+	ht->n_nodes++;
+	_filter_add(ht, hash);
+	*slot_out = slot;
+	return 1;
+}
+
+static void _flat_erase(ht_st *ht, size_t slot)
+{
+	size_t group_start = slot & ~(size_t) (FLAT_GROUP - 1);
+	/*
+	 * If this group still has an empty slot no probe ever continued past it, so the slot can go
+	 * back to empty instead of leaving a tombstone.
+	 */
+	if (_group_match(&ht->ctrl[group_start], FLAT_EMPTY)) {
+		ht->ctrl[slot] = FLAT_EMPTY;
+		ht->growth_left++;
+	} else {
+		ht->ctrl[slot] = FLAT_DELETED;
+	}
+	ht->n_nodes--;
+}
+
+static void _flat_purge(ht_st *ht)
+{
+	size_t i;
+	for (i = 0; i < _flat_cap(ht); i++) {
+		if (ht->ctrl[i] & 0x80)
+			continue;
+		_free_key(ht, ht->slots[i].key);
+		_free_value(ht, ht->slots[i].value);
+	}
+	memset(ht->ctrl, FLAT_EMPTY, _flat_cap(ht));
+	ht->n_nodes     = 0;
+	ht->growth_left = FLAT_MAX_LOAD(_flat_cap(ht));
+}
+
+static void _purge_buckets(ht_st *ht, _node_t **nodes, size_t from, size_t to)
+{
+	size_t i;
+	for (i = from; i < to; i++) {
+		_node_t *next = NULL;
+		while (nodes[i]) {
+			next = nodes[i]->next;
+			_cleanup_node(ht, &(nodes[i]));
+			nodes[i] = next;
+		}
+	}
+}
+
+/*
+ * Drop every node. Nodes only have to be visited when their keys or values need releasing,
+ * otherwise the slabs are dropped whole. Bucket heads are cleared only when the table lives on.
+ */
+static void _chained_purge(ht_st *ht, bool reset_buckets)
+{
+	if (_is_migrating(ht)) {
+		if (_owns_kv(ht))
+			_purge_buckets(ht, ht->old_nodes, ht->migrated, _n_buckets(ht, ht->old_buckets));
+		free(MOVE_PZ(ht->old_nodes));
+	}
+	if (_owns_kv(ht)) {
+		_purge_buckets(ht, ht->nodes, 0, ht_buckets(ht));
+	} else if (reset_buckets) {
+		memset(ht->nodes, 0, ht_buckets(ht) * sizeof(*ht->nodes));
+	}
+	_slabs_free(ht);
+	ht->n_nodes = 0;
+}
+
+void ht_purge(ht_st *ht)
+{
+	if (_is_mapped(ht))
+		return;
+	if (_is_flat(ht))
+		_flat_purge(ht);
+	else
+		_chained_purge(ht, true);
+	/* Also brings back a filter that had been dropped */
+	if (_wants_filter(ht))
+		_filter_rebuild(ht, 0);
+}
+
+void ht_free(ht_st **to_free)
+{
+	if (to_free && *to_free) {
+		bloom_free(&(*to_free)->bloom);
+		cuckoo_free(&(*to_free)->cuckoo);
+		if ((*to_free)->ctrl) {
+			_flat_purge(*to_free);
+			_flat_free_arrays(*to_free);
+		}
+		if ((*to_free)->nodes) {
+			_chained_purge(*to_free, false);
+			free((*to_free)->nodes);
+		}
+		if ((*to_free)->snap)
+			munmap((void *) (*to_free)->snap, (*to_free)->snap_len);
+		free(*to_free);
+		*to_free = NULL;
+	}
+}
+
+/*
+ * Move a bounded number of buckets out of the old array. Ends the migration once the old array is
+ * drained. Never runs under ht_foreach so iteration sees a stable pair of arrays.
+ */
+static void _migrate_step(ht_st *ht)
+{
+	size_t old_size = _n_buckets(ht, ht->old_buckets);
+	uint64_t start;
+	size_t end;
+	if (!_is_migrating(ht) || ht->iterating)
+		return;
+	start = _stat_clock();
+	end   = MIN(ht->migrated + MIGRATE_STEP, old_size);
+	for (; ht->migrated < end; ht->migrated++) {
+		_node_t **old = &ht->old_nodes[ht->migrated];
+		while (*old) {
+			_node_t *node   = *old;
+			size_t hash     = _bucket_of(ht, node->hash, ht->buckets);
+			*old            = node->next;
+			node->next      = ht->nodes[hash];
+			ht->nodes[hash] = node;
+		}
+	}
+	if (ht->migrated == old_size) {
+		free(MOVE_PZ(ht->old_nodes));
+	}
+	_stat_resize(ht, start, false);
+}
+
+/* The chain holding hash. Mid migration that is the old bucket until it has been moved. */
+static _node_t **_bucket_head(const ht_st *ht, size_t hash)
+{
+	if (_is_migrating(ht)) {
+		size_t old_hash = _bucket_of(ht, hash, ht->old_buckets);
+		if (old_hash >= ht->migrated)
+			return &(ht->old_nodes[old_hash]);
+	}
+	return &(ht->nodes[_bucket_of(ht, hash, ht->buckets)]);
+}
+
+_node_t **_find_node(ht_st *ht, const void *key, size_t hash)
+{
+	_node_t **head = _bucket_head(ht, hash);
+	for (; *head; head = &((*head)->next)) {
+		STAT(ht->probes++);
+		if ((*head)->hash != hash)
+			continue;
+		STAT(ht->compares++);
+		if (!ht->cmp((*head)->key, key))
+			break;
+	}
+	STAT(*head ? ht->hits++ : ht->misses++);
+	return head;
+}
+
+/*
+ * Filters (HT_FILTER_*)
+ *
+ * Keyed on the stored hash (mixed for HT_FLAT), so resizes and migrations leave the filter valid.
+ * It is only rebuilt once it fills up, from the hashes the table keeps anyway. A filter can't
+ * give false negatives, so one that fails to rebuild is dropped rather than left partial.
+ */
+
+/* True if the filter rules key out, the lookup counts as a miss without touching the table */
+static inline bool _filter_rejects(ht_st *ht, size_t hash)
+{
+	bool absent = (ht->bloom && !bloom_may_contain(ht->bloom, hash)) ||
+	              (ht->cuckoo && !cuckoo_may_contain(ht->cuckoo, hash));
+	STAT(ht->misses += absent);
+	STAT(ht->filtered += absent);
+	return absent;
+}
+
+static bool _filter_insert(ht_st *ht, size_t hash)
+{
+	if (ht->bloom) {
+		bloom_add(ht->bloom, hash);
+		return true;
+	}
+	return cuckoo_add(ht->cuckoo, hash) > 0;
+}
+
+static bool _filter_fill_chains(ht_st *ht, _node_t **nodes, size_t from, size_t to)
+{
+	size_t i;
+	for (i = from; i < to; i++) {
+		const _node_t *node;
+		for (node = nodes[i]; node; node = node->next) {
+			if (!_filter_insert(ht, node->hash))
+				return false;
+		}
+	}
+	return true;
+}
+
+static bool _filter_fill(ht_st *ht)
+{
+	size_t i;
+	if (_is_flat(ht)) {
+		for (i = 0; i < _flat_cap(ht); i++) {
+			if (!(ht->ctrl[i] & 0x80) && !_filter_insert(ht, ht->slots[i].hash))
+				return false;
+		}
+		return true;
+	}
+	if (_is_migrating(ht) &&
+	    !_filter_fill_chains(ht, ht->old_nodes, ht->migrated, _n_buckets(ht, ht->old_buckets)))
+		return false;
+	return _filter_fill_chains(ht, ht->nodes, 0, ht_buckets(ht));
+}
+
+/*
+ * Replace the filter with one sized for capacity entries holding every stored hash. Keys sharing
+ * hashes can overflow a cuckoo filter of any size, after FILTER_TRIES doublings the table goes
+ * without one.
+ */
+static void _filter_rebuild(ht_st *ht, size_t capacity)
+{
+	size_t tries;
+	bloom_free(&ht->bloom);
+	cuckoo_free(&ht->cuckoo);
+	capacity = MAX(capacity, FILTER_MIN);
+	for (tries = 0; tries < FILTER_TRIES; tries++, capacity *= 2) {
+		if (ht->flags & HT_FILTER_BLOOM) {
+			if (bloom_alloc(&ht->bloom, capacity, FILTER_BITS_PER_KEY) < 0)
+				return;
+			ht->filter_capacity = capacity;
+		} else {
+			if (cuckoo_alloc(&ht->cuckoo, capacity) < 0)
+				return;
+			ht->filter_capacity = cuckoo_capacity(ht->cuckoo);
+		}
+		ht->filter_adds = ht->n_nodes;
+		if (_filter_fill(ht))
+			return;
+		cuckoo_free(&ht->cuckoo);
+	}
+}
+
+/* Called once hash is stored and counted */
+static void _filter_add(ht_st *ht, size_t hash)
+{
+	if (!_has_filter(ht))
+		return;
+	if (++ht->filter_adds <= ht->filter_capacity && _filter_insert(ht, hash))
+		return;
+	/*
+	 * Bloom filters also hold the bits of deleted entries, rebuilding at twice the entries bounds
+	 * those and spreads the cost over as many inserts. Cuckoo filters go one size up.
+	 */
+	if (ht->bloom)
+		_filter_rebuild(ht, 2 * ht->n_nodes);
+	else
+		_filter_rebuild(ht, MAX(ht->n_nodes, ht->filter_capacity + 1));
+}
+
+static void _filter_remove(ht_st *ht, size_t hash)
+{
+	if (ht->cuckoo && cuckoo_remove(ht->cuckoo, hash))
+		ht->filter_adds--;
+}
+
+/* Size the filter for n entries up front, so the inserts that follow need no rebuilds */
+static void _filter_reserve(ht_st *ht, size_t n)
+{
+	if (_has_filter(ht) && n > ht->filter_capacity)
+		_filter_rebuild(ht, n);
+}
+
+static inline size_t _max_level(const ht_st *ht)
+{
+	if (_is_flat(ht) || (ht->flags & HT_POW2))
+		return POW2_MAX_LOG2;
+	return ARRAY_SIZE(_primes) - 1;
+}
+
+static inline bool _should_shrink(ht_st *ht)
+{
+	return ht->shrink_at > 0 && ht->buckets > ht->min_buckets && ht_density(ht) <= ht->shrink_at;
+}
+
+/* Move every node into a fresh bucket array in one go */
+static int _chained_rehash(ht_st *ht, size_t new_bucks)
+{
+	_node_t **new_nodes = NULL;
+	uint64_t start      = _stat_clock();
+	size_t i;
+	ES_NEW_ASRT_NM(new_nodes = calloc(_n_buckets(ht, new_bucks), sizeof(*new_nodes)));
+	for (i = 0; i < ht_buckets(ht); i++) {
+		while (ht->nodes[i]) {
+			size_t hash           = _bucket_of(ht, ht->nodes[i]->hash, new_bucks);
+			_node_t *new_next     = new_nodes[hash];
+			new_nodes[hash]       = ht->nodes[i];
+			ht->nodes[i]          = ht->nodes[i]->next;
+			new_nodes[hash]->next = new_next;
+		}
+	}
+	free(ht->nodes);
+	ht->nodes   = new_nodes;
+	ht->buckets = new_bucks;
+	_stat_resize(ht, start, true);
+	return 1;
+}
+
+void _adjust_by_density(ht_st *ht)
+{
+	size_t new_bucks    = ht->buckets;
+	_node_t **new_nodes = NULL;
+
+	/* Resizing would pull the buckets out from under ht_foreach */
+	if (ht->iterating)
+		return;
+	if (_is_flat(ht)) {
+		/* Growth happens on insert, only shrink here */
+		if (_should_shrink(ht))
+			_flat_resize(ht, new_bucks - 1);
+		return;
+	}
+	/* One resize at a time, the next is decided once the old array is drained */
+	if (_is_migrating(ht))
+		return;
+	if (_should_shrink(ht)) {
+		new_bucks--;
+	} else if (new_bucks < _max_level(ht) && ht_density(ht) >= ht->grow_at) {
+		new_bucks++;
+	} else {
+		return;
+	}
+	if (!(ht->flags & HT_INCREMENTAL)) {
+		_chained_rehash(ht, new_bucks);
+		return;
+	}
+	new_nodes = calloc(_n_buckets(ht, new_bucks), sizeof(*new_nodes));
+	if (!new_nodes)
+		return;
+	ht->old_nodes   = ht->nodes;
+	ht->old_buckets = ht->buckets;
+	ht->migrated    = 0;
+	ht->nodes       = new_nodes;
+	ht->buckets     = new_bucks;
+	STAT(ht->resizes++);
+}
+
+/* Smallest level holding n entries without crossing the grow threshold */
+static size_t _level_for(const ht_st *ht, size_t n)
+{
+	size_t level = ht->min_buckets;
+	while (level < _max_level(ht)) {
+		if (_is_flat(ht) && n <= FLAT_MAX_LOAD((size_t) 1 << level))
+			break;
+		if (!_is_flat(ht) && (double) n < ht->grow_at * _n_buckets(ht, level))
+			break;
+		level++;
+	}
+	return level;
+}
+
+/* Resize straight to level if the table is smaller. Finishes a pending migration first. */
+static int _grow_to(ht_st *ht, size_t level)
+{
+	ES_NEW_ASRT(!ht->iterating, "Can't resize under ht_foreach");
+	if (level <= ht->buckets)
+		return 1;
+	if (_is_flat(ht))
+		return ES_FWD_INT_NM(_flat_resize(ht, level));
+	while (_is_migrating(ht)) {
+		_migrate_step(ht);
+	}
+	return ES_FWD_INT_NM(_chained_rehash(ht, level));
+}
+
+int ht_reserve(ht_st *ht, size_t n)
+{
+	size_t level;
+	ES_NEW_ASRT_NM(ht && !_is_mapped(ht));
+	level = _level_for(ht, n);
+	ES_FWD_INT_NM(_grow_to(ht, level));
+	ht->min_buckets = level;
+	_filter_reserve(ht, n);
+	return 1;
+}
+
+int ht_set_thresholds(ht_st *ht, double grow, double shrink)
+{
+	double grow_at;
+	ES_NEW_ASRT_NM(ht);
+	grow_at = _is_flat(ht) ? (double) FLAT_MAX_LOAD(8) / 8 : grow;
+	ES_NEW_ASRT(grow > 0 && shrink >= 0, "Thresholds must be positive");
+	/* A resize doubles or halves the density, it must not land past the opposite threshold */
+	ES_NEW_ASRT(shrink * 2 < grow_at, "Shrink %f too close to grow %f", shrink, grow_at);
+	ht->grow_at   = grow;
+	ht->shrink_at = shrink;
+	return 1;
+}
+
+int _new_node(_node_t **cur_node, ht_st *ht, void *key, void *value, size_t hash)
+{
+	_node_t *tmp    = NULL;
+	void *new_value = NULL;
+	if (*cur_node) {
+		if (ht->inline_value)
+			new_value = (*cur_node)->value;
+		ES_FWD_INT_NM(_copy_value(ht, &new_value, value));
+		_cleanup_node_value(ht, cur_node);
+		(*cur_node)->value = new_value;
+		return 1;
+	}
+	ES_NEW_ASRT_NM(tmp = _node_alloc(ht));
+	if (_copy_key(ht, &tmp->key, key) < 0) {
+		_node_release(ht, tmp);
+		ES_FWD_INT_NM(-1);
+	}
+	if (_copy_value(ht, &tmp->value, value) < 0) {
+		_free_key(ht, tmp->key);
+		_node_release(ht, tmp);
+		ES_FWD_INT_NM(-1);
+	}
+	tmp->hash = hash;
+	*cur_node = tmp;
+	ht->n_nodes++;
+	_filter_add(ht, hash);
+	return 1;
+}
+
+static int _chained_set(ht_st *ht, void *key, void *value, size_t hash)
+{
+	_node_t **head = NULL;
+	int new_node   = false;
+	_migrate_step(ht);
+	head     = _find_node(ht, key, hash);
+	new_node = !*head;
+	ES_NEW_INT_NM(_new_node(head, ht, key, value, hash));
+	if (new_node)
+		_adjust_by_density(ht);
+	return new_node;
+}
+
+int ht_set(ht_st *ht, void *key, void *value)
+{
+	ES_NEW_ASRT(ht && !_is_mapped(ht), "Snapshots are read only");
+	if (_is_flat(ht)) {
+		size_t slot;
+		return ES_FWD_INT_NM(_flat_upsert(ht, key, value, _mix(_hash(ht, key)), &slot));
+	}
+	return ES_FWD_INT_NM(_chained_set(ht, key, value, _hash(ht, key)));
+}
+
+/**
+ * Expose the underlying value pointer for the given key. This value will follow the same semantics
+ * as all other values. User must obey freeing semantics. i.e., value created must be safe to pass
+ * to `value_free` if applicable, else must be able to `free` it if applicable, else always safe.
+ * For HT_FLAT tables the returned pointer is only valid until the next insertion or deletion.
+ *
+ * @returns a pointer to the value in the k/v pair. NULL on allocation failure.
+ */
+void **ht_emplace(ht_st *ht, void *key)
+{
+	_node_t **head = NULL;
+	int new_node   = false;
+	size_t hash;
+	if (!ht || _is_mapped(ht)) {
+		return NULL;
+	}
+	if (_is_flat(ht)) {
+		size_t slot;
+		if (_flat_upsert(ht, key, NULL, _mix(_hash(ht, key)), &slot) < 0) {
+			return NULL;
+		}
+		return &ht->slots[slot].value;
+	}
+	_migrate_step(ht);
+	hash     = _hash(ht, key);
+	head     = _find_node(ht, key, hash);
+	new_node = !*head;
+	if (_new_node(head, ht, key, NULL, hash) < 0) {
+		return NULL;
+	}
+	if (new_node)
+		_adjust_by_density(ht);
+	return &(*head)->value;
+}
+
+/* Stored hash of key, mixed for HT_FLAT tables */
+static inline size_t _hash_of(const ht_st *ht, const void *key)
+{
+	return _is_flat(ht) ? _mix(_hash(ht, key)) : _hash(ht, key);
+}
+
+bool ht_has(ht_st *ht, const void *key)
+{
+	_node_t **head = NULL;
+	size_t hash;
+	if (_is_mapped(ht))
+		return _snap_find(ht, key) != NULL;
+	/* Migration steps go on while the filter answers */
+	_migrate_step(ht);
+	hash = _hash_of(ht, key);
+	if (_filter_rejects(ht, hash))
+		return false;
+	if (_is_flat(ht)) {
+		return _flat_find(ht, key, hash) != SIZE_MAX;
+	}
+	head = _find_node(ht, key, hash);
+	return !!*head;
+}
+
+void *ht_get(ht_st *ht, const void *key)
+{
+	_node_t **head = NULL;
+	size_t hash;
+	if (_is_mapped(ht))
+		return _snap_value(ht, _snap_find(ht, key));
+	_migrate_step(ht);
+	hash = _hash_of(ht, key);
+	if (_filter_rejects(ht, hash))
+		return NULL;
+	if (_is_flat(ht)) {
+		size_t slot = _flat_find(ht, key, hash);
+		return slot == SIZE_MAX ? NULL : ht->slots[slot].value;
+	}
+	head = _find_node(ht, key, hash);
+	if (!*head)
+		return NULL;
+	return (*head)->value;
+}
+
+void *ht_take(ht_st *ht, void *key)
+{
+	_node_t **head;
+	_node_t *ret_node;
+	size_t hash;
+	if (_is_mapped(ht))
+		return NULL;
+	_migrate_step(ht);
+	hash = _hash_of(ht, key);
+	if (_filter_rejects(ht, hash))
+		return NULL;
+	if (_is_flat(ht)) {
+		size_t slot = _flat_find(ht, key, hash);
+		void *ret;
+		if (slot == SIZE_MAX)
+			return NULL;
+		ret = ht->slots[slot].value;
+		_free_key(ht, ht->slots[slot].key);
+		_flat_erase(ht, slot);
+		_filter_remove(ht, hash);
+		_adjust_by_density(ht);
+		return ret;
+	}
+	head     = _find_node(ht, key, hash);
+	ret_node = *head;
+	if (ret_node) {
+		void *ret = ret_node->value;
+		/* The node's storage goes back to the slab, hand out a copy the caller can free */
+		if (ht->inline_value) {
+			if (!(ret = malloc(ht->value_size)))
+				return NULL;
+			memcpy(ret, ret_node->value, ht->value_size);
+		}
+		_cleanup_node_util(ht, head, true);
+		_filter_remove(ht, hash);
+		_adjust_by_density(ht);
+		return ret;
+	}
+	return NULL;
+}
+
+void ht_delete(ht_st *ht, void *key)
+{
+	_node_t **head;
+	size_t hash;
+	if (_is_mapped(ht))
+		return;
+	_migrate_step(ht);
+	hash = _hash_of(ht, key);
+	if (_filter_rejects(ht, hash))
+		return;
+	if (_is_flat(ht)) {
+		size_t slot = _flat_find(ht, key, hash);
+		if (slot != SIZE_MAX) {
+			_free_key(ht, ht->slots[slot].key);
+			_free_value(ht, ht->slots[slot].value);
+			_flat_erase(ht, slot);
+			_filter_remove(ht, hash);
+			_adjust_by_density(ht);
+		}
+		return;
+	}
+	head = _find_node(ht, key, hash);
+	if (*head) {
+		_cleanup_node(ht, head);
+		_filter_remove(ht, hash);
+		_adjust_by_density(ht);
+	}
+	return;
+}
+
+/*
+ * Hash a chunk of keys, then prefetch in two rounds: first every bucket (control group for
+ * HT_FLAT), then the first candidate node or slot behind it. Each round issues all of its loads
+ * before waiting on any, so the misses of the chunk overlap instead of serializing.
+ */
+static void _batch_prepare(ht_st *ht, void *const *keys, size_t n, size_t *hashes)
+{
+	size_t i;
+	for (i = 0; i < n; i++) {
+		hashes[i] = _hash_of(ht, keys[i]);
+		if (_is_flat(ht)) {
+			__builtin_prefetch(&ht->ctrl[((hashes[i] >> 7) & _flat_group_mask(ht)) * FLAT_GROUP]);
+		} else {
+			__builtin_prefetch(_bucket_head(ht, hashes[i]));
+		}
+	}
+	for (i = 0; i < n; i++) {
+		if (_is_flat(ht)) {
+			size_t start   = ((hashes[i] >> 7) & _flat_group_mask(ht)) * FLAT_GROUP;
+			uint32_t match = _group_match(&ht->ctrl[start], hashes[i] & 0x7F);
+			__builtin_prefetch(&ht->slots[start + (match ? __builtin_ctz(match) : 0)]);
+		} else if (*_bucket_head(ht, hashes[i])) {
+			__builtin_prefetch(*_bucket_head(ht, hashes[i]));
+		}
+	}
+}
+
+void ht_get_many(ht_st *ht, void *const *keys, size_t n, void **values)
+{
+	size_t hashes[BATCH_CHUNK];
+	size_t done, i;
+	if (_is_mapped(ht)) {
+		for (i = 0; i < n; i++) {
+			values[i] = ht_get(ht, keys[i]);
+		}
+		return;
+	}
+	for (done = 0; done < n; done += BATCH_CHUNK) {
+		size_t chunk = MIN(n - done, (size_t) BATCH_CHUNK);
+		/* Migrate as much as `chunk` single key calls would, up front so the buckets hold still */
+		for (i = 0; i < chunk; i++) {
+			_migrate_step(ht);
+		}
+		_batch_prepare(ht, &keys[done], chunk, hashes);
+		for (i = 0; i < chunk; i++) {
+			if (_filter_rejects(ht, hashes[i])) {
+				values[done + i] = NULL;
+			} else if (_is_flat(ht)) {
+				size_t slot      = _flat_find(ht, keys[done + i], hashes[i]);
+				values[done + i] = slot == SIZE_MAX ? NULL : ht->slots[slot].value;
+			} else {
+				_node_t *node    = *_find_node(ht, keys[done + i], hashes[i]);
+				values[done + i] = node ? node->value : NULL;
+			}
+		}
+	}
+}
+
+void ht_has_many(ht_st *ht, void *const *keys, size_t n, bool *found)
+{
+	size_t hashes[BATCH_CHUNK];
+	size_t done, i;
+	if (_is_mapped(ht)) {
+		for (i = 0; i < n; i++) {
+			found[i] = ht_has(ht, keys[i]);
+		}
+		return;
+	}
+	for (done = 0; done < n; done += BATCH_CHUNK) {
+		size_t chunk = MIN(n - done, (size_t) BATCH_CHUNK);
+		for (i = 0; i < chunk; i++) {
+			_migrate_step(ht);
+		}
+		_batch_prepare(ht, &keys[done], chunk, hashes);
+		for (i = 0; i < chunk; i++) {
+			if (_filter_rejects(ht, hashes[i])) {
+				found[done + i] = false;
+			} else if (_is_flat(ht)) {
+				found[done + i] = _flat_find(ht, keys[done + i], hashes[i]) != SIZE_MAX;
+			} else {
+				found[done + i] = *_find_node(ht, keys[done + i], hashes[i]) != NULL;
+			}
+		}
+	}
+}
+
+int ht_set_many(ht_st *ht, void *const *keys, void *const *values, size_t n)
+{
+	size_t hashes[BATCH_CHUNK];
+	size_t done, i;
+	int added = 0;
+	ES_NEW_ASRT(ht && !_is_mapped(ht), "Snapshots are read only");
+	for (done = 0; done < n; done += BATCH_CHUNK) {
+		size_t chunk = MIN(n - done, (size_t) BATCH_CHUNK);
+		_batch_prepare(ht, &keys[done], chunk, hashes);
+		/* A resize mid chunk only makes the prefetches stale, the stored hashes stay valid */
+		for (i = 0; i < chunk; i++) {
+			int ret;
+			if (_is_flat(ht)) {
+				size_t slot;
+				ret = _flat_upsert(ht, keys[done + i], values[done + i], hashes[i], &slot);
+			} else {
+				ret = _chained_set(ht, keys[done + i], values[done + i], hashes[i]);
+			}
+			ES_FWD_INT_NM(ret);
+			added += ret;
+		}
+	}
+	return added;
+}
+
+int ht_bulk_load(ht_st *ht, void *const *keys, void *const *values, size_t n)
+{
+	size_t min_buckets;
+	size_t level;
+	int added;
+	ES_NEW_ASRT(ht && !_is_mapped(ht), "Snapshots are read only");
+	level = _level_for(ht, ht->n_nodes + n);
+	ES_FWD_INT_NM(_grow_to(ht, level));
+	_filter_reserve(ht, ht->n_nodes + n);
+	/* Hold the size while the table is still sparse, the first inserts would shrink it again */
+	min_buckets     = ht->min_buckets;
+	ht->min_buckets = MAX(min_buckets, level);
+	added           = ht_set_many(ht, keys, values, n);
+	ht->min_buckets = min_buckets;
+	ES_FWD_INT_NM(added);
+	/* Duplicate keys may have left it oversized */
+	_adjust_by_density(ht);
+	return added;
+}
+
+static int _flat_foreach(ht_st *ht, ht_foreach_func_t body, void *data)
+{
+	size_t i;
+	for (i = 0; i < _flat_cap(ht); i++) {
+		int ret;
+		if (ht->ctrl[i] & 0x80)
+			continue;
+		ES_NEW_INT_NM(ret = body(ht, ht->slots[i].key, ht->slots[i].value, data));
+		if (ret == 0)
+			return 0;
+	}
+	return 1;
+}
+
+static int _chained_foreach(ht_st *ht,
+                            _node_t **nodes,
+                            size_t from,
+                            size_t to,
+                            ht_foreach_func_t body,
+                            void *data)
+{
+	size_t i;
+	for (i = from; i < to; i++) {
+		_node_t **head = &(nodes[i]);
+		while (*head) {
+			int ret;
+			_node_t *post;
+			_node_t *pre = *head;
+			ES_NEW_INT_NM(ret = body(ht, (*head)->key, (*head)->value, data));
+			post = *head;
+			if (ret == 0)
+				return 0;
+			/* Case when body didn't delete the iterated node*/
+			if (pre == post)
+				head = &(*head)->next;
+		}
+	}
+	return 1;
+}
+
+static inline size_t _reverse_bits(size_t v)
+{
+	v = ((v >> 1) & UINT64_C(0x5555555555555555)) | ((v & UINT64_C(0x5555555555555555)) << 1);
+	v = ((v >> 2) & UINT64_C(0x3333333333333333)) | ((v & UINT64_C(0x3333333333333333)) << 2);
+	v = ((v >> 4) & UINT64_C(0x0F0F0F0F0F0F0F0F)) | ((v & UINT64_C(0x0F0F0F0F0F0F0F0F)) << 4);
+	return __builtin_bswap64(v);
+}
+
+/*
+ * Next cursor after v for a table of mask + 1 buckets. Counting on the reversed bits walks the
+ * high bits of the bucket index first, so every bucket of a larger or smaller table sharing the
+ * low bits of an already visited cursor was covered by it.
+ */
+static inline size_t _scan_next(size_t v, size_t mask)
+{
+	v |= ~mask;
+	return _reverse_bits(_reverse_bits(v) + 1);
+}
+
+static size_t _chain_len(const _node_t *node)
+{
+	size_t n = 0;
+	for (; node; node = node->next) {
+		n++;
+	}
+	return n;
+}
+
+static int _scan_bucket(ht_st *ht,
+                        _node_t **nodes,
+                        size_t i,
+                        size_t *seen,
+                        ht_foreach_func_t body,
+                        void *data)
+{
+	*seen += _chain_len(nodes[i]);
+	return ES_FWD_INT_NM(_chained_foreach(ht, nodes, i, i + 1, body, data));
+}
+
+/*
+ * Visit every bucket cursor v stands for. Mid migration that is one bucket of the smaller array
+ * and all of its expansions in the larger one, buckets already migrated out are empty.
+ */
+static int _scan_cursor(ht_st *ht, size_t v, size_t *seen, ht_foreach_func_t body, void *data)
+{
+	_node_t **small   = ht->nodes;
+	_node_t **large   = NULL;
+	size_t small_mask = ht_buckets(ht) - 1;
+	size_t large_mask = small_mask;
+	int ret;
+	if (_is_migrating(ht)) {
+		size_t old_mask = _n_buckets(ht, ht->old_buckets) - 1;
+		large           = ht->nodes;
+		small           = ht->old_nodes;
+		small_mask      = old_mask;
+		if (old_mask > large_mask) {
+			large      = ht->old_nodes;
+			small      = ht->nodes;
+			small_mask = large_mask;
+			large_mask = old_mask;
+		}
+	}
+	ES_FWD_INT_NM(ret = _scan_bucket(ht, small, v & small_mask, seen, body, data));
+	if (!large || ret == 0)
+		return ret;
+	do {
+		ES_FWD_INT_NM(ret = _scan_bucket(ht, large, v & large_mask, seen, body, data));
+		v = _scan_next(v, large_mask);
+	} while (ret > 0 && (v & (small_mask ^ large_mask)));
+	return ret;
+}
+
+int ht_scan(ht_st *ht, size_t *cursor, size_t max_items, ht_foreach_func_t body, void *data)
+{
+	size_t seen = 0;
+	size_t v;
+	int ret;
+	ES_NEW_ASRT_NM(ht && cursor);
+	ES_NEW_ASRT(!_is_flat(ht) && !_is_mapped(ht) && (ht->flags & HT_POW2),
+	            "ht_scan needs a chained HT_POW2 table");
+	v = *cursor;
+	ht->iterating++;
+	do {
+		size_t mask = ht_buckets(ht) - 1;
+		if (_is_migrating(ht))
+			mask = MIN(mask, _n_buckets(ht, ht->old_buckets) - 1);
+		ret = _scan_cursor(ht, v, &seen, body, data);
+		/* A stopped cursor is resumed from the start of its buckets */
+		if (ret > 0)
+			v = _scan_next(v, mask);
+	} while (ret > 0 && v && seen < max_items);
+	ht->iterating--;
+	*cursor = v;
+	_adjust_by_density(ht);
+	ES_FWD_INT_NM(ret);
+	return ret;
+}
+
+/* Walk every entry without resizing afterwards, so ht_stats leaves the table as it found it */
+static int _foreach(ht_st *ht, ht_foreach_func_t body, void *data)
+{
+	int ret;
+	ht->iterating++;
+	if (_is_flat(ht)) {
+		ret = _flat_foreach(ht, body, data);
+	} else {
+		ret = 1;
+		if (_is_migrating(ht)) {
+			ret = _chained_foreach(
+			    ht, ht->old_nodes, ht->migrated, _n_buckets(ht, ht->old_buckets), body, data);
+		}
+		if (ret > 0) {
+			ret = _chained_foreach(ht, ht->nodes, 0, ht_buckets(ht), body, data);
+		}
+	}
+	ht->iterating--;
+	return ret;
+}
+
+/* Self deletion safe. NOT arbitrary deletion safe. The table is not resized until the loop ends.*/
+int ht_foreach(ht_st *ht, ht_foreach_func_t body, void *data)
+{
+	int ret;
+	ES_NEW_ASRT_NM(ht);
+	ES_NEW_ASRT(!_is_mapped(ht), "Snapshots only serve lookups");
+	ret = _foreach(ht, body, data);
+	_adjust_by_density(ht);
+	ES_FWD_INT_NM(ret);
+	return ret;
+}
+
+size_t ht_buckets(ht_st *ht)
+{
+	if (_is_flat(ht))
+		return _flat_cap(ht);
+	return _n_buckets(ht, ht->buckets);
+}
+
+size_t ht_size(ht_st *ht)
+{
+	return ht->n_nodes;
+}
+
+double ht_density(ht_st *ht)
+{
+	return (double) ht->n_nodes / ht_buckets(ht);
+}
+
+/*
+ * wyhash (final version 4, public domain) by Wang Yi. Reads 8 byte words, folds them with
+ * 64x64->128 bit multiplies and runs three independent lanes over long inputs to keep the
+ * multiplier busy.
+ */
+static const uint64_t _wy_secret[4] = {
+    UINT64_C(0xa0761d6478bd642f),
+    UINT64_C(0xe7037ed1a0b428db),
+    UINT64_C(0x8ebc6af09c88c6e3),
+    UINT64_C(0x589965cc75374cc3),
+};
+
+static inline uint64_t _wy_mix(uint64_t a, uint64_t b)
+{
+	__uint128_t r = (__uint128_t) a * b;
+	return (uint64_t) r ^ (uint64_t) (r >> 64);
+}
+
+static inline uint64_t _wy_r8(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t _wy_r4(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+uint64_t ht_hash_bytes(const void *data, size_t len, uint64_t seed)
+{
+	const uint8_t *p = data;
+	size_t i         = len;
+	uint64_t a, b;
+	__uint128_t r;
+	seed ^= _wy_mix(seed ^ _wy_secret[0], _wy_secret[1]);
+	if (len <= 16) {
+		if (len >= 4) {
+			a = (_wy_r4(p) << 32) | _wy_r4(p + ((len >> 3) << 2));
+			b = (_wy_r4(p + len - 4) << 32) | _wy_r4(p + len - 4 - ((len >> 3) << 2));
+		} else if (len > 0) {
+			a = ((uint64_t) p[0] << 16) | ((uint64_t) p[len >> 1] << 8) | p[len - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		if (i > 48) {
+			uint64_t see1 = seed, see2 = seed;
+			do {
+				seed = _wy_mix(_wy_r8(p) ^ _wy_secret[1], _wy_r8(p + 8) ^ seed);
+				see1 = _wy_mix(_wy_r8(p + 16) ^ _wy_secret[2], _wy_r8(p + 24) ^ see1);
+				see2 = _wy_mix(_wy_r8(p + 32) ^ _wy_secret[3], _wy_r8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= see1 ^ see2;
+		}
+		while (i > 16) {
+			seed = _wy_mix(_wy_r8(p) ^ _wy_secret[1], _wy_r8(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+		a = _wy_r8(p + i - 16);
+		b = _wy_r8(p + i - 8);
+	}
+	r = (__uint128_t) (a ^ _wy_secret[1]) * (b ^ seed);
+	return _wy_mix((uint64_t) r ^ _wy_secret[0] ^ len, (uint64_t) (r >> 64) ^ _wy_secret[1]);
+}
+
+size_t ht_int_hash(const void *key)
+{
+	uint64_t x = (uint64_t) key;
+	x          = (x ^ (x >> 31) ^ (x >> 62)) * UINT64_C(0x319642b2d24d8ec3);
+	x          = (x ^ (x >> 27) ^ (x >> 54)) * UINT64_C(0x96de1b173f119089);
+	x          = x ^ (x >> 30) ^ (x >> 60);
+	return x;
+}
+
+int64_t ht_int_cmp(const void *key1, const void *key2)
+{
+	return key2 - key1;
+}
+
+size_t ht_int_hash_seeded(const void *key, uint64_t seed)
+{
+	return ht_int_hash((const void *) ((uint64_t) key ^ seed));
+}
+
+size_t ht_str_hash(const void *k)
+{
+	return ht_hash_bytes(k, strlen(k), _process_seed);
+}
+
+size_t ht_str_hash_seeded(const void *k, uint64_t seed)
+{
+	return ht_hash_bytes(k, strlen(k), seed);
+}
+
+int64_t ht_str_cmp(const void *k1, const void *k2)
+{
+	const char *key1 = k1, *key2 = k2;
+	return strcmp(key1, key2);
+}
+
+int ht_str_copy(void **dst, void *key)
+{
+	if (key == NULL) {
+		*dst = NULL;
+		return 1;
+	}
+	char *new_key = strdup((char *) key);
+	ES_NEW_ASRT_NM(new_key);
+	*dst = new_key;
+	return 1;
+}
+
+void ht_str_free(void *key)
+{
+	if (key)
+		free(key);
+}
+
+/*
+ * Stored ht_strn key. Lives inline in the node, NUL terminated, heap allocated only when it
+ * doesn't fit in buf. The hash is cached by the node itself.
+ */
+typedef struct _strn_key_s
+{
+	uint32_t len;
+	union
+	{
+		char buf[HT_STRN_INLINE + 1];
+		char *heap;
+	};
+} _strn_key_t;
+
+static inline const char *_strn_data(const _strn_key_t *key)
+{
+	return key->len <= HT_STRN_INLINE ? key->buf : key->heap;
+}
+
+static size_t _strn_hash(const void *key, uint64_t seed)
+{
+	const ht_strn_st *probe = key;
+	return ht_hash_bytes(probe->str, probe->len, seed);
+}
+
+/* Only ever called as (stored, probe), see _find_node */
+static int64_t _strn_cmp(const void *key1, const void *key2)
+{
+	const _strn_key_t *stored = key1;
+	const ht_strn_st *probe   = key2;
+	if (stored->len != probe->len)
+		return (int64_t) stored->len - (int64_t) probe->len;
+	return memcmp(_strn_data(stored), probe->str, probe->len);
+}
+
+static int _strn_copy(void **dst, void *key)
+{
+	_strn_key_t *stored     = *dst;
+	const ht_strn_st *probe = key;
+	char *data              = stored->buf;
+	ES_NEW_ASRT(probe->len <= UINT32_MAX, "Key of %zu bytes is too long", probe->len);
+	if (probe->len > HT_STRN_INLINE) {
+		ES_NEW_ASRT_NM(data = malloc(probe->len + 1));
+		stored->heap = data;
+	}
+	memcpy(data, probe->str, probe->len);
+	data[probe->len] = '\0';
+	stored->len      = probe->len;
+	return 1;
+}
+
+static void _strn_free(void *key)
+{
+	_strn_key_t *stored = key;
+	if (stored->len > HT_STRN_INLINE)
+		free(stored->heap);
+}
+
+int ht_strn_alloc(ht_st **dst,
+                  uint32_t flags,
+                  size_t value_size,
+                  ht_alloc_func_t value_copy,
+                  ht_free_func_t value_free)
+{
+	ES_NEW_ASRT(!(flags & HT_FLAT), "ht_strn keys are stored in chained nodes");
+	ES_FWD_INT_NM(_alloc_util(dst,
+	                          flags,
+	                          NULL,
+	                          _strn_hash,
+	                          _strn_cmp,
+	                          sizeof(_strn_key_t),
+	                          _strn_copy,
+	                          _strn_free,
+	                          value_size,
+	                          value_copy,
+	                          value_free));
+	/* The key always lives in the node, values only with HT_INLINE as in other tables */
+	(*dst)->inline_key = true;
+	_node_layout(*dst);
+	return 1;
+}
+
+ht_strn_st ht_strn_key(const void *key)
+{
+	const _strn_key_t *stored = key;
+	return (ht_strn_st){.str = _strn_data(stored), .len = stored->len};
+}
+
+size_t ht_arb_hash_util(void *key, size_t size)
+{
+	return ht_hash_bytes(key, size, _process_seed);
+}
+int64_t ht_arb_cmp_util(void *key1, void *key2, size_t size)
+{
+	return memcmp(key1, key2, size);
+}
+
+/*
+ * Snapshots
+ *
+ * File layout, native endianness: a header, a power of two array of (hash, record offset) slots
+ * probed linearly, then the records. A record is a (key length, value length) pair followed by the
+ * key bytes and the value bytes, each padded to 8 bytes. Offsets are relative
+ * to the start of the file so a mapping can be used wherever it lands. Keys are hashed with
+ * ht_hash_bytes under a seed stored in the header, never with the process seed.
+ */
+
+#define SNAP_MAGIC   "HTSNAP01"
+#define SNAP_ALIGN   ((size_t) 8)
+#define SNAP_NULL    UINT32_MAX
+#define SNAP_MIN_LOG (4)
+#define SNAP_PAD(sz) (((sz) + SNAP_ALIGN - 1) & ~(SNAP_ALIGN - 1))
+
+/* How keys and values are turned into bytes. Anything with a custom copy can't be written. */
+typedef enum
+{
+	/* The pointer itself, for int keys/values stored as pointers */
+	SNAP_WORD,
+	/* key_size/value_size bytes behind the pointer */
+	SNAP_FIXED,
+	/* NUL terminated string (ht_str_copy) */
+	SNAP_STR,
+	/* ht_strn_alloc key, probed with ht_strn_st */
+	SNAP_STRN,
+} _snap_kind_et;
+
+typedef struct _snap_header_s
+{
+	char magic[8];
+	uint32_t key_kind;
+	uint32_t value_kind;
+	uint64_t key_size;
+	uint64_t value_size;
+	uint64_t n;
+	uint64_t seed;
+	uint64_t slots_log2;
+	uint64_t file_size;
+} _snap_header_t;
+
+typedef struct _snap_slot_s
+{
+	uint64_t hash;
+	uint64_t offset;
+} _snap_slot_t;
+
+typedef struct _snap_rec_s
+{
+	uint32_t key_len;
+	uint32_t value_len;
+	char data[];
+} _snap_rec_t;
+
+static int _snap_key_kind(const ht_st *ht)
+{
+	if (ht->key_copy == _strn_copy)
+		return SNAP_STRN;
+	if (ht->key_copy == ht_str_copy)
+		return SNAP_STR;
+	if (ht->key_copy)
+		return -1;
+	return ht->key_size ? SNAP_FIXED : SNAP_WORD;
+}
+
+static int _snap_value_kind(const ht_st *ht)
+{
+	if (ht->value_copy == ht_str_copy)
+		return SNAP_STR;
+	if (ht->value_copy)
+		return -1;
+	return ht->value_size ? SNAP_FIXED : SNAP_WORD;
+}
+
+/* Bytes of a key or value, *word backs SNAP_WORD. Length SNAP_NULL for a NULL value. */
+static const void *_snap_bytes(_snap_kind_et kind,
+                               size_t size,
+                               const void *const *kv,
+                               bool stored,
+                               size_t *len)
+{
+	if (kind == SNAP_WORD) {
+		*len = sizeof(*kv);
+		return kv;
+	}
+	if (!*kv) {
+		*len = SNAP_NULL;
+		return NULL;
+	}
+	if (kind == SNAP_FIXED) {
+		*len = size;
+	} else if (kind == SNAP_STR) {
+		*len = strlen(*kv);
+	} else if (stored) {
+		ht_strn_st key = ht_strn_key(*kv);
+		*len           = key.len;
+		return key.str;
+	} else {
+		*len = ((const ht_strn_st *) *kv)->len;
+		return ((const ht_strn_st *) *kv)->str;
+	}
+	return *kv;
+}
+
+/* Strings keep a terminator so values can be handed out as C strings */
+static inline size_t _snap_field_size(uint32_t kind, size_t len)
+{
+	if (len == SNAP_NULL)
+		return 0;
+	return SNAP_PAD(len + (kind == SNAP_STR || kind == SNAP_STRN));
+}
+
+static inline size_t _snap_rec_size(const _snap_header_t *header, size_t key_len, size_t value_len)
+{
+	return sizeof(_snap_rec_t) + _snap_field_size(header->key_kind, key_len) +
+	       _snap_field_size(header->value_kind, value_len);
+}
+
+typedef struct
+{
+	const _snap_header_t *header;
+	uint8_t *base;
+	size_t end;
+} _snap_writer_t;
+
+static int _snap_measure(const ht_st *ht, void *key, void *value, void *data)
+{
+	_snap_writer_t *w = data;
+	size_t key_len, value_len;
+	_snap_bytes(w->header->key_kind, ht->key_size, (const void **) &key, true, &key_len);
+	_snap_bytes(w->header->value_kind, ht->value_size, (const void **) &value, true, &value_len);
+	ES_NEW_ASRT(key_len < SNAP_NULL && value_len <= SNAP_NULL, "Entry too large for a snapshot");
+	w->end += _snap_rec_size(w->header, key_len, value_len);
+	return 1;
+}
+
+static int _snap_emit(const ht_st *ht, void *key, void *value, void *data)
+{
+	_snap_writer_t *w            = data;
+	const _snap_header_t *header = w->header;
+	_snap_slot_t *slots          = (_snap_slot_t *) (w->base + sizeof(*header));
+	const size_t mask            = ((size_t) 1 << header->slots_log2) - 1;
+	_snap_rec_t *rec             = (_snap_rec_t *) (w->base + w->end);
+	const void *key_bytes;
+	const void *value_bytes;
+	size_t key_len, value_len;
+	size_t hash, i;
+	key_bytes = _snap_bytes(header->key_kind, ht->key_size, (const void **) &key, true, &key_len);
+	value_bytes =
+	    _snap_bytes(header->value_kind, ht->value_size, (const void **) &value, true, &value_len);
+	rec->key_len   = key_len;
+	rec->value_len = value_len;
+	/* The file starts zeroed, terminators and padding are already in place */
+	memcpy(rec->data, key_bytes, key_len);
+	if (value_len != SNAP_NULL)
+		memcpy(rec->data + _snap_field_size(header->key_kind, key_len), value_bytes, value_len);
+	hash = ht_hash_bytes(key_bytes, key_len, header->seed);
+	for (i = hash & mask; slots[i].offset; i = (i + 1) & mask) {
+		;
+	}
+	slots[i].hash   = hash;
+	slots[i].offset = w->end;
+	w->end += _snap_rec_size(w->header, key_len, value_len);
+	return 1;
+}
+
+static void _snap_unmap(_snap_writer_t *w)
+{
+	if (w->base)
+		munmap(w->base, w->header->file_size);
+	w->base = NULL;
+}
+
+/* Fill the file behind fd, header last */
+static int _snap_fill(ht_st *ht, int fd, _snap_header_t *header)
+{
+	CLEANUP(_snap_unmap) _snap_writer_t w = {.header = header};
+	size_t slots                          = (size_t) 1 << header->slots_log2;
+	void *base;
+	/* Probes stay short at up to 3/4 load */
+	while (header->n > slots / 2 + slots / 4) {
+		slots <<= 1;
+		header->slots_log2++;
+	}
+	ES_FWD_INT_NM(ht_foreach(ht, _snap_measure, &w));
+	w.end += sizeof(*header) + slots * sizeof(_snap_slot_t);
+	header->file_size = w.end;
+	ES_NEW_INT_ERRNO(ftruncate(fd, header->file_size));
+	base = mmap(NULL, header->file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	ES_NEW_ASRT_ERRNO(base != MAP_FAILED);
+	w.base = base;
+	w.end  = sizeof(*header) + slots * sizeof(_snap_slot_t);
+	ES_FWD_INT_NM(ht_foreach(ht, _snap_emit, &w));
+	memcpy(w.base, header, sizeof(*header));
+	ES_NEW_INT_ERRNO(msync(w.base, header->file_size, MS_SYNC));
+	return 1;
+}
+
+int ht_snapshot_write(ht_st *ht, const char *path)
+{
+	CLEAN_FD int fd       = -1;
+	_snap_header_t header = {.magic = SNAP_MAGIC, .slots_log2 = SNAP_MIN_LOG};
+	char tmp[PATH_MAX];
+	int key_kind, value_kind;
+	ES_NEW_ASRT_NM(ht && path);
+	ES_NEW_ASRT(!_is_mapped(ht), "Already a snapshot");
+	ES_NEW_ASRT((key_kind = _snap_key_kind(ht)) >= 0, "Keys with a custom copy can't be written");
+	ES_NEW_ASRT((value_kind = _snap_value_kind(ht)) >= 0,
+	            "Values with a custom copy can't be written");
+	ES_NEW_ASRT(snprintf(tmp, sizeof(tmp), "%s.tmp", path) < (int) sizeof(tmp), "Path too long");
+	header.key_kind   = key_kind;
+	header.value_kind = value_kind;
+	header.key_size   = ht->key_size;
+	header.value_size = ht->value_size;
+	header.n          = ht->n_nodes;
+	header.seed       = _random_seed();
+	/* Written aside and renamed over path, mappings of the previous file stay valid */
+	ES_NEW_INT_ERRNO(fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+	if (_snap_fill(ht, fd, &header) < 0) {
+		unlink(tmp);
+		ES_FWD_INT_NM(-1);
+	}
+	ES_NEW_INT_ERRNO(rename(tmp, path));
+	return 1;
+}
+
+int ht_snapshot_map(ht_st **dst, const char *path)
+{
+	HT_CLEANUP ht_st *tmp = NULL;
+	CLEAN_FD int fd       = -1;
+	const _snap_header_t *header;
+	struct stat st;
+	void *base;
+	ES_NEW_ASRT_NM(dst && path);
+	*dst = NULL;
+	ES_NEW_INT_ERRNO(fd = open(path, O_RDONLY | O_CLOEXEC));
+	ES_NEW_INT_ERRNO(fstat(fd, &st));
+	ES_NEW_ASRT((size_t) st.st_size >= sizeof(*header), "%s is not a snapshot", path);
+	ES_NEW_ASRT_NM(tmp = calloc(1, sizeof(*tmp)));
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	ES_NEW_ASRT_ERRNO(base != MAP_FAILED);
+	header        = base;
+	tmp->snap     = header;
+	tmp->snap_len = st.st_size;
+	ES_NEW_ASRT(!memcmp(header->magic, SNAP_MAGIC, sizeof(header->magic)) &&
+	                header->file_size == (size_t) st.st_size && header->key_kind <= SNAP_STRN &&
+	                header->value_kind <= SNAP_STR && header->value_kind != SNAP_STRN &&
+	                header->slots_log2 < 48 &&
+	                sizeof(*header) + (sizeof(_snap_slot_t) << header->slots_log2) <=
+	                    header->file_size,
+	            "%s is not a snapshot or is corrupt",
+	            path);
+	/* Lookups land on random pages, readahead would only pull in neighbours nobody asked for */
+	madvise(base, st.st_size, MADV_RANDOM);
+	tmp->flags      = HT_POW2;
+	tmp->buckets    = header->slots_log2;
+	tmp->n_nodes    = header->n;
+	tmp->key_size   = header->key_size;
+	tmp->value_size = header->value_size;
+	*dst            = MOVE_PZ(tmp);
+	return 1;
+}
+
+/* Whether the record at offset lies in the records area and its fields are readable as stored */
+static bool _snap_rec_valid(const ht_st *ht, uint64_t offset)
+{
+	const _snap_header_t *header = ht->snap;
+	const size_t start           = sizeof(*header) + (sizeof(_snap_slot_t) << header->slots_log2);
+	const _snap_rec_t *rec;
+	const char *value;
+	if (offset < start || offset % SNAP_ALIGN || offset > ht->snap_len - sizeof(*rec))
+		return false;
+	rec = (const _snap_rec_t *) ((const uint8_t *) header + offset);
+	if (rec->key_len == SNAP_NULL ||
+	    _snap_rec_size(header, rec->key_len, rec->value_len) > ht->snap_len - offset)
+		return false;
+	if (rec->value_len == SNAP_NULL)
+		return header->value_kind != SNAP_WORD;
+	value = rec->data + _snap_field_size(header->key_kind, rec->key_len);
+	switch (header->value_kind) {
+	case SNAP_WORD:
+		return rec->value_len == sizeof(void *);
+	case SNAP_FIXED:
+		return rec->value_len == header->value_size;
+	default:
+		/* Handed out as a C string */
+		return value[rec->value_len] == '\0';
+	}
+}
+
+static const void *_snap_find(const ht_st *ht, const void *key)
+{
+	const _snap_header_t *header = ht->snap;
+	const uint8_t *base          = (const uint8_t *) header;
+	const _snap_slot_t *slots    = (const _snap_slot_t *) (base + sizeof(*header));
+	const size_t mask            = ((size_t) 1 << header->slots_log2) - 1;
+	const void *bytes;
+	size_t len, hash, i, probes;
+	bytes = _snap_bytes(header->key_kind, header->key_size, (const void **) &key, false, &len);
+	if (len == SNAP_NULL)
+		return NULL;
+	hash = ht_hash_bytes(bytes, len, header->seed);
+	/* A corrupt file may have no empty slot to stop at */
+	for (i = hash & mask, probes = 0; probes <= mask && slots[i].offset;
+	     i = (i + 1) & mask, probes++) {
+		const _snap_rec_t *rec = (const _snap_rec_t *) (base + slots[i].offset);
+		if (slots[i].hash != hash)
+			continue;
+		/* Only records matching the hash are checked, so lookups fault in no extra pages */
+		if (!_snap_rec_valid(ht, slots[i].offset))
+			return NULL;
+		if (rec->key_len == len && !memcmp(rec->data, bytes, len))
+			return rec;
+	}
+	return NULL;
+}
+
+static void *_snap_value(const ht_st *ht, const void *found)
+{
+	const _snap_rec_t *rec = found;
+	const char *value;
+	if (!rec || rec->value_len == SNAP_NULL)
+		return NULL;
+	value = rec->data + _snap_field_size(ht->snap->key_kind, rec->key_len);
+	if (ht->snap->value_kind == SNAP_WORD)
+		return *(void *const *) value;
+	return (void *) value;
+}
+
+/* Heap bytes behind a stored key/value, as far as the table knows how they were copied */
+static size_t _key_bytes(const ht_st *ht, const void *key)
+{
+	if (ht->key_copy == _strn_copy) {
+		size_t len = ht_strn_key(key).len;
+		return len > HT_STRN_INLINE ? len + 1 : 0;
+	}
+	if (ht->key_copy == ht_str_copy)
+		return strlen(key) + 1;
+	if (ht->inline_key || ht->key_copy)
+		return 0;
+	return ht->key_size;
+}
+
+static size_t _value_bytes(const ht_st *ht, const void *value)
+{
+	if (!value)
+		return 0;
+	if (ht->value_copy == ht_str_copy)
+		return strlen(value) + 1;
+	if (ht->inline_value || ht->value_copy)
+		return 0;
+	return ht->value_size;
+}
+
+static int _stats_entry(const ht_st *ht, void *key, void *value, void *data)
+{
+	ht_stats_st *dst = data;
+	dst->key_bytes += _key_bytes(ht, key);
+	dst->value_bytes += _value_bytes(ht, value);
+	return 1;
+}
+
+static void _stats_chain(ht_stats_st *dst, size_t len)
+{
+	dst->chain_hist[MIN(len, (size_t) HT_STATS_HIST - 1)]++;
+	dst->max_chain = MAX(dst->max_chain, len);
+}
+
+static void _stats_chained(const ht_st *ht, ht_stats_st *dst)
+{
+	size_t i;
+	for (i = 0; i < _n_buckets(ht, ht->buckets); i++) {
+		_stats_chain(dst, _chain_len(ht->nodes[i]));
+	}
+	dst->table_bytes = _n_buckets(ht, ht->buckets) * sizeof(*ht->nodes);
+	if (_is_migrating(ht)) {
+		for (i = ht->migrated; i < _n_buckets(ht, ht->old_buckets); i++) {
+			_stats_chain(dst, _chain_len(ht->old_nodes[i]));
+		}
+		dst->table_bytes += _n_buckets(ht, ht->old_buckets) * sizeof(*ht->old_nodes);
+	}
+}
+
+/* Groups probed past the home group to reach each entry */
+static void _stats_flat(const ht_st *ht, ht_stats_st *dst)
+{
+	const size_t mask = _flat_group_mask(ht);
+	size_t i;
+	for (i = 0; i < _flat_cap(ht); i++) {
+		size_t group = (ht->slots[i].hash >> 7) & mask;
+		size_t step;
+		if (ht->ctrl[i] & 0x80)
+			continue;
+		for (step = 0; group != i / FLAT_GROUP; step++) {
+			group = (group + step + 1) & mask;
+		}
+		_stats_chain(dst, step);
+	}
+	dst->table_bytes = _flat_cap(ht) * (1 + sizeof(*ht->slots));
+}
+
+int ht_stats(ht_st *ht, ht_stats_st *dst)
+{
+	const _slab_t *slab;
+	ES_NEW_ASRT_NM(ht && dst);
+	ES_NEW_ASRT(!_is_mapped(ht), "No statistics for snapshots");
+	memset(dst, 0, sizeof(*dst));
+	if (_is_flat(ht))
+		_stats_flat(ht, dst);
+	else
+		_stats_chained(ht, dst);
+	for (slab = ht->slabs; slab; slab = slab->next) {
+		dst->node_bytes += sizeof(*slab) + slab->capacity * ht->node_size;
+	}
+	_foreach(ht, _stats_entry, dst);
+	if (ht->bloom)
+		dst->filter_bytes = bloom_bytes(ht->bloom);
+	if (ht->cuckoo)
+		dst->filter_bytes = cuckoo_bytes(ht->cuckoo);
+#ifdef HT_STATS
+	dst->counting  = true;
+	dst->hits      = ht->hits;
+	dst->misses    = ht->misses;
+	dst->filtered  = ht->filtered;
+	dst->probes    = ht->probes;
+	dst->compares  = ht->compares;
+	dst->resizes   = ht->resizes;
+	dst->resize_ns = ht->resize_ns;
+#endif
+	return 1;
+}
+
+void ht_stats_reset(UNUSED ht_st *ht)
+{
+	STAT(ht->hits = ht->misses = ht->filtered = ht->probes = ht->compares = 0);
+	STAT(ht->resizes = ht->resize_ns = 0);
 }
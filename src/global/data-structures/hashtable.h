@@ -18,11 +18,55 @@ struct ht_s;
 typedef struct ht_s ht_st;
 
 typedef size_t (*ht_hash_func_t)(const void *key);
+/* Hash keyed by a per table random seed, see ht_alloc_seeded */
+typedef size_t (*ht_seeded_hash_func_t)(const void *key, uint64_t seed);
 typedef int64_t (*ht_cmp_func_t)(const void *key1, const void *key2);
 typedef int (*ht_alloc_func_t)(void **dst, void *data);
 typedef void (*ht_free_func_t)(void *kv);
 typedef int (*ht_foreach_func_t)(const ht_st *ht, void *key, void *value, void *data);
 
+/* Layout and behaviour selected at allocation time, see ht_alloc_flags */
+enum ht_flags_e
+{
+	HT_DEFAULT = 0,
+	/* Open addressing: 16 wide SSE2 probed control byte groups, keys/values in flat slot arrays */
+	HT_FLAT = 1 << 0,
+	/*
+	 * Chained layout only. Resizes keep the old bucket array around and every operation moves a
+	 * bounded number of its buckets over, instead of rehashing everything in one call.
+	 */
+	HT_INCREMENTAL = 1 << 1,
+	/*
+	 * Power of two bucket counts indexed by masking an avalanche mix of the hash, instead of a
+	 * 64-bit modulo by a prime. The mix keeps weak hashes (djb2) spread out. HT_FLAT always does
+	 * this.
+	 */
+	HT_POW2 = 1 << 2,
+	/*
+	 * Chained layout only. Fixed size keys/values (key_size/value_size without copy or free
+	 * functions) are stored inside the node instead of separate allocations. ht_get and
+	 * ht_emplace then point into the node: *ht_emplace(...) is the value storage itself and is
+	 * written in place. ht_take returns a malloc'd copy.
+	 */
+	HT_INLINE = 1 << 3,
+	/*
+	 * Keep a filter over the stored hashes in front of the table, so most lookups of absent keys
+	 * (ht_has, ht_get, ht_take, ht_delete and the batch versions) are answered by the filter
+	 * without walking a chain or probe sequence. It grows with the table by rebuilding from the
+	 * stored hashes. At most one of the two. Hits pay for the extra filter lookup, and
+	 * HT_FLAT probes already end most misses at their first control group, so this is meant for
+	 * miss heavy chained tables.
+	 *
+	 * HT_FILTER_BLOOM: blocked Bloom filter, 10 to 20 bits per entry and at most about 1% false
+	 * positives. Deleted entries stay in it until the next rebuild.
+	 * HT_FILTER_CUCKOO: cuckoo filter, 17 to 34 bits per entry and at most about 0.01% false
+	 * positives. Deletes are removed. A table whose keys share hashes en masse drops it once it
+	 * can't hold them.
+	 */
+	HT_FILTER_BLOOM  = 1 << 4,
+	HT_FILTER_CUCKOO = 1 << 5,
+};
+
 /**
  * Allocate a new table.
  *
@@ -49,6 +93,40 @@ int ht_alloc(ht_st **dst,
              size_t value_size,
              ht_alloc_func_t value_copy,
              ht_free_func_t value_free);
+/**
+ * Allocate a new table with a non default layout. Same as ht_alloc otherwise.
+ *
+ * @param flags A combination of enum ht_flags_e
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int ht_alloc_flags(ht_st **dst,
+                   uint32_t flags,
+                   ht_hash_func_t hash,
+                   ht_cmp_func_t cmp,
+                   size_t key_size,
+                   ht_alloc_func_t key_copy,
+                   ht_free_func_t key_free,
+                   size_t value_size,
+                   ht_alloc_func_t value_copy,
+                   ht_free_func_t value_free);
+/**
+ * Allocate a new table hashing with a seeded hash function. Every table draws its own random
+ * seed, so colliding key sets can't be precomputed or carried over between tables. Same as
+ * ht_alloc_flags otherwise.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int ht_alloc_seeded(ht_st **dst,
+                    uint32_t flags,
+                    ht_seeded_hash_func_t hash,
+                    ht_cmp_func_t cmp,
+                    size_t key_size,
+                    ht_alloc_func_t key_copy,
+                    ht_free_func_t key_free,
+                    size_t value_size,
+                    ht_alloc_func_t value_copy,
+                    ht_free_func_t value_free);
 void ht_free(ht_st **to_free);
 void ht_purge(ht_st *ht);
 
@@ -59,15 +137,120 @@ void *ht_get(ht_st *ht, const void *key);
 WARN_UNUSED void *ht_take(ht_st *ht, void *key);
 void ht_delete(ht_st *ht, void *key);
 int ht_foreach(ht_st *ht, ht_foreach_func_t body, void *data);
+/**
+ * Resumable iteration, chained HT_POW2 tables only. Start with *cursor at 0 and call again with the
+ * updated cursor until it comes back as 0. Each call visits whole buckets until at least max_items
+ * entries were handed to body, the table may be modified and resized between calls.
+ *
+ * Every entry present for the whole scan is visited at least once, entries may be visited more
+ * than once if the table shrank in between. The body has the same contract as for ht_foreach.
+ *
+ * @returns negative on failure, 0 if body stopped the scan, positive otherwise
+ */
+int ht_scan(ht_st *ht, size_t *cursor, size_t max_items, ht_foreach_func_t body, void *data);
+
+/**
+ * Batched ht_get. Keys are hashed and their buckets prefetched a chunk at a time before any is
+ * resolved, so the cache misses of a batch overlap. values[i] receives the value of keys[i], NULL
+ * when absent.
+ */
+void ht_get_many(ht_st *ht, void *const *keys, size_t n, void **values);
+/**
+ * Batched ht_has. found[i] is set for keys[i].
+ */
+void ht_has_many(ht_st *ht, void *const *keys, size_t n, bool *found);
+/**
+ * Batched ht_set, applied in order. On failure the pairs before the failing one are already set.
+ *
+ * @returns the number of new keys, negative on failure
+ */
+int ht_set_many(ht_st *ht, void *const *keys, void *const *values, size_t n);
+/**
+ * Insert n pairs after sizing the table once for all of them, instead of growing step by step.
+ *
+ * @returns the number of new keys, negative on failure
+ */
+int ht_bulk_load(ht_st *ht, void *const *keys, void *const *values, size_t n);
+
+/**
+ * Size the table for n entries now. It won't shrink below that size afterwards.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int ht_reserve(ht_st *ht, size_t n);
+/**
+ * Set the densities (entries per bucket) at which the table grows and shrinks. Defaults are 2.0
+ * and 0.25. A shrink threshold of 0 never shrinks. HT_FLAT tables always grow at 7/8 load and only
+ * take the shrink threshold. Keep a wide gap (4x or more) so churn around either threshold can't
+ * bounce the table between two sizes.
+ *
+ * @returns negative on failure (e.g., shrink at or above half of grow)
+ */
+int ht_set_thresholds(ht_st *ht, double grow, double shrink);
 
 size_t ht_buckets(ht_st *ht);
 size_t ht_size(ht_st *ht);
 double ht_density(ht_st *ht);
 
+/* Chain lengths past the last histogram entry are counted in it */
+#define HT_STATS_HIST (16)
+
+typedef struct ht_stats_s
+{
+	/*
+	 * Taken by walking the table on every ht_stats call. chain_hist[i] counts the buckets holding
+	 * i entries, for HT_FLAT the entries i probe groups away from their home group.
+	 */
+	size_t chain_hist[HT_STATS_HIST];
+	size_t max_chain;
+	/* Bucket array(s) or control bytes and slots, node slabs including inline keys/values */
+	size_t table_bytes;
+	size_t node_bytes;
+	/* Keys/values the table copied out of line. Custom copy functions can't be sized and count 0 */
+	size_t key_bytes;
+	size_t value_bytes;
+	/* HT_FILTER_* only, 0 if the table had to drop its filter */
+	size_t filter_bytes;
+
+	/*
+	 * Counted on every lookup (including the one ht_set does) when built with HT_STATS, 0 and
+	 * counting false otherwise. probes are nodes (HT_FLAT: groups) visited, compares are calls to
+	 * the table's cmp; compares / (hits + misses) is the average per lookup. resize_ns includes
+	 * the steps of HT_INCREMENTAL migrations. filtered are the misses a filter answered, they
+	 * cost no probes or compares.
+	 */
+	bool counting;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t filtered;
+	uint64_t probes;
+	uint64_t compares;
+	uint64_t resizes;
+	uint64_t resize_ns;
+} ht_stats_st;
+
+/**
+ * Fill dst with the statistics of ht. Walks the whole table without resizing it, meant for
+ * diagnostics, not hot paths.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int ht_stats(ht_st *ht, ht_stats_st *dst);
+/* Zero the HT_STATS counters */
+void ht_stats_reset(ht_st *ht);
+
+/**
+ * Word at a time hash (wyhash) of len bytes. Used by the string and arbitrary key hashes below.
+ */
+uint64_t ht_hash_bytes(const void *data, size_t len, uint64_t seed);
+
 size_t ht_int_hash(const void *key);
+size_t ht_int_hash_seeded(const void *key, uint64_t seed);
 int64_t ht_int_cmp(const void *key1, const void *key2);
 
+/* Seeded once per process, use ht_str_hash_seeded for a per table seed */
 size_t ht_str_hash(const void *key);
+size_t ht_str_hash_seeded(const void *key, uint64_t seed);
 int64_t ht_str_cmp(const void *key1, const void *key2);
 int ht_str_copy(void **dst, void *key);
 void ht_str_free(void *key);
@@ -80,18 +263,72 @@ int64_t ht_arb_cmp_util(void *key1, void *key2, size_t size);
 #define ht_int_set(ht, key, value) ht_set((ht), (void *) (uint64_t) (key), (void *) (value))
 #define ht_int_get(ht, key)        ht_get((ht), (void *) (uint64_t) (key))
 #define ht_int_delete(ht, key)     ht_delete(ht, (void *) (uint64_t) (key))
-/* Allocate a string -> user defined data hash table. Copies via strdup */
+/* Allocate a string -> user defined data hash table. Copies via strdup, hashes with a table seed */
 #define ht_str_alloc(dst, value_size, value_copy, value_free)                                      \
-	ht_alloc(dst,                                                                                  \
-	         ht_str_hash,                                                                          \
-	         ht_str_cmp,                                                                           \
-	         0,                                                                                    \
-	         ht_str_copy,                                                                          \
-	         ht_str_free,                                                                          \
-	         value_size,                                                                           \
-	         value_copy,                                                                           \
-	         value_free)
+	ht_alloc_seeded(dst,                                                                           \
+	                HT_DEFAULT,                                                                    \
+	                ht_str_hash_seeded,                                                            \
+	                ht_str_cmp,                                                                    \
+	                0,                                                                             \
+	                ht_str_copy,                                                                   \
+	                ht_str_free,                                                                   \
+	                value_size,                                                                    \
+	                value_copy,                                                                    \
+	                value_free)
 #define ht_str_set(ht, key, value) ht_set(ht, (void *) (key), (void *) (value))
 #define ht_str_get(ht, key)        ht_get(ht, (void *) (key))
 
+/* Keys up to this many bytes are stored in the node, longer ones on the heap */
+#define HT_STRN_INLINE (23)
+
+/* A string slice, need not be NUL terminated */
+typedef struct ht_strn_s
+{
+	const char *str;
+	size_t len;
+} ht_strn_st;
+
+/**
+ * Allocate a string slice -> user defined data hash table. Keys are looked up by (pointer, length)
+ * so tokens can be used straight out of a buffer. Stored keys keep their length and hash, short
+ * ones inline in the node. Values are stored inline only when flags has HT_INLINE, as in any
+ * other table. Chained layout only.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int ht_strn_alloc(ht_st **dst,
+                  uint32_t flags,
+                  size_t value_size,
+                  ht_alloc_func_t value_copy,
+                  ht_free_func_t value_free);
+/* View of a stored key as handed to ht_foreach bodies. str is NUL terminated. */
+ht_strn_st ht_strn_key(const void *key);
+#define ht_strn_set(ht, s, n, value)                                                               \
+	ht_set((ht), &(ht_strn_st){.str = (s), .len = (n)}, (void *) (value))
+#define ht_strn_get(ht, s, n)    ht_get((ht), &(ht_strn_st){.str = (s), .len = (n)})
+#define ht_strn_has(ht, s, n)    ht_has((ht), &(ht_strn_st){.str = (s), .len = (n)})
+#define ht_strn_delete(ht, s, n) ht_delete((ht), &(ht_strn_st){.str = (s), .len = (n)})
+
+/**
+ * Write the table to path as a flat, position independent file that ht_snapshot_map serves
+ * lookups from without loading it. Keys and values are written as bytes: pointer sized ints when
+ * key_size/value_size is 0, key_size/value_size bytes otherwise, strings for ht_str_copy and
+ * ht_strn_alloc. Tables with any other copy function are rejected. Files are only portable between
+ * machines of the same endianness.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int ht_snapshot_write(ht_st *ht, const char *path);
+/**
+ * Map a file written by ht_snapshot_write as a read only table. ht_get/ht_has (and their batched
+ * forms) are answered from the mapping, pages are faulted in as lookups touch them. Values are
+ * returned as pointers into the read only mapping, except pointer sized ones which are returned
+ * as is. Probe keys are passed the same way as for the table that was written. Any modification,
+ * ht_foreach and ht_scan fail; ht_free unmaps. Records are bounds checked as lookups reach them,
+ * keys whose record is corrupt are reported missing.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int ht_snapshot_map(ht_st **dst, const char *path);
+
 #define HT_CLEANUP CLEANUP(ht_free)
@@ -0,0 +1,225 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * This is a generator for typed hashtables. HT_DEFINE(name, key_type, value_type, hash_fn, eq_fn)
+ * emits a table type `name##_st` and static inline `name##_*` functions with the hash and compare
+ * inlined and keys/values stored by value in one open addressing slot array.
+ *
+ * Collisions probe linearly. Each slot has a control byte, 0 when empty or the top 7 bits of the
+ * hash with the high bit set when full, so most mismatches are rejected without calling eq_fn.
+ * Deletion shifts the following entries back instead of leaving tombstones.
+ *
+ * hash_fn(key) must spread its entropy into the low bits, ht_typed_int_hash does for integers.
+ * eq_fn(a, b) must be true for equal keys. The table never frees keys or values.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../errstack.h"
+#include "../util.h"
+
+#define HT_TYPED_MIN_CAP (16)
+/* Grow past 3/4 full, linear probing degrades quickly beyond that */
+#define HT_TYPED_FULL(n, cap) ((n) * 4 > (cap) * 3)
+
+static inline size_t ht_typed_int_hash(uint64_t x)
+{
+	x = (x ^ (x >> 31) ^ (x >> 62)) * UINT64_C(0x319642b2d24d8ec3);
+	x = (x ^ (x >> 27) ^ (x >> 54)) * UINT64_C(0x96de1b173f119089);
+	return x ^ (x >> 30) ^ (x >> 60);
+}
+
+#define HT_TYPED_EQ(a, b) ((a) == (b))
+
+#define HT_TYPED_CLEANUP(name) CLEANUP(name##_free)
+
+/*
+ * Emit the table `name##_st` and its functions: name##_alloc, name##_free, name##_reserve,
+ * name##_set, name##_get, name##_has, name##_delete, name##_purge, name##_size, name##_foreach.
+ * Invoke once per translation unit at file scope.
+ */
+#define HT_DEFINE(name, key_type, value_type, hash_fn, eq_fn)                                      \
+	typedef struct                                                                                 \
+	{                                                                                              \
+		key_type key;                                                                              \
+		value_type value;                                                                          \
+	} name##_slot_t;                                                                               \
+                                                                                                   \
+	typedef struct name##_s                                                                        \
+	{                                                                                              \
+		size_t n;                                                                                  \
+		size_t mask;                                                                               \
+		uint8_t *ctrl;                                                                             \
+		name##_slot_t *slots;                                                                      \
+	} name##_st;                                                                                   \
+                                                                                                   \
+	typedef int (*name##_foreach_func_t)(key_type * key, value_type * value, void *data);          \
+                                                                                                   \
+	static inline uint8_t name##_tag_(size_t hash)                                                 \
+	{                                                                                              \
+		return 0x80 | (hash >> (sizeof(size_t) * 8 - 7));                                          \
+	}                                                                                              \
+                                                                                                   \
+	static inline void name##_free(name##_st **to_free)                                            \
+	{                                                                                              \
+		if (!to_free || !*to_free)                                                                 \
+			return;                                                                                \
+		free((*to_free)->ctrl);                                                                    \
+		free((*to_free)->slots);                                                                   \
+		free(*to_free);                                                                            \
+		*to_free = NULL;                                                                           \
+	}                                                                                              \
+                                                                                                   \
+	static inline int name##_rehash_(name##_st *ht, size_t cap)                                    \
+	{                                                                                              \
+		uint8_t *ctrl = NULL;                                                                      \
+		name##_slot_t *slots;                                                                      \
+		size_t i;                                                                                  \
+		ES_NEW_ASRT_NM(ctrl = calloc(cap, sizeof(*ctrl)));                                         \
+		if (!(slots = malloc(cap * sizeof(*slots)))) {                                             \
+			free(ctrl);                                                                            \
+			ES_NEW_ASRT_NM(false);                                                                 \
+		}                                                                                          \
+		for (i = 0; ht->ctrl && i <= ht->mask; i++) {                                              \
+			size_t j;                                                                              \
+			if (!ht->ctrl[i])                                                                      \
+				continue;                                                                          \
+			j = hash_fn(ht->slots[i].key) & (cap - 1);                                             \
+			while (ctrl[j]) {                                                                      \
+				j = (j + 1) & (cap - 1);                                                           \
+			}                                                                                      \
+			ctrl[j]  = ht->ctrl[i];                                                                \
+			slots[j] = ht->slots[i];                                                               \
+		}                                                                                          \
+		free(ht->ctrl);                                                                            \
+		free(ht->slots);                                                                           \
+		ht->ctrl  = ctrl;                                                                          \
+		ht->slots = slots;                                                                         \
+		ht->mask  = cap - 1;                                                                       \
+		return 1;                                                                                  \
+	}                                                                                              \
+                                                                                                   \
+	static inline int name##_alloc(name##_st **dst)                                                \
+	{                                                                                              \
+		HT_TYPED_CLEANUP(name) name##_st *tmp = NULL;                                              \
+		ES_NEW_ASRT_NM(dst);                                                                       \
+		*dst = NULL;                                                                               \
+		ES_NEW_ASRT_NM(tmp = calloc(1, sizeof(*tmp)));                                             \
+		ES_FWD_INT_NM(name##_rehash_(tmp, HT_TYPED_MIN_CAP));                                      \
+		*dst = MOVE_PZ(tmp);                                                                       \
+		return 1;                                                                                  \
+	}                                                                                              \
+                                                                                                   \
+	/* Make room for n entries without growing again */                                            \
+	static inline int name##_reserve(name##_st *ht, size_t n)                                      \
+	{                                                                                              \
+		size_t cap = ht->mask + 1;                                                                 \
+		while (HT_TYPED_FULL(n, cap)) {                                                            \
+			cap *= 2;                                                                              \
+		}                                                                                          \
+		if (cap != ht->mask + 1)                                                                   \
+			ES_FWD_INT_NM(name##_rehash_(ht, cap));                                                \
+		return 1;                                                                                  \
+	}                                                                                              \
+                                                                                                   \
+	static inline size_t name##_find_(const name##_st *ht, key_type key, size_t hash)              \
+	{                                                                                              \
+		const uint8_t tag = name##_tag_(hash);                                                     \
+		size_t i;                                                                                  \
+		for (i = hash & ht->mask; ht->ctrl[i]; i = (i + 1) & ht->mask) {                           \
+			if (ht->ctrl[i] == tag && eq_fn(ht->slots[i].key, key))                                \
+				return i;                                                                          \
+		}                                                                                          \
+		return SIZE_MAX;                                                                           \
+	}                                                                                              \
+                                                                                                   \
+	/* @returns 1 if the key is new, 0 if its value was replaced, negative on failure */           \
+	static inline int name##_set(name##_st *ht, key_type key, value_type value)                    \
+	{                                                                                              \
+		size_t hash = hash_fn(key);                                                                \
+		size_t i    = name##_find_(ht, key, hash);                                                 \
+		if (i != SIZE_MAX) {                                                                       \
+			ht->slots[i].value = value;                                                            \
+			return 0;                                                                              \
+		}                                                                                          \
+		if (HT_TYPED_FULL(ht->n + 1, ht->mask + 1))                                                \
+			ES_FWD_INT_NM(name##_rehash_(ht, (ht->mask + 1) * 2));                                 \
+		i = hash & ht->mask;                                                                       \
+		while (ht->ctrl[i]) {                                                                      \
+			i = (i + 1) & ht->mask;                                                                \
+		}                                                                                          \
+		ht->ctrl[i]        = name##_tag_(hash);                                                    \
+		ht->slots[i].key   = key;                                                                  \
+		ht->slots[i].value = value;                                                                \
+		ht->n++;                                                                                   \
+		return 1;                                                                                  \
+	}                                                                                              \
+                                                                                                   \
+	/* @returns a pointer to the stored value, valid until the next set/delete. NULL if absent */  \
+	static inline value_type *name##_get(const name##_st *ht, key_type key)                        \
+	{                                                                                              \
+		size_t i = name##_find_(ht, key, hash_fn(key));                                            \
+		return i == SIZE_MAX ? NULL : &ht->slots[i].value;                                         \
+	}                                                                                              \
+                                                                                                   \
+	static inline bool name##_has(const name##_st *ht, key_type key)                               \
+	{                                                                                              \
+		return name##_find_(ht, key, hash_fn(key)) != SIZE_MAX;                                    \
+	}                                                                                              \
+                                                                                                   \
+	/* @returns true if the key was present */                                                     \
+	static inline bool name##_delete(name##_st *ht, key_type key)                                  \
+	{                                                                                              \
+		size_t i = name##_find_(ht, key, hash_fn(key));                                            \
+		size_t j;                                                                                  \
+		if (i == SIZE_MAX)                                                                         \
+			return false;                                                                          \
+		for (j = (i + 1) & ht->mask; ht->ctrl[j]; j = (j + 1) & ht->mask) {                        \
+			size_t home = hash_fn(ht->slots[j].key) & ht->mask;                                    \
+			/* j may fill the hole unless its home slot lies cyclically in (i, j] */               \
+			if (((j - home) & ht->mask) >= ((j - i) & ht->mask)) {                                 \
+				ht->ctrl[i]  = ht->ctrl[j];                                                        \
+				ht->slots[i] = ht->slots[j];                                                       \
+				i            = j;                                                                  \
+			}                                                                                      \
+		}                                                                                          \
+		ht->ctrl[i] = 0;                                                                           \
+		ht->n--;                                                                                   \
+		return true;                                                                               \
+	}                                                                                              \
+                                                                                                   \
+	static inline void name##_purge(name##_st *ht)                                                 \
+	{                                                                                              \
+		memset(ht->ctrl, 0, ht->mask + 1);                                                         \
+		ht->n = 0;                                                                                 \
+	}                                                                                              \
+                                                                                                   \
+	static inline size_t name##_size(const name##_st *ht)                                          \
+	{                                                                                              \
+		return ht->n;                                                                              \
+	}                                                                                              \
+                                                                                                   \
+	/*                                                                                             \
+	 * body returns as for ht_foreach, but unlike ht_foreach it must not set or delete anything,   \
+	 * not even the current entry: deletion shifts later entries back, so some would be skipped    \
+	 * and others visited twice.                                                                   \
+	 */                                                                                            \
+	static inline int name##_foreach(name##_st *ht, name##_foreach_func_t body, void *data)        \
+	{                                                                                              \
+		size_t i;                                                                                  \
+		int ret = 1;                                                                               \
+		ES_NEW_ASRT_NM(ht);                                                                        \
+		for (i = 0; i <= ht->mask && ret > 0; i++) {                                               \
+			if (ht->ctrl[i])                                                                       \
+				ret = body(&ht->slots[i].key, &ht->slots[i].value, data);                          \
+		}                                                                                          \
+		ES_FWD_INT_NM(ret);                                                                        \
+		return ret;                                                                                \
+	}
@@ -0,0 +1,410 @@
+#include "intseq.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * This is an implementation for a compressed integer sequence.
+ *
+ * Values are collected in tail until INTSEQ_BLOCK of them fill a block. The block is stored as its
+ * first value, kept in the skip entry, and the differences between neighbours, the first of which
+ * is 0. The differences are bit packed at the width of the largest one, a block of equal values
+ * takes no words at all.
+ *
+ * Packing is vertical over LANES 64-bit lanes: difference i goes to lane i % LANES, and each lane
+ * packs its values one after another into every LANES-th word. Every lane then has the same bit
+ * offset for the same step, so one load, shift and mask decodes LANES differences, which are
+ * consecutive in the output. With LANES * 64 values in a block, each lane takes exactly one word
+ * per bit of width. SSE2 handles two lanes at a time and AVX2 all four, chosen by a constructor the
+ * way soa.c chooses its kernels. The running sum restoring the values stays a plain loop.
+ *
+ * Searching goes through the skip entries first: a block starting above the key can't hold it, so
+ * only the block before it gets decoded. Intersection leapfrogs two such searches.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#	include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#	include <immintrin.h>
+#	define INTSEQ_AVX2
+#endif
+
+#include "../errstack.h"
+
+#define LANES    (4)
+#define LANE_LEN (INTSEQ_BLOCK / LANES)
+#define MIN_CAP  (16)
+
+typedef struct
+{
+	uint64_t first;
+	/* Where the block's words start, it has bits * LANES of them */
+	uint64_t offset : 56;
+	uint64_t bits : 8;
+} _skip_t;
+
+struct intseq_s
+{
+	size_t size;
+	uint64_t last;
+	uint64_t *words;
+	size_t n_words;
+	size_t cap_words;
+	_skip_t *skips;
+	size_t n_blocks;
+	size_t cap_blocks;
+	/* The last size % INTSEQ_BLOCK values, not packed yet */
+	uint64_t tail[INTSEQ_BLOCK];
+};
+
+/* A position in a sequence, with its block decoded */
+typedef struct
+{
+	const intseq_st *seq;
+	size_t block;
+	size_t pos;
+	size_t n;
+	uint64_t buf[INTSEQ_BLOCK];
+} _iter_t;
+
+typedef void (*_unpack_t)(const uint64_t *words, unsigned bits, uint64_t *out);
+
+static inline uint64_t _mask(unsigned bits)
+{
+	return bits == 64 ? UINT64_MAX : (UINT64_C(1) << bits) - 1;
+}
+
+static void _unpack_scalar(const uint64_t *words, unsigned bits, uint64_t *out)
+{
+	uint64_t mask = _mask(bits);
+	size_t k, lane;
+	for (k = 0; k < LANE_LEN; k++) {
+		size_t off = k * bits, j = off / 64;
+		unsigned s = off % 64;
+		for (lane = 0; lane < LANES; lane++) {
+			uint64_t v = words[j * LANES + lane] >> s;
+			if (s + bits > 64)
+				v |= words[(j + 1) * LANES + lane] << (64 - s);
+			out[k * LANES + lane] = v & mask;
+		}
+	}
+}
+
+#ifdef __SSE2__
+static void _unpack_sse2(const uint64_t *words, unsigned bits, uint64_t *out)
+{
+	__m128i mask = _mm_set1_epi64x(_mask(bits));
+	size_t k, half;
+	for (k = 0; k < LANE_LEN; k++) {
+		size_t off = k * bits, j = off / 64;
+		__m128i lo = _mm_cvtsi32_si128(off % 64), hi = _mm_cvtsi32_si128(64 - off % 64);
+		for (half = 0; half < LANES; half += 2) {
+			const uint64_t *w = words + j * LANES + half;
+			__m128i v         = _mm_srl_epi64(_mm_loadu_si128((const __m128i *) w), lo);
+			if (off % 64 + bits > 64) {
+				__m128i next = _mm_loadu_si128((const __m128i *) (w + LANES));
+				v            = _mm_or_si128(v, _mm_sll_epi64(next, hi));
+			}
+			_mm_storeu_si128((__m128i *) (out + k * LANES + half), _mm_and_si128(v, mask));
+		}
+	}
+}
+#endif
+
+#ifdef INTSEQ_AVX2
+__attribute__((target("avx2"))) static void _unpack_avx2(
+    const uint64_t *words, unsigned bits, uint64_t *out)
+{
+	__m256i mask = _mm256_set1_epi64x(_mask(bits));
+	size_t k;
+	for (k = 0; k < LANE_LEN; k++) {
+		size_t off = k * bits, j = off / 64;
+		const uint64_t *w = words + j * LANES;
+		__m256i v = _mm256_srl_epi64(_mm256_loadu_si256((const __m256i *) w),
+		                             _mm_cvtsi32_si128(off % 64));
+		if (off % 64 + bits > 64) {
+			__m256i next = _mm256_loadu_si256((const __m256i *) (w + LANES));
+			v = _mm256_or_si256(v, _mm256_sll_epi64(next, _mm_cvtsi32_si128(64 - off % 64)));
+		}
+		_mm256_storeu_si256((__m256i *) (out + k * LANES), _mm256_and_si256(v, mask));
+	}
+}
+#endif
+
+static _unpack_t _unpack    = _unpack_scalar;
+static intseq_simd_t _level = INTSEQ_SIMD_SCALAR;
+
+intseq_simd_t intseq_simd_set(intseq_simd_t level)
+{
+#ifdef INTSEQ_AVX2
+	if (level >= INTSEQ_SIMD_AVX2 && __builtin_cpu_supports("avx2")) {
+		_unpack = _unpack_avx2;
+		return _level = INTSEQ_SIMD_AVX2;
+	}
+#endif
+#ifdef __SSE2__
+	if (level >= INTSEQ_SIMD_SSE2) {
+		_unpack = _unpack_sse2;
+		return _level = INTSEQ_SIMD_SSE2;
+	}
+#endif
+	_unpack = _unpack_scalar;
+	return _level = INTSEQ_SIMD_SCALAR;
+}
+
+intseq_simd_t intseq_simd_level(void)
+{
+	return _level;
+}
+
+__attribute__((constructor)) static void _intseq_init(void)
+{
+#ifdef INTSEQ_AVX2
+	__builtin_cpu_init();
+#endif
+	intseq_simd_set(INTSEQ_SIMD_AVX2);
+}
+
+static void _pack(const uint64_t *deltas, unsigned bits, uint64_t *words)
+{
+	size_t k, lane;
+	if (!bits)
+		return;
+	memset(words, 0, bits * LANES * sizeof(*words));
+	for (k = 0; k < LANE_LEN; k++) {
+		size_t off = k * bits, j = off / 64;
+		unsigned s = off % 64;
+		for (lane = 0; lane < LANES; lane++) {
+			uint64_t d = deltas[k * LANES + lane];
+			words[j * LANES + lane] |= d << s;
+			if (s + bits > 64)
+				words[(j + 1) * LANES + lane] |= d >> (64 - s);
+		}
+	}
+}
+
+/* Make room for need elements of elm_size in *arr, doubling its capacity */
+static int _reserve(void **arr, size_t *capacity, size_t need, size_t elm_size)
+{
+	size_t cap = MAX(*capacity, (size_t) MIN_CAP);
+	void *tmp;
+	if (need <= *capacity)
+		return 1;
+	while (cap < need) {
+		cap *= 2;
+	}
+	ES_NEW_ASRT_NM(tmp = realloc(*arr, cap * elm_size));
+	*arr      = tmp;
+	*capacity = cap;
+	return 1;
+}
+
+/* Pack the full tail into a new block */
+static int _flush(intseq_st *seq)
+{
+	uint64_t deltas[INTSEQ_BLOCK], any = 0;
+	unsigned bits;
+	size_t i;
+	deltas[0] = 0;
+	for (i = 1; i < INTSEQ_BLOCK; i++) {
+		deltas[i] = seq->tail[i] - seq->tail[i - 1];
+		any |= deltas[i];
+	}
+	bits = any ? 64 - __builtin_clzll(any) : 0;
+	ES_FWD_INT_NM(_reserve((void **) &seq->words,
+	                       &seq->cap_words,
+	                       seq->n_words + bits * LANES,
+	                       sizeof(*seq->words)));
+	ES_FWD_INT_NM(_reserve(
+	    (void **) &seq->skips, &seq->cap_blocks, seq->n_blocks + 1, sizeof(*seq->skips)));
+	_pack(deltas, bits, seq->words + seq->n_words);
+	seq->skips[seq->n_blocks++] = (_skip_t){
+	    .first  = seq->tail[0],
+	    .offset = seq->n_words,
+	    .bits   = bits,
+	};
+	seq->n_words += bits * LANES;
+	return 1;
+}
+
+int intseq_alloc(intseq_st **dst)
+{
+	ES_NEW_ASRT_NM(dst);
+	ES_NEW_ASRT_NM(*dst = calloc(1, sizeof(**dst)));
+	return 1;
+}
+
+void intseq_free(intseq_st **to_free)
+{
+	if (!to_free || !*to_free)
+		return;
+	free((*to_free)->words);
+	free((*to_free)->skips);
+	free(*to_free);
+	*to_free = NULL;
+}
+
+int intseq_append(intseq_st *seq, uint64_t value)
+{
+	ES_NEW_ASRT(!seq->size || value >= seq->last, "%lu appended after %lu", value, seq->last);
+	seq->tail[seq->size % INTSEQ_BLOCK] = value;
+	if (seq->size % INTSEQ_BLOCK == INTSEQ_BLOCK - 1)
+		ES_FWD_INT_NM(_flush(seq));
+	seq->size++;
+	seq->last = value;
+	return 1;
+}
+
+size_t intseq_size(const intseq_st *seq)
+{
+	return seq->size;
+}
+
+size_t intseq_bytes(const intseq_st *seq)
+{
+	return sizeof(*seq) + seq->cap_words * sizeof(*seq->words) +
+	       seq->cap_blocks * sizeof(*seq->skips);
+}
+
+size_t intseq_blocks(const intseq_st *seq)
+{
+	return (seq->size + INTSEQ_BLOCK - 1) / INTSEQ_BLOCK;
+}
+
+size_t intseq_decode_block(const intseq_st *seq, size_t block, uint64_t out[INTSEQ_BLOCK])
+{
+	const _skip_t *skip;
+	size_t i;
+	if (block >= seq->n_blocks) {
+		size_t n = block == seq->n_blocks ? seq->size % INTSEQ_BLOCK : 0;
+		memcpy(out, seq->tail, n * sizeof(*out));
+		return n;
+	}
+	skip = &seq->skips[block];
+	if (skip->bits)
+		_unpack(seq->words + skip->offset, skip->bits, out);
+	else
+		memset(out, 0, INTSEQ_BLOCK * sizeof(*out));
+	out[0] = skip->first;
+	for (i = 1; i < INTSEQ_BLOCK; i++) {
+		out[i] += out[i - 1];
+	}
+	return INTSEQ_BLOCK;
+}
+
+void intseq_copy_out(const intseq_st *seq, uint64_t *dst)
+{
+	size_t block;
+	for (block = 0; block < intseq_blocks(seq); block++) {
+		intseq_decode_block(seq, block, dst + block * INTSEQ_BLOCK);
+	}
+}
+
+bool intseq_at(const intseq_st *seq, size_t idx, uint64_t *value)
+{
+	uint64_t buf[INTSEQ_BLOCK];
+	if (idx >= seq->size)
+		return false;
+	intseq_decode_block(seq, idx / INTSEQ_BLOCK, buf);
+	*value = buf[idx % INTSEQ_BLOCK];
+	return true;
+}
+
+static inline uint64_t _block_first(const intseq_st *seq, size_t block)
+{
+	return block < seq->n_blocks ? seq->skips[block].first : seq->tail[0];
+}
+
+/* @returns the first block at or after from whose first value is not less than key */
+static size_t _block_search(const intseq_st *seq, size_t from, uint64_t key)
+{
+	size_t lo = from, hi = intseq_blocks(seq);
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (_block_first(seq, mid) < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* @returns false if the block is past the end */
+static bool _iter_load(_iter_t *it, size_t block)
+{
+	it->block = block;
+	it->pos   = 0;
+	it->n     = intseq_decode_block(it->seq, block, it->buf);
+	return it->n;
+}
+
+static bool _iter_next(_iter_t *it)
+{
+	if (++it->pos < it->n)
+		return true;
+	return _iter_load(it, it->block + 1);
+}
+
+/* Move to the first value not less than key, never backwards. @returns false if there is none */
+static bool _iter_seek(_iter_t *it, uint64_t key)
+{
+	size_t lo, hi;
+	if (it->pos == it->n || it->buf[it->n - 1] < key) {
+		size_t block = _block_search(it->seq, it->block + 1, key);
+		/* The block before the first one starting at or after key is the only other candidate */
+		bool before  = block > it->block + 1 && _iter_load(it, block - 1) &&
+		              it->buf[it->n - 1] >= key;
+		if (!before && !_iter_load(it, block))
+			return false;
+	}
+	lo = it->pos;
+	hi = it->n;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (it->buf[mid] < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	it->pos = lo;
+	return true;
+}
+
+size_t intseq_lower_bound(const intseq_st *seq, uint64_t key)
+{
+	_iter_t it;
+	it.seq = seq;
+	if (!_iter_load(&it, 0) || !_iter_seek(&it, key))
+		return seq->size;
+	return it.block * INTSEQ_BLOCK + it.pos;
+}
+
+int intseq_intersect(const intseq_st *a, const intseq_st *b, intseq_st **dst)
+{
+	INTSEQ_CLEANUP intseq_st *tmp = NULL;
+	_iter_t ia, ib;
+	bool more;
+	ES_NEW_ASRT_NM(dst);
+	*dst = NULL;
+	ES_FWD_INT_NM(intseq_alloc(&tmp));
+	ia.seq = a;
+	ib.seq = b;
+	more   = _iter_load(&ia, 0) && _iter_load(&ib, 0);
+	while (more) {
+		uint64_t x = ia.buf[ia.pos], y = ib.buf[ib.pos];
+		if (x < y) {
+			more = _iter_seek(&ia, y);
+		} else if (y < x) {
+			more = _iter_seek(&ib, x);
+		} else {
+			ES_FWD_INT_NM(intseq_append(tmp, x));
+			more = _iter_next(&ia) && _iter_next(&ib);
+		}
+	}
+	*dst = MOVE_PZ(tmp);
+	return 1;
+}
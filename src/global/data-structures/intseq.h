@@ -0,0 +1,75 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * This is an implementation for a compressed sequence of non-decreasing 64-bit integers, such as
+ * sorted id lists. Values are appended in order and stored in blocks of INTSEQ_BLOCK, each block
+ * as the differences between consecutive values packed at the width of its largest difference.
+ * Dense ids take a byte or two per value instead of eight.
+ *
+ * A skip entry per block keeps its first value, so lower_bound and intersection look at the blocks
+ * that can hold a match and decode only those. Blocks are unpacked with AVX2 or SSE2 when the CPU
+ * has it, at the level set by intseq_simd_set.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "../util.h"
+
+struct intseq_s;
+typedef struct intseq_s intseq_st;
+
+#define INTSEQ_BLOCK (256)
+
+typedef enum
+{
+	INTSEQ_SIMD_SCALAR,
+	INTSEQ_SIMD_SSE2,
+	INTSEQ_SIMD_AVX2,
+} intseq_simd_t;
+
+int intseq_alloc(intseq_st **dst);
+void intseq_free(intseq_st **to_free);
+/**
+ * Append value, which must not be less than the last one. Every INTSEQ_BLOCK values are packed
+ * into a new block.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int intseq_append(intseq_st *seq, uint64_t value);
+size_t intseq_size(const intseq_st *seq);
+/* Bytes allocated for the sequence, the unpacked last block included */
+size_t intseq_bytes(const intseq_st *seq);
+/* Blocks holding intseq_size values, the last one possibly partial */
+size_t intseq_blocks(const intseq_st *seq);
+/**
+ * Decode block into out, the values at indices block * INTSEQ_BLOCK onwards.
+ *
+ * @returns the number of values written, 0 if block is out of range
+ */
+size_t intseq_decode_block(const intseq_st *seq, size_t block, uint64_t out[INTSEQ_BLOCK]);
+/* Decode every value into dst, which has room for intseq_size values */
+void intseq_copy_out(const intseq_st *seq, uint64_t *dst);
+/* Decode the value at idx into *value, unpacking its block. @returns false if out of range */
+bool intseq_at(const intseq_st *seq, size_t idx, uint64_t *value);
+/* @returns the index of the first value not less than key, intseq_size if none */
+size_t intseq_lower_bound(const intseq_st *seq, uint64_t key);
+/**
+ * Allocate *dst holding the values found in both a and b. A value repeated in both appears as
+ * many times as in the one repeating it less.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int intseq_intersect(const intseq_st *a, const intseq_st *b, intseq_st **dst);
+
+/* @returns the level blocks are unpacked with */
+intseq_simd_t intseq_simd_level(void);
+/* Use level, or the best supported level below it. @returns the level in use. Not thread safe. */
+intseq_simd_t intseq_simd_set(intseq_simd_t level);
+
+#define INTSEQ_CLEANUP CLEANUP(intseq_free)
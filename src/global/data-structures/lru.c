@@ -0,0 +1,363 @@
+#include "lru.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * This is an implementation for a bounded cache.
+ *
+ * Each entry embeds its llist_st node, the list runs from least to most recently used. The
+ * hashtable maps keys to entries and borrows the key stored in the entry, so a key is copied once
+ * and eviction finds it without a lookup. With LRU_CLOCK hits only set the referenced flag;
+ * eviction requeues referenced entries at the tail and takes the first one that isn't.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../errstack.h"
+#include "linkedlist.h"
+
+#define CACHE_LINE (64)
+
+typedef struct _entry_s
+{
+	/* First so the list node is the entry */
+	llist_st list;
+	void *key;
+	void *value;
+	size_t charge;
+	bool referenced;
+} _entry_t;
+
+struct lru_s
+{
+	uint32_t flags;
+	size_t capacity_entries;
+	size_t capacity_bytes;
+	size_t bytes;
+	/* Keys are borrowed from the entries, values are the entries */
+	ht_st *entries;
+	llist_st order;
+
+	size_t key_size;
+	ht_alloc_func_t key_copy;
+	ht_free_func_t key_free;
+	lru_evict_func_t on_evict;
+	void *evict_data;
+
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+};
+
+typedef struct _shard_s
+{
+	pthread_mutex_t lock;
+	lru_st *lru;
+} __attribute__((aligned(CACHE_LINE))) _shard_t;
+
+struct lru_sharded_s
+{
+	ht_hash_func_t hash;
+	size_t mask;
+	_shard_t shards[];
+};
+
+static int _copy_key(lru_st *lru, void **dst, void *key)
+{
+	if (lru->key_copy) {
+		ES_NEW_INT_NM(lru->key_copy(dst, key));
+	} else if (lru->key_size) {
+		ES_NEW_ASRT_NM(*dst = malloc(lru->key_size));
+		memcpy(*dst, key, lru->key_size);
+	} else {
+		*dst = key;
+	}
+	return 1;
+}
+
+static void _free_key(lru_st *lru, void *key)
+{
+	if (lru->key_free)
+		lru->key_free(key);
+	else if (lru->key_size)
+		free(key);
+}
+
+/* Unlink an entry and hand its value to on_evict */
+static void _drop(lru_st *lru, _entry_t *entry)
+{
+	ht_delete(lru->entries, entry->key);
+	ll_remove(&entry->list);
+	lru->bytes -= entry->charge;
+	if (lru->on_evict)
+		lru->on_evict(entry->key, entry->value, lru->evict_data);
+	_free_key(lru, entry->key);
+	free(entry);
+}
+
+static bool _over(const lru_st *lru)
+{
+	return (lru->capacity_entries && ht_size(lru->entries) > lru->capacity_entries) ||
+	       (lru->capacity_bytes && lru->bytes > lru->capacity_bytes);
+}
+
+static void _requeue(lru_st *lru, _entry_t *entry)
+{
+	ll_remove(&entry->list);
+	ll_emplace_back(&lru->order, entry);
+}
+
+static void _evict(lru_st *lru)
+{
+	while (_over(lru)) {
+		_entry_t *victim = (_entry_t *) lru->order.next;
+		if (victim->referenced) {
+			victim->referenced = false;
+			_requeue(lru, victim);
+			continue;
+		}
+		_drop(lru, victim);
+		lru->evictions++;
+	}
+}
+
+int lru_alloc(lru_st **dst,
+              uint32_t flags,
+              size_t capacity_entries,
+              size_t capacity_bytes,
+              ht_hash_func_t hash,
+              ht_cmp_func_t cmp,
+              size_t key_size,
+              ht_alloc_func_t key_copy,
+              ht_free_func_t key_free,
+              lru_evict_func_t on_evict,
+              void *evict_data)
+{
+	LRU_CLEANUP lru_st *tmp = NULL;
+	ES_NEW_ASRT_NM(dst);
+	*dst = NULL;
+	ES_NEW_ASRT(capacity_entries || capacity_bytes, "Cache needs a capacity");
+	ES_NEW_ASRT_NM(tmp = calloc(1, sizeof(*tmp)));
+	ll_init(&tmp->order);
+	ES_FWD_INT_NM(ht_alloc(&tmp->entries, hash, cmp, 0, NULL, NULL, 0, NULL, NULL));
+	if (capacity_entries)
+		ES_FWD_INT_NM(ht_reserve(tmp->entries, capacity_entries));
+	tmp->flags            = flags;
+	tmp->capacity_entries = capacity_entries;
+	tmp->capacity_bytes   = capacity_bytes;
+	tmp->key_size         = key_size;
+	tmp->key_copy         = key_copy;
+	tmp->key_free         = key_free;
+	tmp->on_evict         = on_evict;
+	tmp->evict_data       = evict_data;
+	*dst                  = MOVE_PZ(tmp);
+	return 1;
+}
+
+void lru_free(lru_st **to_free)
+{
+	if (!to_free || !*to_free)
+		return;
+	while (!ll_is_empty(&(*to_free)->order)) {
+		_drop(*to_free, (_entry_t *) (*to_free)->order.next);
+	}
+	ht_free(&(*to_free)->entries);
+	free(*to_free);
+	*to_free = NULL;
+}
+
+void *lru_get(lru_st *lru, const void *key)
+{
+	_entry_t *entry = ht_get(lru->entries, key);
+	if (!entry) {
+		lru->misses++;
+		return NULL;
+	}
+	lru->hits++;
+	if (lru->flags & LRU_CLOCK)
+		entry->referenced = true;
+	else
+		_requeue(lru, entry);
+	return entry->value;
+}
+
+bool lru_has(lru_st *lru, const void *key)
+{
+	return ht_has(lru->entries, key);
+}
+
+int lru_put(lru_st *lru, void *key, void *value, size_t charge)
+{
+	_entry_t *entry = NULL;
+	ES_NEW_ASRT_NM(lru);
+	if (lru->capacity_bytes && charge > lru->capacity_bytes) {
+		lru_delete(lru, key);
+		if (lru->on_evict)
+			lru->on_evict(key, value, lru->evict_data);
+		return 0;
+	}
+	if ((entry = ht_get(lru->entries, key))) {
+		if (lru->on_evict && entry->value != value)
+			lru->on_evict(entry->key, entry->value, lru->evict_data);
+		lru->bytes -= entry->charge;
+		_requeue(lru, entry);
+	} else {
+		ES_NEW_ASRT_NM(entry = calloc(1, sizeof(*entry)));
+		if (_copy_key(lru, &entry->key, key) < 0) {
+			free(entry);
+			ES_FWD_INT_NM(-1);
+		}
+		if (ht_set(lru->entries, entry->key, entry) < 0) {
+			_free_key(lru, entry->key);
+			free(entry);
+			ES_FWD_INT_NM(-1);
+		}
+		ll_emplace_back(&lru->order, entry);
+	}
+	entry->value      = value;
+	entry->charge     = charge;
+	entry->referenced = false;
+	lru->bytes += charge;
+	_evict(lru);
+	return 1;
+}
+
+void lru_delete(lru_st *lru, const void *key)
+{
+	_entry_t *entry = ht_get(lru->entries, key);
+	if (entry)
+		_drop(lru, entry);
+}
+
+void lru_stats(lru_st *lru, lru_stats_st *dst)
+{
+	dst->hits      = lru->hits;
+	dst->misses    = lru->misses;
+	dst->evictions = lru->evictions;
+	dst->entries   = ht_size(lru->entries);
+	dst->bytes     = lru->bytes;
+}
+
+/* High bits of a mixed hash, the shard's own table indexes by the low ones */
+static inline _shard_t *_shard_of(lru_sharded_st *lru, const void *key)
+{
+	uint64_t h = lru->hash(key);
+	h ^= h >> 33;
+	h *= UINT64_C(0xff51afd7ed558ccd);
+	h ^= h >> 33;
+	return &lru->shards[(h >> 32) & lru->mask];
+}
+
+int lru_sharded_alloc(lru_sharded_st **dst,
+                      size_t n_shards,
+                      uint32_t flags,
+                      size_t capacity_entries,
+                      size_t capacity_bytes,
+                      ht_hash_func_t hash,
+                      ht_cmp_func_t cmp,
+                      size_t key_size,
+                      ht_alloc_func_t key_copy,
+                      ht_free_func_t key_free,
+                      lru_evict_func_t on_evict,
+                      void *evict_data)
+{
+	LRU_SHARDED_CLEANUP lru_sharded_st *tmp = NULL;
+	size_t count                            = 1;
+	size_t i;
+	ES_NEW_ASRT_NM(dst);
+	*dst = NULL;
+	ES_NEW_ASRT_NM(n_shards && hash);
+	while (count < n_shards) {
+		count *= 2;
+	}
+	ES_NEW_ASRT_NM(tmp = aligned_alloc(CACHE_LINE, sizeof(*tmp) + count * sizeof(_shard_t)));
+	memset(tmp, 0, sizeof(*tmp) + count * sizeof(_shard_t));
+	tmp->hash = hash;
+	tmp->mask = count - 1;
+	for (i = 0; i < count; i++) {
+		pthread_mutex_init(&tmp->shards[i].lock, NULL);
+	}
+	/* Round the shares up so a tiny capacity still leaves every shard room for an entry */
+	for (i = 0; i < count; i++) {
+		ES_FWD_INT_NM(lru_alloc(&tmp->shards[i].lru,
+		                        flags,
+		                        (capacity_entries + count - 1) / count,
+		                        (capacity_bytes + count - 1) / count,
+		                        hash,
+		                        cmp,
+		                        key_size,
+		                        key_copy,
+		                        key_free,
+		                        on_evict,
+		                        evict_data));
+	}
+	*dst = MOVE_PZ(tmp);
+	return 1;
+}
+
+void lru_sharded_free(lru_sharded_st **to_free)
+{
+	size_t i;
+	if (!to_free || !*to_free)
+		return;
+	for (i = 0; i <= (*to_free)->mask; i++) {
+		lru_free(&(*to_free)->shards[i].lru);
+		pthread_mutex_destroy(&(*to_free)->shards[i].lock);
+	}
+	free(*to_free);
+	*to_free = NULL;
+}
+
+bool lru_sharded_get(lru_sharded_st *lru, const void *key, lru_visit_func_t visit, void *data)
+{
+	_shard_t *shard = _shard_of(lru, key);
+	void *value;
+	bool hit;
+	pthread_mutex_lock(&shard->lock);
+	value = lru_get(shard->lru, key);
+	hit   = value || lru_has(shard->lru, key);
+	if (hit && visit)
+		visit(key, value, data);
+	pthread_mutex_unlock(&shard->lock);
+	return hit;
+}
+
+int lru_sharded_put(lru_sharded_st *lru, void *key, void *value, size_t charge)
+{
+	_shard_t *shard = _shard_of(lru, key);
+	int ret;
+	pthread_mutex_lock(&shard->lock);
+	ret = lru_put(shard->lru, key, value, charge);
+	pthread_mutex_unlock(&shard->lock);
+	ES_FWD_INT_NM(ret);
+	return ret;
+}
+
+void lru_sharded_delete(lru_sharded_st *lru, const void *key)
+{
+	_shard_t *shard = _shard_of(lru, key);
+	pthread_mutex_lock(&shard->lock);
+	lru_delete(shard->lru, key);
+	pthread_mutex_unlock(&shard->lock);
+}
+
+void lru_sharded_stats(lru_sharded_st *lru, lru_stats_st *dst)
+{
+	size_t i;
+	memset(dst, 0, sizeof(*dst));
+	for (i = 0; i <= lru->mask; i++) {
+		lru_stats_st shard;
+		pthread_mutex_lock(&lru->shards[i].lock);
+		lru_stats(lru->shards[i].lru, &shard);
+		pthread_mutex_unlock(&lru->shards[i].lock);
+		dst->hits += shard.hits;
+		dst->misses += shard.misses;
+		dst->evictions += shard.evictions;
+		dst->entries += shard.entries;
+		dst->bytes += shard.bytes;
+	}
+}
@@ -0,0 +1,143 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * This is an implementation for a bounded cache. Entries live in a hashtable and are threaded on
+ * an intrusive recency list, bounded by an entry count and/or a byte budget.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "../util.h"
+#include "hashtable.h"
+
+struct lru_s;
+typedef struct lru_s lru_st;
+struct lru_sharded_s;
+typedef struct lru_sharded_s lru_sharded_st;
+
+/* Called for every value the cache lets go of: evicted, replaced, deleted or freed */
+typedef void (*lru_evict_func_t)(void *key, void *value, void *data);
+/* Called with the shard locked, value must not be used after it returns */
+typedef void (*lru_visit_func_t)(const void *key, void *value, void *data);
+
+enum lru_flags_e
+{
+	LRU_DEFAULT = 0,
+	/*
+	 * Second chance instead of exact recency. A hit only sets a flag, entries are requeued when
+	 * eviction reaches them, so hits never write to the list.
+	 */
+	LRU_CLOCK = 1 << 0,
+};
+
+typedef struct lru_stats_s
+{
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	size_t entries;
+	size_t bytes;
+} lru_stats_st;
+
+/**
+ * Allocate a cache holding at most capacity_entries entries and capacity_bytes of charge (see
+ * lru_put). A capacity of 0 is unbounded, at least one of them must be set. Keys follow ht_alloc:
+ * copied with key_copy, or key_size bytes, or used as is. Values are never copied, the cache owns
+ * them from lru_put until it hands them to on_evict.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int lru_alloc(lru_st **dst,
+              uint32_t flags,
+              size_t capacity_entries,
+              size_t capacity_bytes,
+              ht_hash_func_t hash,
+              ht_cmp_func_t cmp,
+              size_t key_size,
+              ht_alloc_func_t key_copy,
+              ht_free_func_t key_free,
+              lru_evict_func_t on_evict,
+              void *evict_data);
+/**
+ * Free the cache, passing every value to on_evict.
+ */
+void lru_free(lru_st **to_free);
+
+/**
+ * Look a key up and mark it as recently used.
+ *
+ * @returns the value, NULL on a miss
+ */
+void *lru_get(lru_st *lru, const void *key);
+bool lru_has(lru_st *lru, const void *key);
+/**
+ * Insert or replace a value charged `charge` bytes against capacity_bytes, then evict least
+ * recently used entries until the cache is within its capacities. A value larger than the whole
+ * byte budget is handed straight to on_evict.
+ *
+ * @returns 1 if stored, 0 if it was too large to cache, negative on failure
+ */
+int lru_put(lru_st *lru, void *key, void *value, size_t charge);
+void lru_delete(lru_st *lru, const void *key);
+void lru_stats(lru_st *lru, lru_stats_st *dst);
+
+/**
+ * Allocate a cache split into n_shards independently locked caches (rounded up to a power of
+ * two), each with its share of the capacities. Parameters follow lru_alloc.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int lru_sharded_alloc(lru_sharded_st **dst,
+                      size_t n_shards,
+                      uint32_t flags,
+                      size_t capacity_entries,
+                      size_t capacity_bytes,
+                      ht_hash_func_t hash,
+                      ht_cmp_func_t cmp,
+                      size_t key_size,
+                      ht_alloc_func_t key_copy,
+                      ht_free_func_t key_free,
+                      lru_evict_func_t on_evict,
+                      void *evict_data);
+void lru_sharded_free(lru_sharded_st **to_free);
+/**
+ * lru_get for shared caches. Values may be evicted by other threads as soon as the shard is
+ * unlocked, so a hit is handed to visit instead of being returned.
+ *
+ * @returns true on a hit
+ */
+bool lru_sharded_get(lru_sharded_st *lru, const void *key, lru_visit_func_t visit, void *data);
+int lru_sharded_put(lru_sharded_st *lru, void *key, void *value, size_t charge);
+void lru_sharded_delete(lru_sharded_st *lru, const void *key);
+/* Sum over the shards, not an atomic snapshot */
+void lru_sharded_stats(lru_sharded_st *lru, lru_stats_st *dst);
+
+/* Allocate an int -> value cache */
+#define lru_int_alloc(dst, flags, entries, bytes, on_evict, evict_data)                            \
+	lru_alloc(                                                                                     \
+	    dst, flags, entries, bytes, ht_int_hash, ht_int_cmp, 0, NULL, NULL, on_evict, evict_data)
+#define lru_int_get(lru, key) lru_get((lru), (void *) (uint64_t) (key))
+#define lru_int_put(lru, key, value, charge)                                                       \
+	lru_put((lru), (void *) (uint64_t) (key), (void *) (value), (charge))
+/* Allocate a string -> value cache, keys are copied */
+#define lru_str_alloc(dst, flags, entries, bytes, on_evict, evict_data)                            \
+	lru_alloc(dst,                                                                                 \
+	          flags,                                                                               \
+	          entries,                                                                             \
+	          bytes,                                                                               \
+	          ht_str_hash,                                                                         \
+	          ht_str_cmp,                                                                          \
+	          0,                                                                                   \
+	          ht_str_copy,                                                                         \
+	          ht_str_free,                                                                         \
+	          on_evict,                                                                            \
+	          evict_data)
+
+#define LRU_CLEANUP         CLEANUP(lru_free)
+#define LRU_SHARDED_CLEANUP CLEANUP(lru_sharded_free)
@@ -0,0 +1,188 @@
+#include "segvec.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * This is an implementation for a segmented vector.
+ *
+ * Block k holds FIRST << k elements, so blocks 0..k hold FIRST * (2^(k+1) - 1). Shifting an index
+ * up by FIRST turns that into a power of two boundary: for j = idx + FIRST the block is
+ * log2(j) - FIRST_BITS and the offset is j less its highest bit. The block pointers fit a fixed
+ * array, one per bit of size_t.
+ *
+ * Pushes write through a cursor into the current block, so only the first push into a block looks
+ * it up. Popping resets the cursor.
+ *
+ * Popping frees a block once the vector shrinks below the block before it, so pushing and popping
+ * across a boundary doesn't allocate every time.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../errstack.h"
+
+#define FIRST_BITS (3)
+#define FIRST      ((size_t) 1 << FIRST_BITS)
+#define MAX_BLOCKS (sizeof(size_t) * 8 - FIRST_BITS)
+
+struct segvec_s
+{
+	size_t elm_size;
+	size_t size;
+	/* Blocks [0, n_blocks) are allocated */
+	size_t n_blocks;
+	/* Where the next element goes, equal when the next push has to find its block */
+	uint8_t *tail;
+	uint8_t *tail_end;
+	uint8_t *blocks[MAX_BLOCKS];
+};
+
+static inline size_t _block_of(size_t idx)
+{
+	return sizeof(size_t) * 8 - 1 - __builtin_clzl(idx + FIRST) - FIRST_BITS;
+}
+
+static inline size_t _block_len(size_t block)
+{
+	return FIRST << block;
+}
+
+/* First index stored in block */
+static inline size_t _block_start(size_t block)
+{
+	return _block_len(block) - FIRST;
+}
+
+static inline void *_elm(const segvec_st *sv, size_t idx)
+{
+	size_t block = _block_of(idx);
+	return sv->blocks[block] + (idx - _block_start(block)) * sv->elm_size;
+}
+
+int segvec_alloc(segvec_st **dst, size_t elm_size)
+{
+	segvec_st *tmp;
+	ES_NEW_ASRT_NM(dst);
+	*dst = NULL;
+	ES_NEW_ASRT(elm_size > 0, "Elements need a size");
+	ES_NEW_ASRT_NM(tmp = calloc(1, sizeof(*tmp)));
+	tmp->elm_size = elm_size;
+	*dst          = tmp;
+	return 1;
+}
+
+void segvec_free(segvec_st **to_free)
+{
+	size_t i;
+	if (!to_free || !*to_free)
+		return;
+	for (i = 0; i < (*to_free)->n_blocks; i++) {
+		free((*to_free)->blocks[i]);
+	}
+	free(*to_free);
+	*to_free = NULL;
+}
+
+/* Point the cursor at index size, allocating its block if needed */
+static int _seek_tail(segvec_st *sv)
+{
+	size_t block = _block_of(sv->size);
+	size_t len   = _block_len(block);
+	if (block == sv->n_blocks) {
+		ES_NEW_ASRT(block < MAX_BLOCKS && len <= SIZE_MAX / sv->elm_size, "Out of space");
+		ES_NEW_ASRT_NM(sv->blocks[block] = malloc(len * sv->elm_size));
+		sv->n_blocks++;
+	}
+	sv->tail     = _elm(sv, sv->size);
+	sv->tail_end = sv->blocks[block] + len * sv->elm_size;
+	return 1;
+}
+
+int segvec_emplace_back(segvec_st *sv, void **dst)
+{
+	*dst = NULL;
+	if (sv->tail == sv->tail_end)
+		ES_FWD_INT_NM(_seek_tail(sv));
+	*dst = sv->tail;
+	sv->tail += sv->elm_size;
+	sv->size++;
+	return 1;
+}
+
+int segvec_push_back(segvec_st *sv, const void *elm)
+{
+	void *dst;
+	ES_FWD_INT_NM(segvec_emplace_back(sv, &dst));
+	memcpy(dst, elm, sv->elm_size);
+	return 1;
+}
+
+bool segvec_pop_back(segvec_st *sv)
+{
+	if (!sv->size)
+		return false;
+	sv->size--;
+	sv->tail = sv->tail_end = NULL;
+	/* Keep one empty block past the last used one */
+	if (sv->n_blocks >= 2 && sv->size < _block_start(sv->n_blocks - 2)) {
+		free(sv->blocks[--sv->n_blocks]);
+		sv->blocks[sv->n_blocks] = NULL;
+	}
+	return true;
+}
+
+void *segvec_at(const segvec_st *sv, size_t idx)
+{
+	return idx < sv->size ? _elm(sv, idx) : NULL;
+}
+
+void *segvec_back(const segvec_st *sv)
+{
+	return sv->size ? _elm(sv, sv->size - 1) : NULL;
+}
+
+size_t segvec_size(const segvec_st *sv)
+{
+	return sv->size;
+}
+
+int segvec_foreach(segvec_st *sv, segvec_foreach_func_t body, void *data)
+{
+	size_t block, i = 0;
+	int ret = 1;
+	ES_NEW_ASRT_NM(sv);
+	for (block = 0; i < sv->size && ret > 0; block++) {
+		uint8_t *elm = sv->blocks[block];
+		size_t end   = MIN(_block_start(block + 1), sv->size);
+		for (; i < end && ret > 0; i++, elm += sv->elm_size) {
+			ES_NEW_INT_NM(ret = body(i, elm, data));
+		}
+	}
+	return ret;
+}
+
+void segvec_copy_out(const segvec_st *sv, void *dst)
+{
+	uint8_t *out = dst;
+	size_t block;
+	for (block = 0; _block_start(block) < sv->size; block++) {
+		size_t n = MIN(_block_len(block), sv->size - _block_start(block));
+		memcpy(out, sv->blocks[block], n * sv->elm_size);
+		out += n * sv->elm_size;
+	}
+}
+
+void *segvec_take_data(segvec_st **sv, size_t *size)
+{
+	void *data;
+	if (!(*sv)->size || !(data = malloc((*sv)->size * (*sv)->elm_size)))
+		return NULL;
+	segvec_copy_out(*sv, data);
+	if (size)
+		*size = (*sv)->size;
+	segvec_free(sv);
+	return data;
+}
@@ -0,0 +1,69 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * This is an implementation for a segmented vector: an auto-resized array stored in blocks that
+ * double in size, so elements never move. Pointers from segvec_emplace_back/segvec_at stay valid
+ * until the element is popped, and growing allocates the next block instead of copying.
+ *
+ * Random access is O(1), the block and offset of an index come from its highest set bit.
+ * segvec_take_data copies everything into one contiguous array when one is needed.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "../util.h"
+
+struct segvec_s;
+typedef struct segvec_s segvec_st;
+
+typedef int (*segvec_foreach_func_t)(size_t idx, void *elm, void *data);
+
+/**
+ * Allocate a vector of elm_size elements. No block is allocated until the first push.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int segvec_alloc(segvec_st **dst, size_t elm_size);
+void segvec_free(segvec_st **to_free);
+/**
+ * Copy elm_size bytes from elm to the end.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int segvec_push_back(segvec_st *sv, const void *elm);
+/**
+ * Append an uninitialized element and expose it through *dst. It stays put until popped.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int segvec_emplace_back(segvec_st *sv, void **dst);
+/* @returns false if the vector was empty */
+bool segvec_pop_back(segvec_st *sv);
+/* @returns NULL if idx is out of range */
+void *segvec_at(const segvec_st *sv, size_t idx);
+void *segvec_back(const segvec_st *sv);
+size_t segvec_size(const segvec_st *sv);
+/**
+ * Call body on every element in order, a block at a time. A positive return from body moves on to
+ * the next element, 0 ends the walk and a negative one fails it. body must not push or pop.
+ *
+ * @returns negative on failure, 0 if body stopped, positive otherwise
+ */
+int segvec_foreach(segvec_st *sv, segvec_foreach_func_t body, void *data);
+/* Copy every element into dst, which has room for segvec_size elements */
+void segvec_copy_out(const segvec_st *sv, void *dst);
+/**
+ * Free the vector and return its elements as one array for the caller to free(). On failure the
+ * vector is left as it was.
+ *
+ * @returns the array, NULL if it couldn't be allocated or the vector is empty
+ */
+void *segvec_take_data(segvec_st **sv, size_t *size);
+
+#define SEGVEC_CLEANUP CLEANUP(segvec_free)
@@ -0,0 +1,223 @@
+#include "slotmap.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * This is an implementation for a slot map.
+ *
+ * Handles are the slot index in the low 32 bits and the slot's generation in the high 32. A slot
+ * holds the dense index of its value while live, or the next free slot while free. Removal bumps
+ * the generation, so older handles stop matching. Values are packed at the front of `values`,
+ * `owners` maps each back to its slot so a removal can move the last value into the hole and
+ * repoint its slot.
+ *
+ * Generations start at 1, so SLOTMAP_NULL never matches. A slot whose generation would wrap is
+ * retired instead of reused.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../errstack.h"
+
+#define SLOTMAP_MIN_CAP (8)
+#define SLOTS_MAX       ((size_t) UINT32_MAX)
+#define FREE_END        UINT32_MAX
+
+typedef struct _slot_s
+{
+	/* Dense index while live, next free slot otherwise */
+	uint32_t index;
+	uint32_t generation;
+} _slot_t;
+
+struct slotmap_s
+{
+	size_t elm_size;
+	size_t size;
+	size_t capacity;
+	uint8_t *values;
+	uint32_t *owners;
+
+	_slot_t *slots;
+	size_t n_slots;
+	size_t slots_capacity;
+	uint32_t free_head;
+};
+
+static inline slotmap_handle_t _handle(uint32_t slot, uint32_t generation)
+{
+	return ((uint64_t) generation << 32) | slot;
+}
+
+static inline void *_value_at(const slotmap_st *sm, size_t idx)
+{
+	return sm->values + idx * sm->elm_size;
+}
+
+/* The slot of a live handle, NULL if it is stale or foreign. Retired slots sit at generation 0. */
+static inline _slot_t *_lookup(const slotmap_st *sm, slotmap_handle_t handle)
+{
+	uint32_t slot       = (uint32_t) handle;
+	uint32_t generation = handle >> 32;
+	if (slot >= sm->n_slots || !generation || sm->slots[slot].generation != generation)
+		return NULL;
+	return &sm->slots[slot];
+}
+
+/* Invalidate the slot's handles and put it on the free list */
+static void _release(slotmap_st *sm, uint32_t slot)
+{
+	/* A wrapped generation would match handles long gone, retire the slot instead */
+	if (++sm->slots[slot].generation == 0)
+		return;
+	sm->slots[slot].index = sm->free_head;
+	sm->free_head         = slot;
+}
+
+static int _grow_values(slotmap_st *sm, size_t capacity)
+{
+	uint8_t *values;
+	uint32_t *owners;
+	ES_NEW_ASRT(capacity <= SLOTS_MAX && capacity <= SIZE_MAX / sm->elm_size,
+	            "Capacity %zu too large",
+	            capacity);
+	ES_NEW_ASRT_NM(values = realloc(sm->values, capacity * sm->elm_size));
+	sm->values = values;
+	ES_NEW_ASRT_NM(owners = realloc(sm->owners, capacity * sizeof(*owners)));
+	sm->owners   = owners;
+	sm->capacity = capacity;
+	return 1;
+}
+
+static int _grow_slots(slotmap_st *sm)
+{
+	size_t capacity = MAX(sm->slots_capacity * 2, (size_t) SLOTMAP_MIN_CAP);
+	_slot_t *slots;
+	capacity = MIN(capacity, SLOTS_MAX);
+	ES_NEW_ASRT(capacity > sm->slots_capacity, "Out of slots");
+	ES_NEW_ASRT_NM(slots = realloc(sm->slots, capacity * sizeof(*slots)));
+	sm->slots          = slots;
+	sm->slots_capacity = capacity;
+	return 1;
+}
+
+int slotmap_alloc(slotmap_st **dst, size_t elm_size, size_t capacity)
+{
+	SLOTMAP_CLEANUP slotmap_st *tmp = NULL;
+	ES_NEW_ASRT_NM(dst);
+	*dst = NULL;
+	ES_NEW_ASRT(elm_size > 0, "Values need a size");
+	ES_NEW_ASRT_NM(tmp = calloc(1, sizeof(*tmp)));
+	tmp->elm_size  = elm_size;
+	tmp->free_head = FREE_END;
+	ES_FWD_INT_NM(_grow_values(tmp, MAX(capacity, (size_t) SLOTMAP_MIN_CAP)));
+	*dst = MOVE_PZ(tmp);
+	return 1;
+}
+
+void slotmap_free(slotmap_st **to_free)
+{
+	if (!to_free || !*to_free)
+		return;
+	free((*to_free)->values);
+	free((*to_free)->owners);
+	free((*to_free)->slots);
+	free(*to_free);
+	*to_free = NULL;
+}
+
+int slotmap_emplace(slotmap_st *sm, void **dst, slotmap_handle_t *handle)
+{
+	uint32_t slot;
+	ES_NEW_ASRT_NM(sm && dst && handle);
+	if (sm->size == sm->capacity)
+		ES_FWD_INT_NM(_grow_values(sm, sm->capacity * 2));
+	if (sm->free_head != FREE_END) {
+		slot          = sm->free_head;
+		sm->free_head = sm->slots[slot].index;
+	} else {
+		if (sm->n_slots == sm->slots_capacity)
+			ES_FWD_INT_NM(_grow_slots(sm));
+		slot                       = sm->n_slots++;
+		sm->slots[slot].generation = 1;
+	}
+	sm->slots[slot].index = sm->size;
+	sm->owners[sm->size]  = slot;
+	*dst                  = _value_at(sm, sm->size++);
+	*handle               = _handle(slot, sm->slots[slot].generation);
+	return 1;
+}
+
+int slotmap_insert(slotmap_st *sm, const void *value, slotmap_handle_t *handle)
+{
+	void *dst;
+	ES_FWD_INT_NM(slotmap_emplace(sm, &dst, handle));
+	memcpy(dst, value, sm->elm_size);
+	return 1;
+}
+
+void *slotmap_get(const slotmap_st *sm, slotmap_handle_t handle)
+{
+	const _slot_t *slot = _lookup(sm, handle);
+	return slot ? _value_at(sm, slot->index) : NULL;
+}
+
+bool slotmap_has(const slotmap_st *sm, slotmap_handle_t handle)
+{
+	return _lookup(sm, handle) != NULL;
+}
+
+bool slotmap_remove(slotmap_st *sm, slotmap_handle_t handle)
+{
+	_slot_t *slot = _lookup(sm, handle);
+	size_t last;
+	if (!slot)
+		return false;
+	last = --sm->size;
+	if (slot->index != last) {
+		memcpy(_value_at(sm, slot->index), _value_at(sm, last), sm->elm_size);
+		sm->owners[slot->index]           = sm->owners[last];
+		sm->slots[sm->owners[last]].index = slot->index;
+	}
+	_release(sm, (uint32_t) handle);
+	return true;
+}
+
+void slotmap_clear(slotmap_st *sm)
+{
+	size_t i;
+	for (i = 0; i < sm->size; i++) {
+		_release(sm, sm->owners[i]);
+	}
+	sm->size = 0;
+}
+
+size_t slotmap_size(const slotmap_st *sm)
+{
+	return sm->size;
+}
+
+void *slotmap_values(slotmap_st *sm)
+{
+	return sm->values;
+}
+
+slotmap_handle_t slotmap_handle_at(const slotmap_st *sm, size_t idx)
+{
+	uint32_t slot = sm->owners[idx];
+	return _handle(slot, sm->slots[slot].generation);
+}
+
+int slotmap_foreach(slotmap_st *sm, slotmap_foreach_func_t body, void *data)
+{
+	size_t i;
+	int ret = 1;
+	ES_NEW_ASRT_NM(sm);
+	for (i = 0; i < sm->size && ret > 0; i++) {
+		ES_NEW_INT_NM(ret = body(slotmap_handle_at(sm, i), _value_at(sm, i), data));
+	}
+	return ret;
+}
@@ -0,0 +1,74 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * This is an implementation for a slot map: values of one size kept densely packed, addressed
+ * through 64-bit handles that stay valid until the value is removed. A handle carries the
+ * generation of its slot, so using it after the value was removed is detected instead of reaching
+ * whichever value took the slot over.
+ *
+ * Removal moves the last value into the hole. Pointers into the map are only valid until the next
+ * insert or remove, handles are what to keep.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "../util.h"
+
+struct slotmap_s;
+typedef struct slotmap_s slotmap_st;
+
+typedef uint64_t slotmap_handle_t;
+
+/* Never returned for a live value */
+#define SLOTMAP_NULL ((slotmap_handle_t) 0)
+
+typedef int (*slotmap_foreach_func_t)(slotmap_handle_t handle, void *value, void *data);
+
+/**
+ * Allocate a map of values elm_size bytes each, with room for capacity values.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int slotmap_alloc(slotmap_st **dst, size_t elm_size, size_t capacity);
+void slotmap_free(slotmap_st **to_free);
+/**
+ * Copy elm_size bytes from value into the map.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int slotmap_insert(slotmap_st *sm, const void *value, slotmap_handle_t *handle);
+/**
+ * Make room for a value and expose it, to be written in place through *dst.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int slotmap_emplace(slotmap_st *sm, void **dst, slotmap_handle_t *handle);
+/* @returns the value, NULL if handle was removed or never came from this map */
+void *slotmap_get(const slotmap_st *sm, slotmap_handle_t handle);
+bool slotmap_has(const slotmap_st *sm, slotmap_handle_t handle);
+/* @returns true if handle was live */
+bool slotmap_remove(slotmap_st *sm, slotmap_handle_t handle);
+void slotmap_clear(slotmap_st *sm);
+size_t slotmap_size(const slotmap_st *sm);
+
+/*
+ * The live values as one array of slotmap_size values, in no particular order. handles gives the
+ * handle of each. Both are invalidated by inserts and removals.
+ */
+void *slotmap_values(slotmap_st *sm);
+slotmap_handle_t slotmap_handle_at(const slotmap_st *sm, size_t idx);
+/**
+ * Call body on every value with its handle. body returns positive to go on, 0 to stop and
+ * negative to fail, and must not insert or remove.
+ *
+ * @returns negative on failure, 0 if body stopped, positive otherwise
+ */
+int slotmap_foreach(slotmap_st *sm, slotmap_foreach_func_t body, void *data);
+
+#define SLOTMAP_CLEANUP CLEANUP(slotmap_free)
@@ -0,0 +1,623 @@
+#include "soa.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * This is an implementation for a structure of arrays and its scan kernels.
+ *
+ * Columns are reallocated together, each to a new 64 byte aligned array, so a failed grow leaves
+ * every column as it was.
+ *
+ * Each kernel exists as a plain loop, an SSE2 version and an AVX2 version. The vector versions run
+ * the bulk of the array and finish the remainder with the plain loop. _kernels holds the set in
+ * use, chosen by a constructor from __builtin_cpu_supports. The AVX2 versions are compiled with a
+ * target attribute, so the rest of the build needs no extra flags.
+ *
+ * Filters write a row id for every element and advance the output only past matches, so there is
+ * no branch on the data. AVX2 compacts eight matches at a time through a table holding, for each
+ * 8-bit match mask, the lanes whose bits are set.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#	include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#	include <immintrin.h>
+#	define SOA_AVX2
+#endif
+
+#include "../errstack.h"
+
+#define COLUMN_ALIGN (64)
+#define SOA_MIN_CAP  (16)
+
+struct soa_s
+{
+	size_t n_cols;
+	size_t size;
+	size_t capacity;
+	size_t *widths;
+	uint8_t **cols;
+};
+
+typedef struct _kernels_s
+{
+	size_t (*filter_i32)(const int32_t *, size_t, int32_t, int32_t, uint32_t *);
+	size_t (*filter_f64)(const double *, size_t, double, double, uint32_t *);
+	int64_t (*sum_i32)(const int32_t *, size_t);
+	double (*sum_f64)(const double *, size_t);
+	void (*minmax_i32)(const int32_t *, size_t, int32_t *, int32_t *);
+	void (*minmax_f64)(const double *, size_t, double *, double *);
+	void (*gather_i32)(const int32_t *, const uint32_t *, size_t, int32_t *);
+	void (*gather_f64)(const double *, const uint32_t *, size_t, double *);
+} _kernels_t;
+
+static int _grow(soa_st *soa, size_t capacity)
+{
+	uint8_t **cols;
+	size_t i;
+	ES_NEW_ASRT(capacity <= SOA_MAX_ROWS, "Capacity %zu too large", capacity);
+	ES_NEW_ASRT_NM(cols = calloc(soa->n_cols, sizeof(*cols)));
+	for (i = 0; i < soa->n_cols; i++) {
+		size_t bytes = (capacity * soa->widths[i] + COLUMN_ALIGN - 1) / COLUMN_ALIGN * COLUMN_ALIGN;
+		if (!(cols[i] = aligned_alloc(COLUMN_ALIGN, bytes)))
+			break;
+	}
+	if (i < soa->n_cols) {
+		while (i--) {
+			free(cols[i]);
+		}
+		free(cols);
+		ES_NEW_ASRT_NM(false);
+	}
+	for (i = 0; i < soa->n_cols; i++) {
+		if (soa->size)
+			memcpy(cols[i], soa->cols[i], soa->size * soa->widths[i]);
+		free(soa->cols[i]);
+	}
+	free(soa->cols);
+	soa->cols     = cols;
+	soa->capacity = capacity;
+	return 1;
+}
+
+int soa_alloc(soa_st **dst, const size_t *col_sizes, size_t n_cols)
+{
+	SOA_CLEANUP soa_st *tmp = NULL;
+	size_t i;
+	ES_NEW_ASRT_NM(dst);
+	*dst = NULL;
+	ES_NEW_ASRT(n_cols > 0, "Need at least one column");
+	for (i = 0; i < n_cols; i++) {
+		ES_NEW_ASRT(col_sizes[i] > 0 && col_sizes[i] <= SIZE_MAX / SOA_MAX_ROWS,
+		            "Bad width %zu for column %zu",
+		            col_sizes[i],
+		            i);
+	}
+	ES_NEW_ASRT_NM(tmp = calloc(1, sizeof(*tmp)));
+	ES_NEW_ASRT_NM(tmp->widths = malloc(n_cols * sizeof(*tmp->widths)));
+	ES_NEW_ASRT_NM(tmp->cols = calloc(n_cols, sizeof(*tmp->cols)));
+	memcpy(tmp->widths, col_sizes, n_cols * sizeof(*tmp->widths));
+	tmp->n_cols = n_cols;
+	*dst        = MOVE_PZ(tmp);
+	return 1;
+}
+
+void soa_free(soa_st **to_free)
+{
+	size_t i;
+	if (!to_free || !*to_free)
+		return;
+	for (i = 0; (*to_free)->cols && i < (*to_free)->n_cols; i++) {
+		free((*to_free)->cols[i]);
+	}
+	free((*to_free)->cols);
+	free((*to_free)->widths);
+	free(*to_free);
+	*to_free = NULL;
+}
+
+int soa_reserve(soa_st *soa, size_t n)
+{
+	if (n > soa->capacity)
+		ES_FWD_INT_NM(_grow(soa, n));
+	return 1;
+}
+
+int soa_emplace_row(soa_st *soa, size_t *row)
+{
+	if (soa->size == soa->capacity)
+		ES_FWD_INT_NM(_grow(soa, MAX(soa->capacity * 2, (size_t) SOA_MIN_CAP)));
+	*row = soa->size++;
+	return 1;
+}
+
+int soa_push_row(soa_st *soa, const void *const *fields)
+{
+	size_t row, i;
+	ES_FWD_INT_NM(soa_emplace_row(soa, &row));
+	for (i = 0; i < soa->n_cols; i++) {
+		memcpy(soa->cols[i] + row * soa->widths[i], fields[i], soa->widths[i]);
+	}
+	return 1;
+}
+
+bool soa_pop_row(soa_st *soa)
+{
+	if (!soa->size)
+		return false;
+	soa->size--;
+	return true;
+}
+
+void soa_clear(soa_st *soa)
+{
+	soa->size = 0;
+}
+
+size_t soa_size(const soa_st *soa)
+{
+	return soa->size;
+}
+
+void *soa_column(soa_st *soa, size_t col)
+{
+	return col < soa->n_cols ? soa->cols[col] : NULL;
+}
+
+void *soa_at(soa_st *soa, size_t col, size_t row)
+{
+	if (col >= soa->n_cols || row >= soa->size)
+		return NULL;
+	return soa->cols[col] + row * soa->widths[col];
+}
+
+/* Plain loops, also finishing what the vector versions leave over */
+
+static size_t _filter_i32_from(
+    const int32_t *col, size_t i, size_t n, int32_t lo, int32_t hi, uint32_t *rows, size_t count)
+{
+	for (; i < n; i++) {
+		rows[count] = i;
+		count += col[i] >= lo && col[i] <= hi;
+	}
+	return count;
+}
+
+static size_t _filter_f64_from(
+    const double *col, size_t i, size_t n, double lo, double hi, uint32_t *rows, size_t count)
+{
+	for (; i < n; i++) {
+		rows[count] = i;
+		count += col[i] >= lo && col[i] <= hi;
+	}
+	return count;
+}
+
+static size_t _filter_i32_scalar(
+    const int32_t *col, size_t n, int32_t lo, int32_t hi, uint32_t *rows)
+{
+	return _filter_i32_from(col, 0, n, lo, hi, rows, 0);
+}
+
+static size_t _filter_f64_scalar(const double *col, size_t n, double lo, double hi, uint32_t *rows)
+{
+	return _filter_f64_from(col, 0, n, lo, hi, rows, 0);
+}
+
+static int64_t _sum_i32_scalar(const int32_t *col, size_t n)
+{
+	int64_t sum = 0;
+	size_t i;
+	for (i = 0; i < n; i++) {
+		sum += col[i];
+	}
+	return sum;
+}
+
+static double _sum_f64_scalar(const double *col, size_t n)
+{
+	double sum = 0;
+	size_t i;
+	for (i = 0; i < n; i++) {
+		sum += col[i];
+	}
+	return sum;
+}
+
+static void _minmax_i32_scalar(const int32_t *col, size_t n, int32_t *min, int32_t *max)
+{
+	size_t i;
+	for (i = 0; i < n; i++) {
+		*min = MIN(*min, col[i]);
+		*max = MAX(*max, col[i]);
+	}
+}
+
+static void _minmax_f64_scalar(const double *col, size_t n, double *min, double *max)
+{
+	size_t i;
+	for (i = 0; i < n; i++) {
+		*min = MIN(*min, col[i]);
+		*max = MAX(*max, col[i]);
+	}
+}
+
+static void _gather_i32_scalar(const int32_t *col, const uint32_t *rows, size_t n, int32_t *out)
+{
+	size_t i;
+	for (i = 0; i < n; i++) {
+		out[i] = col[rows[i]];
+	}
+}
+
+static void _gather_f64_scalar(const double *col, const uint32_t *rows, size_t n, double *out)
+{
+	size_t i;
+	for (i = 0; i < n; i++) {
+		out[i] = col[rows[i]];
+	}
+}
+
+static const _kernels_t _scalar = {
+    .filter_i32 = _filter_i32_scalar,
+    .filter_f64 = _filter_f64_scalar,
+    .sum_i32    = _sum_i32_scalar,
+    .sum_f64    = _sum_f64_scalar,
+    .minmax_i32 = _minmax_i32_scalar,
+    .minmax_f64 = _minmax_f64_scalar,
+    .gather_i32 = _gather_i32_scalar,
+    .gather_f64 = _gather_f64_scalar,
+};
+
+#ifdef __SSE2__
+static size_t _filter_i32_sse2(const int32_t *col, size_t n, int32_t lo, int32_t hi, uint32_t *rows)
+{
+	__m128i vlo = _mm_set1_epi32(lo), vhi = _mm_set1_epi32(hi);
+	size_t i, count = 0;
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i v   = _mm_loadu_si128((const __m128i *) (col + i));
+		__m128i out = _mm_or_si128(_mm_cmpgt_epi32(vlo, v), _mm_cmpgt_epi32(v, vhi));
+		unsigned m  = ~_mm_movemask_ps(_mm_castsi128_ps(out)) & 0xF;
+		rows[count] = i;
+		count += m & 1;
+		rows[count] = i + 1;
+		count += (m >> 1) & 1;
+		rows[count] = i + 2;
+		count += (m >> 2) & 1;
+		rows[count] = i + 3;
+		count += m >> 3;
+	}
+	return _filter_i32_from(col, i, n, lo, hi, rows, count);
+}
+
+static size_t _filter_f64_sse2(const double *col, size_t n, double lo, double hi, uint32_t *rows)
+{
+	__m128d vlo = _mm_set1_pd(lo), vhi = _mm_set1_pd(hi);
+	size_t i, count = 0;
+	for (i = 0; i + 2 <= n; i += 2) {
+		__m128d v  = _mm_loadu_pd(col + i);
+		unsigned m = _mm_movemask_pd(_mm_and_pd(_mm_cmpge_pd(v, vlo), _mm_cmple_pd(v, vhi)));
+		rows[count] = i;
+		count += m & 1;
+		rows[count] = i + 1;
+		count += m >> 1;
+	}
+	return _filter_f64_from(col, i, n, lo, hi, rows, count);
+}
+
+static int64_t _sum_i32_sse2(const int32_t *col, size_t n)
+{
+	__m128i acc = _mm_setzero_si128();
+	int64_t lanes[2];
+	size_t i;
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i v    = _mm_loadu_si128((const __m128i *) (col + i));
+		__m128i sign = _mm_cmpgt_epi32(_mm_setzero_si128(), v);
+		acc          = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, sign));
+		acc          = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, sign));
+	}
+	_mm_storeu_si128((__m128i *) lanes, acc);
+	return lanes[0] + lanes[1] + _sum_i32_scalar(col + i, n - i);
+}
+
+static double _sum_f64_sse2(const double *col, size_t n)
+{
+	__m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+	double lanes[2];
+	size_t i;
+	for (i = 0; i + 4 <= n; i += 4) {
+		acc0 = _mm_add_pd(acc0, _mm_loadu_pd(col + i));
+		acc1 = _mm_add_pd(acc1, _mm_loadu_pd(col + i + 2));
+	}
+	_mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+	return lanes[0] + lanes[1] + _sum_f64_scalar(col + i, n - i);
+}
+
+static void _minmax_i32_sse2(const int32_t *col, size_t n, int32_t *min, int32_t *max)
+{
+	__m128i vmin = _mm_set1_epi32(*min), vmax = _mm_set1_epi32(*max);
+	int32_t lanes[4];
+	size_t i, j;
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i v    = _mm_loadu_si128((const __m128i *) (col + i));
+		__m128i less = _mm_cmpgt_epi32(vmin, v);
+		__m128i more = _mm_cmpgt_epi32(v, vmax);
+		/* No pminsd/pmaxsd before SSE4.1, select through the compare masks */
+		vmin = _mm_or_si128(_mm_and_si128(less, v), _mm_andnot_si128(less, vmin));
+		vmax = _mm_or_si128(_mm_and_si128(more, v), _mm_andnot_si128(more, vmax));
+	}
+	_mm_storeu_si128((__m128i *) lanes, vmin);
+	for (j = 0; j < 4; j++) {
+		*min = MIN(*min, lanes[j]);
+	}
+	_mm_storeu_si128((__m128i *) lanes, vmax);
+	for (j = 0; j < 4; j++) {
+		*max = MAX(*max, lanes[j]);
+	}
+	_minmax_i32_scalar(col + i, n - i, min, max);
+}
+
+static void _minmax_f64_sse2(const double *col, size_t n, double *min, double *max)
+{
+	__m128d vmin = _mm_set1_pd(*min), vmax = _mm_set1_pd(*max);
+	double lanes[2];
+	size_t i;
+	for (i = 0; i + 2 <= n; i += 2) {
+		__m128d v = _mm_loadu_pd(col + i);
+		vmin      = _mm_min_pd(vmin, v);
+		vmax      = _mm_max_pd(vmax, v);
+	}
+	_mm_storeu_pd(lanes, vmin);
+	*min = MIN(lanes[0], lanes[1]);
+	_mm_storeu_pd(lanes, vmax);
+	*max = MAX(lanes[0], lanes[1]);
+	_minmax_f64_scalar(col + i, n - i, min, max);
+}
+
+/* SSE2 has no gather, the plain loops stand in */
+static const _kernels_t _sse2 = {
+    .filter_i32 = _filter_i32_sse2,
+    .filter_f64 = _filter_f64_sse2,
+    .sum_i32    = _sum_i32_sse2,
+    .sum_f64    = _sum_f64_sse2,
+    .minmax_i32 = _minmax_i32_sse2,
+    .minmax_f64 = _minmax_f64_sse2,
+    .gather_i32 = _gather_i32_scalar,
+    .gather_f64 = _gather_f64_scalar,
+};
+#endif
+
+#ifdef SOA_AVX2
+/* For each 8-bit match mask, the set lanes in order */
+static uint32_t _compact[256][8] __attribute__((aligned(32)));
+
+#	define AVX2 __attribute__((target("avx2")))
+
+AVX2 static size_t _filter_i32_avx2(
+    const int32_t *col, size_t n, int32_t lo, int32_t hi, uint32_t *rows)
+{
+	__m256i vlo = _mm256_set1_epi32(lo), vhi = _mm256_set1_epi32(hi);
+	size_t i, count = 0;
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i v   = _mm256_loadu_si256((const __m256i *) (col + i));
+		__m256i out = _mm256_or_si256(_mm256_cmpgt_epi32(vlo, v), _mm256_cmpgt_epi32(v, vhi));
+		unsigned m  = ~_mm256_movemask_ps(_mm256_castsi256_ps(out)) & 0xFF;
+		__m256i ids = _mm256_load_si256((const __m256i *) _compact[m]);
+		ids         = _mm256_add_epi32(ids, _mm256_set1_epi32(i));
+		/* count <= i, so all eight stores land below n */
+		_mm256_storeu_si256((__m256i *) (rows + count), ids);
+		count += __builtin_popcount(m);
+	}
+	return _filter_i32_from(col, i, n, lo, hi, rows, count);
+}
+
+AVX2 static size_t _filter_f64_avx2(
+    const double *col, size_t n, double lo, double hi, uint32_t *rows)
+{
+	__m256d vlo = _mm256_set1_pd(lo), vhi = _mm256_set1_pd(hi);
+	size_t i, count = 0;
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m256d v   = _mm256_loadu_pd(col + i);
+		__m256d ge  = _mm256_cmp_pd(v, vlo, _CMP_GE_OQ);
+		unsigned m  = _mm256_movemask_pd(_mm256_and_pd(ge, _mm256_cmp_pd(v, vhi, _CMP_LE_OQ)));
+		__m128i ids = _mm_load_si128((const __m128i *) _compact[m]);
+		ids         = _mm_add_epi32(ids, _mm_set1_epi32(i));
+		_mm_storeu_si128((__m128i *) (rows + count), ids);
+		count += __builtin_popcount(m);
+	}
+	return _filter_f64_from(col, i, n, lo, hi, rows, count);
+}
+
+AVX2 static int64_t _sum_i32_avx2(const int32_t *col, size_t n)
+{
+	__m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+	int64_t lanes[4];
+	size_t i;
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (col + i));
+		acc0      = _mm256_add_epi64(acc0, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+		acc1      = _mm256_add_epi64(acc1, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+	}
+	_mm256_storeu_si256((__m256i *) lanes, _mm256_add_epi64(acc0, acc1));
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + _sum_i32_scalar(col + i, n - i);
+}
+
+AVX2 static double _sum_f64_avx2(const double *col, size_t n)
+{
+	__m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+	double lanes[4];
+	size_t i;
+	for (i = 0; i + 8 <= n; i += 8) {
+		acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(col + i));
+		acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(col + i + 4));
+	}
+	_mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + _sum_f64_scalar(col + i, n - i);
+}
+
+AVX2 static void _minmax_i32_avx2(const int32_t *col, size_t n, int32_t *min, int32_t *max)
+{
+	__m256i vmin = _mm256_set1_epi32(*min), vmax = _mm256_set1_epi32(*max);
+	int32_t lanes[8];
+	size_t i, j;
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (col + i));
+		vmin      = _mm256_min_epi32(vmin, v);
+		vmax      = _mm256_max_epi32(vmax, v);
+	}
+	_mm256_storeu_si256((__m256i *) lanes, vmin);
+	for (j = 0; j < 8; j++) {
+		*min = MIN(*min, lanes[j]);
+	}
+	_mm256_storeu_si256((__m256i *) lanes, vmax);
+	for (j = 0; j < 8; j++) {
+		*max = MAX(*max, lanes[j]);
+	}
+	_minmax_i32_scalar(col + i, n - i, min, max);
+}
+
+AVX2 static void _minmax_f64_avx2(const double *col, size_t n, double *min, double *max)
+{
+	__m256d vmin = _mm256_set1_pd(*min), vmax = _mm256_set1_pd(*max);
+	double lanes[4];
+	size_t i, j;
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m256d v = _mm256_loadu_pd(col + i);
+		vmin      = _mm256_min_pd(vmin, v);
+		vmax      = _mm256_max_pd(vmax, v);
+	}
+	_mm256_storeu_pd(lanes, vmin);
+	for (j = 0; j < 4; j++) {
+		*min = MIN(*min, lanes[j]);
+	}
+	_mm256_storeu_pd(lanes, vmax);
+	for (j = 0; j < 4; j++) {
+		*max = MAX(*max, lanes[j]);
+	}
+	_minmax_f64_scalar(col + i, n - i, min, max);
+}
+
+AVX2 static void _gather_i32_avx2(const int32_t *col, const uint32_t *rows, size_t n, int32_t *out)
+{
+	size_t i;
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i idx = _mm256_loadu_si256((const __m256i *) (rows + i));
+		__m256i v   = _mm256_i32gather_epi32((const int *) col, idx, 4);
+		_mm256_storeu_si256((__m256i *) (out + i), v);
+	}
+	_gather_i32_scalar(col, rows + i, n - i, out + i);
+}
+
+AVX2 static void _gather_f64_avx2(const double *col, const uint32_t *rows, size_t n, double *out)
+{
+	size_t i;
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i idx = _mm_loadu_si128((const __m128i *) (rows + i));
+		_mm256_storeu_pd(out + i, _mm256_i32gather_pd(col, idx, 8));
+	}
+	_gather_f64_scalar(col, rows + i, n - i, out + i);
+}
+
+static const _kernels_t _avx2 = {
+    .filter_i32 = _filter_i32_avx2,
+    .filter_f64 = _filter_f64_avx2,
+    .sum_i32    = _sum_i32_avx2,
+    .sum_f64    = _sum_f64_avx2,
+    .minmax_i32 = _minmax_i32_avx2,
+    .minmax_f64 = _minmax_f64_avx2,
+    .gather_i32 = _gather_i32_avx2,
+    .gather_f64 = _gather_f64_avx2,
+};
+#endif
+
+static const _kernels_t *_kernels = &_scalar;
+static soa_simd_t _level          = SOA_SIMD_SCALAR;
+
+soa_simd_t soa_simd_set(soa_simd_t level)
+{
+#ifdef SOA_AVX2
+	if (level >= SOA_SIMD_AVX2 && __builtin_cpu_supports("avx2")) {
+		_kernels = &_avx2;
+		return _level = SOA_SIMD_AVX2;
+	}
+#endif
+#ifdef __SSE2__
+	if (level >= SOA_SIMD_SSE2) {
+		_kernels = &_sse2;
+		return _level = SOA_SIMD_SSE2;
+	}
+#endif
+	_kernels = &_scalar;
+	return _level = SOA_SIMD_SCALAR;
+}
+
+soa_simd_t soa_simd_level(void)
+{
+	return _level;
+}
+
+__attribute__((constructor)) static void _soa_init(void)
+{
+#ifdef SOA_AVX2
+	unsigned m, lane;
+	for (m = 0; m < 256; m++) {
+		unsigned k = 0;
+		for (lane = 0; lane < 8; lane++) {
+			if (m & (1 << lane))
+				_compact[m][k++] = lane;
+		}
+	}
+	__builtin_cpu_init();
+#endif
+	soa_simd_set(SOA_SIMD_AVX2);
+}
+
+size_t soa_filter_i32(const int32_t *col, size_t n, int32_t lo, int32_t hi, uint32_t *rows)
+{
+	return _kernels->filter_i32(col, n, lo, hi, rows);
+}
+
+size_t soa_filter_f64(const double *col, size_t n, double lo, double hi, uint32_t *rows)
+{
+	return _kernels->filter_f64(col, n, lo, hi, rows);
+}
+
+int64_t soa_sum_i32(const int32_t *col, size_t n)
+{
+	return _kernels->sum_i32(col, n);
+}
+
+double soa_sum_f64(const double *col, size_t n)
+{
+	return _kernels->sum_f64(col, n);
+}
+
+void soa_minmax_i32(const int32_t *col, size_t n, int32_t *min, int32_t *max)
+{
+	*min = INT32_MAX;
+	*max = INT32_MIN;
+	_kernels->minmax_i32(col, n, min, max);
+}
+
+void soa_minmax_f64(const double *col, size_t n, double *min, double *max)
+{
+	*min = INFINITY;
+	*max = -INFINITY;
+	_kernels->minmax_f64(col, n, min, max);
+}
+
+void soa_gather_i32(const int32_t *col, const uint32_t *rows, size_t n, int32_t *out)
+{
+	_kernels->gather_i32(col, rows, n, out);
+}
+
+void soa_gather_f64(const double *col, const uint32_t *rows, size_t n, double *out)
+{
+	_kernels->gather_f64(col, rows, n, out);
+}
@@ -0,0 +1,95 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * This is an implementation for a structure of arrays: rows of fixed size fields stored as one
+ * contiguous, 64 byte aligned column per field, so a scan over one field reads only that field.
+ *
+ * The soa_* kernels scan int32_t and double columns, or any arrays of them, with AVX2 or SSE2 when
+ * the CPU has it and plain loops otherwise. The best supported level is picked at load time,
+ * soa_simd_set overrides it.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "../util.h"
+
+struct soa_s;
+typedef struct soa_s soa_st;
+
+/* Row ids are handed to the kernels as uint32_t and gathered with signed 32-bit offsets */
+#define SOA_MAX_ROWS ((size_t) INT32_MAX)
+
+typedef enum
+{
+	SOA_SIMD_SCALAR,
+	SOA_SIMD_SSE2,
+	SOA_SIMD_AVX2,
+} soa_simd_t;
+
+/**
+ * Allocate a container of n_cols columns, column i holding fields col_sizes[i] bytes wide.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int soa_alloc(soa_st **dst, const size_t *col_sizes, size_t n_cols);
+void soa_free(soa_st **to_free);
+/**
+ * Make room for n rows without growing again.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int soa_reserve(soa_st *soa, size_t n);
+/**
+ * Append a row, copying column i's field from fields[i].
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int soa_push_row(soa_st *soa, const void *const *fields);
+/**
+ * Append an uninitialized row and set *row to its index, fields are written through soa_at or
+ * soa_column.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int soa_emplace_row(soa_st *soa, size_t *row);
+/* @returns false if there were no rows */
+bool soa_pop_row(soa_st *soa);
+void soa_clear(soa_st *soa);
+size_t soa_size(const soa_st *soa);
+/* The column as an array of soa_size fields, valid until the next call that can grow it */
+void *soa_column(soa_st *soa, size_t col);
+/* @returns NULL if row or col is out of range */
+void *soa_at(soa_st *soa, size_t col, size_t row);
+
+/* @returns the level the kernels use */
+soa_simd_t soa_simd_level(void);
+/* Use level, or the best supported level below it. @returns the level in use. Not thread safe. */
+soa_simd_t soa_simd_set(soa_simd_t level);
+
+/*
+ * Write the index of every value in [lo, hi] to rows, in order. rows must have room for n entries,
+ * n is at most SOA_MAX_ROWS.
+ *
+ * @returns the number of rows written
+ */
+size_t soa_filter_i32(const int32_t *col, size_t n, int32_t lo, int32_t hi, uint32_t *rows);
+/* soa_filter_i32 over doubles, NaN never matches */
+size_t soa_filter_f64(const double *col, size_t n, double lo, double hi, uint32_t *rows);
+int64_t soa_sum_i32(const int32_t *col, size_t n);
+/* Summed in several lanes, so the last bits can differ from a sequential sum */
+double soa_sum_f64(const double *col, size_t n);
+/* INT32_MAX and INT32_MIN when n is 0 */
+void soa_minmax_i32(const int32_t *col, size_t n, int32_t *min, int32_t *max);
+/* Infinity and -infinity when n is 0. NaNs may or may not be ignored. */
+void soa_minmax_f64(const double *col, size_t n, double *min, double *max);
+/* out[i] = col[rows[i]] for i < n */
+void soa_gather_i32(const int32_t *col, const uint32_t *rows, size_t n, int32_t *out);
+void soa_gather_f64(const double *col, const uint32_t *rows, size_t n, double *out);
+
+#define SOA_CLEANUP CLEANUP(soa_free)
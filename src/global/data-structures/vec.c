@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "vec.h"
 /**
  * Copyright by Benjamin Joseph Correia.
@@ -6,30 +7,102 @@
  *
  * Description:
  * This is an implementation for an auto-resized array.
+ *
+ * VEC_MMAP vectors live in their own anonymous mapping. Growing remaps it with mremap, which moves
+ * page tables rather than bytes, and only when capacity outgrows the mapping. Shrinking keeps the
+ * mapping and hands the pages past the new capacity back with MADV_DONTNEED, so growing again
+ * refaults them without a syscall. With VEC_HUGEPAGE those tail releases are rounded to whole huge
+ * pages to avoid splitting them.
  */
 
+#include <stdint.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 
 #include "../errstack.h"
 
+#define HUGE_PAGE (2 * 1024 * 1024)
+
 struct vec_s
 {
 	size_t capacity;
 	size_t size;
 	size_t elm_size;
 	void *data;
+
+	int flags;
+	/* Bytes mapped for VEC_MMAP vectors, capacity never exceeds it */
+	size_t mapped;
 };
 
+static size_t _round_up(size_t n, size_t to)
+{
+	return (n + to - 1) / to * to;
+}
+
+/* Release and remap granularity */
+static size_t _granule(const vec_t *vec)
+{
+	return vec->flags & VEC_HUGEPAGE ? HUGE_PAGE : (size_t) sysconf(_SC_PAGESIZE);
+}
+
+static int _map_resize(vec_t *vec, size_t bytes)
+{
+	void *data;
+	bytes = _round_up(bytes, _granule(vec));
+	if (vec->data)
+		data = mremap(vec->data, vec->mapped, bytes, MREMAP_MAYMOVE);
+	else
+		data = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	ES_NEW_ASRT_ERRNO(data != MAP_FAILED);
+	/* Advice is per mapping, a remap may have extended or moved it */
+	if (vec->flags & VEC_HUGEPAGE)
+		madvise(data, bytes, MADV_HUGEPAGE);
+	vec->data   = data;
+	vec->mapped = bytes;
+	return 1;
+}
+
+static int _set_capacity(vec_t *vec, size_t new_cap)
+{
+	void *tmp;
+	ES_NEW_ASRT(new_cap <= SIZE_MAX / vec->elm_size, "Capacity %zu too large", new_cap);
+	if (!(vec->flags & VEC_MMAP)) {
+		ES_NEW_ASRT_NM(tmp = realloc(vec->data, new_cap * vec->elm_size));
+		vec->data = tmp;
+	} else if (new_cap * vec->elm_size > vec->mapped) {
+		ES_FWD_INT_NM(_map_resize(vec, new_cap * vec->elm_size));
+	} else if (new_cap < vec->capacity) {
+		size_t keep = _round_up(new_cap * vec->elm_size, _granule(vec));
+		if (keep < vec->mapped)
+			madvise((char *) vec->data + keep, vec->mapped - keep, MADV_DONTNEED);
+	}
+	vec->capacity = new_cap;
+	return 1;
+}
+
 int vec_alloc(vec_t **vec, size_t elm_size)
 {
-	vec_t *tmp;
-	*vec = NULL;
+	return vec_alloc_flags(vec, elm_size, 0);
+}
+
+int vec_alloc_flags(vec_t **vec, size_t elm_size, int flags)
+{
+	VEC_CLEANUP vec_t *tmp = NULL;
+	*vec                   = NULL;
+	ES_NEW_ASRT_NM(elm_size > 0);
+	ES_NEW_ASRT(!(flags & ~(VEC_MMAP | VEC_HUGEPAGE)), "Unknown flags %d", flags);
 	ES_NEW_ASRT_NM(tmp = calloc(1, sizeof(vec_t)));
-	ES_NEW_ASRT_NM(tmp->data = calloc(1, elm_size));
 	tmp->elm_size = elm_size;
-	tmp->capacity = 1;
-	tmp->size     = 0;
-	*vec          = tmp;
+	tmp->flags    = flags & VEC_HUGEPAGE ? flags | VEC_MMAP : flags;
+	if (tmp->flags & VEC_MMAP) {
+		ES_FWD_INT_NM(_map_resize(tmp, elm_size));
+		tmp->capacity = tmp->mapped / elm_size;
+	} else {
+		ES_NEW_ASRT_NM(tmp->data = calloc(1, elm_size));
+		tmp->capacity = 1;
+	}
+	*vec = MOVE_PZ(tmp);
 	return 1;
 }
 
@@ -37,7 +110,9 @@ void vec_cleanup(vec_t **vec)
 {
 	vec_t *tmp = *vec;
 	if (tmp) {
-		if (tmp->data)
+		if (tmp->data && tmp->flags & VEC_MMAP)
+			munmap(tmp->data, tmp->mapped);
+		else if (tmp->data)
 			free(tmp->data);
 		free(tmp);
 	}
@@ -46,13 +121,8 @@ void vec_cleanup(vec_t **vec)
 
 #define _upsize_check()                                                                            \
 	({                                                                                             \
-		if (vec->capacity == vec->size) {                                                          \
-			size_t new_cap = vec->capacity * 2;                                                    \
-			void *tmp      = realloc(vec->data, new_cap * vec->elm_size);                          \
-			ES_NEW_ASRT_NM(tmp);                                                                   \
-			vec->data     = tmp;                                                                   \
-			vec->capacity = new_cap;                                                               \
-		}                                                                                          \
+		if (vec->capacity == vec->size)                                                            \
+			ES_FWD_INT_NM(_set_capacity(vec, vec->capacity * 2));                                  \
 	})
 
 int vec_push_back(vec_t *vec, const void *data)
@@ -74,13 +144,8 @@ int vec_emplace_back(vec_t *vec, void **data)
 
 int vec_pop_back(vec_t *vec)
 {
-	if (vec->capacity / 4 > vec->size) {
-		size_t new_cap = vec->capacity / 2;
-		void *tmp      = realloc(vec->data, new_cap * vec->elm_size);
-		ES_NEW_ASRT_NM(tmp);
-		vec->data     = tmp;
-		vec->capacity = new_cap;
-	}
+	if (vec->capacity / 4 > vec->size)
+		ES_FWD_INT_NM(_set_capacity(vec, vec->capacity / 2));
 	vec->size--;
 	return 1;
 }
@@ -111,6 +176,16 @@ size_t vec_size(vec_t *vec)
 	return vec->size;
 }
 
+size_t vec_elm_size(const vec_t *vec)
+{
+	return vec->elm_size;
+}
+
+void vec_truncate(vec_t *vec, size_t size)
+{
+	vec->size = MIN(vec->size, size);
+}
+
 int vec_foreach(vec_t *vec,
                 void *arg_vp,
                 int (*each)(const vec_t *vec, size_t idx, void *data, void *arg_vp))
@@ -130,14 +205,16 @@ int vec_foreach(vec_t *vec,
 void *vec_take_data(vec_t **vec, size_t *size, size_t *capacity)
 {
 	void *data = (*vec)->data;
+	/* A mapping can't be handed to free() */
+	if ((*vec)->flags & VEC_MMAP)
+		return NULL;
 	if (size) {
 		*size = (*vec)->size;
 	}
 	if (capacity) {
 		*capacity = (*vec)->capacity;
 	}
-	free((*vec));
-	(*vec)->data = NULL;
-	*vec         = NULL;
+	free(*vec);
+	*vec = NULL;
 	return data;
 }
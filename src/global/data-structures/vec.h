@@ -17,7 +17,22 @@ typedef struct vec_s vec_t;
 
 #define VEC_CLEANUP __attribute__((cleanup(vec_cleanup)))
 
+/*
+ * Keep the data in its own anonymous mapping. Growth remaps instead of copying and shrinking
+ * releases the tail pages instead of reallocating, worthwhile for vectors of many megabytes. The
+ * smallest vector takes a whole page. vec_take_data refuses these vectors.
+ */
+#define VEC_MMAP (1 << 0)
+/* VEC_MMAP, with the mapping advised for transparent huge pages and sized in 2MB steps */
+#define VEC_HUGEPAGE (1 << 1)
+
 int vec_alloc(vec_t **vec, size_t elm_size);
+/**
+ * Allocate a vector of elm_size elements, flags is 0 or a combination of VEC_MMAP and VEC_HUGEPAGE.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int vec_alloc_flags(vec_t **vec, size_t elm_size, int flags);
 void vec_cleanup(vec_t **vec);
 int vec_push_back(vec_t *vec, const void *data);
 int vec_emplace_back(vec_t *vec, void **data);
@@ -26,7 +41,11 @@ void *vec_back(vec_t *vec);
 void *vec_front(vec_t *vec);
 void *vec_at(vec_t *vec, size_t idx);
 size_t vec_size(vec_t *vec);
+size_t vec_elm_size(const vec_t *vec);
+/* Drop the elements from size on, keeping the capacity. Does nothing if size isn't smaller. */
+void vec_truncate(vec_t *vec, size_t size);
 int vec_foreach(vec_t *vec,
                 void *arg_vp,
                 int (*each)(const vec_t *vec, size_t idx, void *data, void *arg_vp));
+/* @returns the data array for the caller to free(), NULL for VEC_MMAP vectors which are kept */
 void *vec_take_data(vec_t **vec, size_t *size, size_t *capacity);
@@ -0,0 +1,258 @@
+#include "vec_sort.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * This is an implementation for sorting and searching vectors of primitive types.
+ *
+ * Signed and floating point keys are mapped to unsigned ones with the same order (flip the sign
+ * bit, or every bit of negative doubles), sorted, and mapped back.
+ *
+ * Up to SMALL_SORT elements are sorted in blocks of 8 by a branchless 19 comparator network, then
+ * the blocks are merged. Larger inputs are LSD radix sorted a byte at a time through one scratch
+ * array. All the byte histograms come from one read of the input, and a byte that is the same in
+ * every key is skipped.
+ *
+ * lower_bound halves the range with a conditional move instead of a branch. The Eytzinger search
+ * walks k -> 2k or 2k + 1 and prefetches the line holding k's descendants a few levels down. The
+ * answer is the last node where it went left: k shifted right past its trailing ones.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../errstack.h"
+
+#define SMALL_SORT (64)
+#define RADIX      (256)
+#define SIGN_BIT   (UINT64_C(1) << 63)
+#define CACHE_LINE (64)
+
+#define _SORT_DEFINE(type)                                                                         \
+	static inline void _cswap_##type(type *a, type *b)                                             \
+	{                                                                                              \
+		type x = *a, y = *b;                                                                       \
+		*a     = x < y ? x : y;                                                                    \
+		*b     = x < y ? y : x;                                                                    \
+	}                                                                                              \
+                                                                                                   \
+	static void _network8_##type(type *v)                                                          \
+	{                                                                                              \
+		static const uint8_t pairs[19][2] = {                                                      \
+		    {0, 2}, {1, 3}, {4, 6}, {5, 7}, {0, 4}, {1, 5}, {2, 6}, {3, 7}, {0, 1}, {2, 3},        \
+		    {4, 5}, {6, 7}, {2, 4}, {3, 5}, {1, 4}, {3, 6}, {1, 2}, {3, 4}, {5, 6},                \
+		};                                                                                         \
+		size_t i;                                                                                  \
+		for (i = 0; i < 19; i++) {                                                                 \
+			_cswap_##type(&v[pairs[i][0]], &v[pairs[i][1]]);                                       \
+		}                                                                                          \
+	}                                                                                              \
+                                                                                                   \
+	static void _small_sort_##type(type *v, size_t n)                                              \
+	{                                                                                              \
+		type left[SMALL_SORT];                                                                     \
+		size_t i, j, width;                                                                        \
+		for (i = 0; i + 8 <= n; i += 8) {                                                          \
+			_network8_##type(v + i);                                                               \
+		}                                                                                          \
+		/* The last partial block by insertion */                                                  \
+		for (j = i + 1; j < n; j++) {                                                              \
+			type x   = v[j];                                                                       \
+			size_t k = j;                                                                          \
+			for (; k > i && v[k - 1] > x; k--) {                                                   \
+				v[k] = v[k - 1];                                                                   \
+			}                                                                                      \
+			v[k] = x;                                                                              \
+		}                                                                                          \
+		for (width = 8; width < n; width *= 2) {                                                   \
+			for (i = 0; i + width < n; i += 2 * width) {                                           \
+				size_t l = 0, r = i + width, out = i, end = MIN(i + 2 * width, n);                 \
+				memcpy(left, v + i, width * sizeof(type));                                         \
+				while (l < width && r < end) {                                                     \
+					v[out++] = v[r] < left[l] ? v[r++] : left[l++];                                \
+				}                                                                                  \
+				memcpy(v + out, left + l, (width - l) * sizeof(type));                             \
+			}                                                                                      \
+		}                                                                                          \
+	}                                                                                              \
+                                                                                                   \
+	static int _radix_sort_##type(type *v, size_t n)                                               \
+	{                                                                                              \
+		size_t counts[sizeof(type)][RADIX] = {};                                                   \
+		type *buf, *src = v, *dst;                                                                 \
+		size_t i, b;                                                                               \
+		ES_NEW_ASRT_NM(dst = buf = malloc(n * sizeof(type)));                                      \
+		for (i = 0; i < n; i++) {                                                                  \
+			for (b = 0; b < sizeof(type); b++) {                                                   \
+				counts[b][(v[i] >> (b * 8)) & 0xFF]++;                                             \
+			}                                                                                      \
+		}                                                                                          \
+		for (b = 0; b < sizeof(type); b++) {                                                       \
+			size_t offset = 0, d;                                                                  \
+			type *tmp;                                                                             \
+			if (counts[b][(v[0] >> (b * 8)) & 0xFF] == n)                                          \
+				continue;                                                                          \
+			for (d = 0; d < RADIX; d++) {                                                          \
+				size_t c     = counts[b][d];                                                       \
+				counts[b][d] = offset;                                                             \
+				offset += c;                                                                       \
+			}                                                                                      \
+			for (i = 0; i < n; i++) {                                                              \
+				dst[counts[b][(src[i] >> (b * 8)) & 0xFF]++] = src[i];                             \
+			}                                                                                      \
+			tmp = src;                                                                             \
+			src = dst;                                                                             \
+			dst = tmp;                                                                             \
+		}                                                                                          \
+		if (src != v)                                                                              \
+			memcpy(v, src, n * sizeof(type));                                                      \
+		free(buf);                                                                                 \
+		return 1;                                                                                  \
+	}                                                                                              \
+                                                                                                   \
+	static int _sort_##type(type *v, size_t n)                                                     \
+	{                                                                                              \
+		if (n <= SMALL_SORT) {                                                                     \
+			_small_sort_##type(v, n);                                                              \
+			return 1;                                                                              \
+		}                                                                                          \
+		ES_FWD_INT_NM(_radix_sort_##type(v, n));                                                   \
+		return 1;                                                                                  \
+	}
+
+_SORT_DEFINE(uint32_t)
+_SORT_DEFINE(uint64_t)
+
+int vec_sort_u32(vec_t *vec)
+{
+	ES_NEW_ASRT(vec_elm_size(vec) == sizeof(uint32_t), "Not a vector of uint32_t");
+	ES_FWD_INT_NM(_sort_uint32_t(vec_front(vec), vec_size(vec)));
+	return 1;
+}
+
+int vec_sort_u64(vec_t *vec)
+{
+	ES_NEW_ASRT(vec_elm_size(vec) == sizeof(uint64_t), "Not a vector of uint64_t");
+	ES_FWD_INT_NM(_sort_uint64_t(vec_front(vec), vec_size(vec)));
+	return 1;
+}
+
+int vec_sort_i64(vec_t *vec)
+{
+	uint64_t *keys = vec_front(vec);
+	size_t i, n = vec_size(vec);
+	int ret;
+	ES_NEW_ASRT(vec_elm_size(vec) == sizeof(int64_t), "Not a vector of int64_t");
+	for (i = 0; i < n; i++) {
+		keys[i] ^= SIGN_BIT;
+	}
+	ret = _sort_uint64_t(keys, n);
+	/* Map back even on failure, the keys are unsorted then but intact */
+	for (i = 0; i < n; i++) {
+		keys[i] ^= SIGN_BIT;
+	}
+	ES_FWD_INT_NM(ret);
+	return 1;
+}
+
+int vec_sort_f64(vec_t *vec)
+{
+	uint64_t *keys = vec_front(vec);
+	size_t i, n = vec_size(vec);
+	int ret;
+	ES_NEW_ASRT(vec_elm_size(vec) == sizeof(double), "Not a vector of double");
+	for (i = 0; i < n; i++) {
+		keys[i] ^= (uint64_t) ((int64_t) keys[i] >> 63) | SIGN_BIT;
+	}
+	ret = _sort_uint64_t(keys, n);
+	for (i = 0; i < n; i++) {
+		keys[i] ^= ((keys[i] >> 63) - 1) | SIGN_BIT;
+	}
+	ES_FWD_INT_NM(ret);
+	return 1;
+}
+
+size_t vec_unique(vec_t *vec)
+{
+	size_t elm_size = vec_elm_size(vec), n = vec_size(vec), i, out = 1;
+	uint8_t *data   = vec_front(vec);
+	if (n < 2)
+		return n;
+	for (i = 1; i < n; i++) {
+		if (!memcmp(data + i * elm_size, data + (out - 1) * elm_size, elm_size))
+			continue;
+		if (out != i)
+			memcpy(data + out * elm_size, data + i * elm_size, elm_size);
+		out++;
+	}
+	vec_truncate(vec, out);
+	return out;
+}
+
+static size_t _eytzinger_fill(
+    const uint8_t *src, uint8_t *dst, size_t n, size_t elm, size_t i, size_t k)
+{
+	if (k > n)
+		return i;
+	i = _eytzinger_fill(src, dst, n, elm, i, 2 * k);
+	memcpy(dst + k * elm, src + i * elm, elm);
+	return _eytzinger_fill(src, dst, n, elm, i + 1, 2 * k + 1);
+}
+
+static int _eytzinger(vec_t *sorted, vec_t **dst, size_t elm_size)
+{
+	VEC_CLEANUP vec_t *tmp = NULL;
+	size_t i, n = vec_size(sorted);
+	void *slot;
+	ES_NEW_ASRT_NM(dst);
+	*dst = NULL;
+	ES_NEW_ASRT(vec_elm_size(sorted) == elm_size, "Element size mismatch");
+	ES_FWD_INT_NM(vec_alloc(&tmp, elm_size));
+	for (i = 0; i <= n; i++) {
+		ES_FWD_INT_NM(vec_emplace_back(tmp, &slot));
+	}
+	memset(vec_front(tmp), 0, elm_size);
+	if (n)
+		_eytzinger_fill(vec_front(sorted), vec_front(tmp), n, elm_size, 0, 1);
+	*dst = MOVE_PZ(tmp);
+	return 1;
+}
+
+#define _SEARCH_DEFINE(sfx, type)                                                                  \
+	size_t vec_lower_bound_##sfx(vec_t *vec, type key)                                             \
+	{                                                                                              \
+		const type *first = vec_front(vec), *base = first;                                         \
+		size_t len        = vec_size(vec);                                                         \
+		if (!len)                                                                                  \
+			return 0;                                                                              \
+		while (len > 1) {                                                                          \
+			size_t half = len / 2;                                                                 \
+			base        = base[half] < key ? base + half : base;                                   \
+			len -= half;                                                                           \
+		}                                                                                          \
+		return (base - first) + (*base < key);                                                     \
+	}                                                                                              \
+                                                                                                   \
+	int vec_eytzinger_##sfx(vec_t *sorted, vec_t **dst)                                            \
+	{                                                                                              \
+		ES_FWD_INT_NM(_eytzinger(sorted, dst, sizeof(type)));                                      \
+		return 1;                                                                                  \
+	}                                                                                              \
+                                                                                                   \
+	size_t vec_eytzinger_search_##sfx(vec_t *eyt, type key)                                        \
+	{                                                                                              \
+		const type *b = vec_front(eyt);                                                            \
+		size_t n = vec_size(eyt) ? vec_size(eyt) - 1 : 0, k = 1;                                   \
+		while (k <= n) {                                                                           \
+			__builtin_prefetch(b + k * (CACHE_LINE / sizeof(type)));                               \
+			k = 2 * k + (b[k] < key);                                                              \
+		}                                                                                          \
+		return k >> __builtin_ffsl((long) ~k);                                                     \
+	}
+
+_SEARCH_DEFINE(u32, uint32_t)
+_SEARCH_DEFINE(u64, uint64_t)
+_SEARCH_DEFINE(i64, int64_t)
+_SEARCH_DEFINE(f64, double)
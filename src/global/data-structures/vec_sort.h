@@ -0,0 +1,58 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * This is an implementation for sorting and searching vectors of primitive types without a
+ * comparator call per comparison. The vector's element size must match the type of the function.
+ *
+ * Sorts are ascending. Doubles order as -NaN < -inf < ... < -0.0 < 0.0 < ... < inf < NaN, the
+ * searches assume no NaNs.
+ *
+ * vec_eytzinger_* copies a sorted vector into breadth first (Eytzinger) order, where the first
+ * levels of every search share a few cache lines and the next levels can be prefetched. It pays
+ * off for large vectors searched many times.
+ */
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include "vec.h"
+
+/**
+ * Sort the vector in place, radix sorted unless it is small.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int vec_sort_u32(vec_t *vec);
+int vec_sort_u64(vec_t *vec);
+int vec_sort_i64(vec_t *vec);
+int vec_sort_f64(vec_t *vec);
+
+/* Drop each element bitwise equal to the one before it. @returns the new size. */
+size_t vec_unique(vec_t *vec);
+
+/* @returns the index of the first element not less than key in a sorted vector, its size if none */
+size_t vec_lower_bound_u32(vec_t *vec, uint32_t key);
+size_t vec_lower_bound_u64(vec_t *vec, uint64_t key);
+size_t vec_lower_bound_i64(vec_t *vec, int64_t key);
+size_t vec_lower_bound_f64(vec_t *vec, double key);
+
+/**
+ * Allocate *dst holding the sorted vector in Eytzinger order, at indices 1 to vec_size(sorted).
+ * Index 0 is padding.
+ *
+ * @returns negative on failure, 0 or positive on success
+ */
+int vec_eytzinger_u32(vec_t *sorted, vec_t **dst);
+int vec_eytzinger_u64(vec_t *sorted, vec_t **dst);
+int vec_eytzinger_i64(vec_t *sorted, vec_t **dst);
+int vec_eytzinger_f64(vec_t *sorted, vec_t **dst);
+
+/* @returns the index in eyt of the first element not less than key, 0 if none */
+size_t vec_eytzinger_search_u32(vec_t *eyt, uint32_t key);
+size_t vec_eytzinger_search_u64(vec_t *eyt, uint64_t key);
+size_t vec_eytzinger_search_i64(vec_t *eyt, int64_t key);
+size_t vec_eytzinger_search_f64(vec_t *eyt, double key);
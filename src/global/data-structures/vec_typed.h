@@ -0,0 +1,348 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * This is a generator for typed vectors. VEC_DEFINE(name, type) emits a vector type `name##_st`
+ * and static inline `name##_*` functions over a plain `type *data` array, so element access is an
+ * indexed load and copies are assignments of a known size.
+ *
+ * Capacity doubles when full and never shrinks on its own, name##_shrink_to_fit gives memory back.
+ * Pointers into the vector are valid until the next call that can grow it. Elements are moved with
+ * memmove, the vector never frees what they point to.
+ *
+ * VEC_SMALL_DEFINE(name, type, n_inline) emits the same kind of vector with its first n_inline
+ * elements stored in the struct, so short vectors on the stack never allocate.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../errstack.h"
+#include "../util.h"
+
+#define VEC_TYPED_MIN_CAP (8)
+
+#define VEC_TYPED_CLEANUP(name) CLEANUP(name##_free)
+
+/* Loop iter, a pointer to the element type, over every element of vec_p in order */
+#define VEC_TYPED_FOREACH(vec_p, iter)                                                             \
+	for (iter = (vec_p)->data; iter != (vec_p)->data + (vec_p)->size; iter++)
+
+/*
+ * Emit the vector `name##_st` and its functions: name##_alloc, name##_free, name##_reserve,
+ * name##_push_back, name##_emplace_back, name##_pop_back, name##_at, name##_back, name##_size,
+ * name##_append_n, name##_insert_range, name##_erase_range, name##_clear, name##_shrink_to_fit.
+ * Invoke once per translation unit at file scope. The fields are public, data[0..size) are the
+ * elements.
+ */
+#define VEC_DEFINE(name, type)                                                                     \
+	typedef struct name##_s                                                                        \
+	{                                                                                              \
+		type *data;                                                                                \
+		size_t size;                                                                               \
+		size_t capacity;                                                                           \
+	} name##_st;                                                                                   \
+                                                                                                   \
+	static inline void name##_free(name##_st **to_free)                                            \
+	{                                                                                              \
+		if (!to_free || !*to_free)                                                                 \
+			return;                                                                                \
+		free((*to_free)->data);                                                                    \
+		free(*to_free);                                                                            \
+		*to_free = NULL;                                                                           \
+	}                                                                                              \
+                                                                                                   \
+	static inline int name##_resize_(name##_st *vec, size_t capacity)                              \
+	{                                                                                              \
+		type *data;                                                                                \
+		ES_NEW_ASRT(capacity <= SIZE_MAX / sizeof(type), "Capacity %zu too large", capacity);      \
+		ES_NEW_ASRT_NM(data = realloc(vec->data, capacity * sizeof(type)));                        \
+		vec->data     = data;                                                                      \
+		vec->capacity = capacity;                                                                  \
+		return 1;                                                                                  \
+	}                                                                                              \
+                                                                                                   \
+	/* Make room for n elements without growing again */                                           \
+	static inline int name##_reserve(name##_st *vec, size_t n)                                     \
+	{                                                                                              \
+		if (n > vec->capacity)                                                                     \
+			ES_FWD_INT_NM(name##_resize_(vec, n));                                                 \
+		return 1;                                                                                  \
+	}                                                                                              \
+                                                                                                   \
+	/* Room for n more elements, doubling so repeated appends stay amortized O(1) */               \
+	static inline int name##_grow_(name##_st *vec, size_t n)                                       \
+	{                                                                                              \
+		size_t capacity = MAX(vec->capacity * 2, (size_t) VEC_TYPED_MIN_CAP);                      \
+		ES_NEW_ASRT(n <= SIZE_MAX - vec->size, "Size overflow");                                   \
+		if (vec->size + n <= vec->capacity)                                                        \
+			return 1;                                                                              \
+		ES_FWD_INT_NM(name##_resize_(vec, MAX(capacity, vec->size + n)));                          \
+		return 1;                                                                                  \
+	}                                                                                              \
+                                                                                                   \
+	/* Allocate with room for capacity elements, 0 defers the allocation to the first insert */    \
+	static inline int name##_alloc(name##_st **dst, size_t capacity)                               \
+	{                                                                                              \
+		VEC_TYPED_CLEANUP(name) name##_st *tmp = NULL;                                             \
+		ES_NEW_ASRT_NM(dst);                                                                       \
+		*dst = NULL;                                                                               \
+		ES_NEW_ASRT_NM(tmp = calloc(1, sizeof(*tmp)));                                             \
+		ES_FWD_INT_NM(name##_reserve(tmp, capacity));                                              \
+		*dst = MOVE_PZ(tmp);                                                                       \
+		return 1;                                                                                  \
+	}                                                                                              \
+                                                                                                   \
+	/* Large types copy faster written in place through name##_emplace_back */                     \
+	static inline int name##_push_back(name##_st *vec, type value)                                 \
+	{                                                                                              \
+		if (__builtin_expect(vec->size == vec->capacity, 0))                                       \
+			ES_FWD_INT_NM(name##_grow_(vec, 1));                                                   \
+		vec->data[vec->size++] = value;                                                            \
+		return 1;                                                                                  \
+	}                                                                                              \
+                                                                                                   \
+	/* Append an uninitialized element and expose it through *dst */                               \
+	static inline int name##_emplace_back(name##_st *vec, type **dst)                              \
+	{                                                                                              \
+		*dst = NULL;                                                                               \
+		if (__builtin_expect(vec->size == vec->capacity, 0))                                       \
+			ES_FWD_INT_NM(name##_grow_(vec, 1));                                                   \
+		*dst = &vec->data[vec->size++];                                                            \
+		return 1;                                                                                  \
+	}                                                                                              \
+                                                                                                   \
+	/* @returns false if the vector was empty */                                                   \
+	static inline bool name##_pop_back(name##_st *vec)                                             \
+	{                                                                                              \
+		if (!vec->size)                                                                            \
+			return false;                                                                          \
+		vec->size--;                                                                               \
+		return true;                                                                               \
+	}                                                                                              \
+                                                                                                   \
+	/* @returns NULL if idx is out of range */                                                     \
+	static inline type *name##_at(const name##_st *vec, size_t idx)                                \
+	{                                                                                              \
+		return idx < vec->size ? &vec->data[idx] : NULL;                                           \
+	}                                                                                              \
+                                                                                                   \
+	static inline type *name##_back(const name##_st *vec)                                          \
+	{                                                                                              \
+		return vec->size ? &vec->data[vec->size - 1] : NULL;                                       \
+	}                                                                                              \
+                                                                                                   \
+	static inline size_t name##_size(const name##_st *vec)                                         \
+	{                                                                                              \
+		return vec->size;                                                                          \
+	}                                                                                              \
+                                                                                                   \
+	/* Copy n elements from src to the end. src must not point into the vector. */                 \
+	static inline int name##_append_n(name##_st *vec, const type *src, size_t n)                   \
+	{                                                                                              \
+		ES_FWD_INT_NM(name##_grow_(vec, n));                                                       \
+		if (n)                                                                                     \
+			memcpy(vec->data + vec->size, src, n * sizeof(type));                                  \
+		vec->size += n;                                                                            \
+		return 1;                                                                                  \
+	}                                                                                              \
+                                                                                                   \
+	/* Copy n elements from src in front of idx. src must not point into the vector. */            \
+	static inline int name##_insert_range(name##_st *vec, size_t idx, const type *src, size_t n)   \
+	{                                                                                              \
+		ES_NEW_ASRT(idx <= vec->size, "Index %zu past size %zu", idx, vec->size);                  \
+		ES_FWD_INT_NM(name##_grow_(vec, n));                                                       \
+		if (!n)                                                                                    \
+			return 1;                                                                              \
+		memmove(vec->data + idx + n, vec->data + idx, (vec->size - idx) * sizeof(type));           \
+		memcpy(vec->data + idx, src, n * sizeof(type));                                            \
+		vec->size += n;                                                                            \
+		return 1;                                                                                  \
+	}                                                                                              \
+                                                                                                   \
+	/* Remove the n elements starting at idx. @returns false if they don't all exist. */           \
+	static inline bool name##_erase_range(name##_st *vec, size_t idx, size_t n)                    \
+	{                                                                                              \
+		if (idx > vec->size || n > vec->size - idx)                                                \
+			return false;                                                                          \
+		memmove(vec->data + idx, vec->data + idx + n, (vec->size - idx - n) * sizeof(type));       \
+		vec->size -= n;                                                                            \
+		return true;                                                                               \
+	}                                                                                              \
+                                                                                                   \
+	static inline void name##_clear(name##_st *vec)                                                \
+	{                                                                                              \
+		vec->size = 0;                                                                             \
+	}                                                                                              \
+                                                                                                   \
+	/* Drop unused capacity, an empty vector releases its array */                                 \
+	static inline int name##_shrink_to_fit(name##_st *vec)                                         \
+	{                                                                                              \
+		if (vec->size == vec->capacity)                                                            \
+			return 1;                                                                              \
+		if (!vec->size) {                                                                          \
+			free(vec->data);                                                                       \
+			vec->data     = NULL;                                                                  \
+			vec->capacity = 0;                                                                     \
+			return 1;                                                                              \
+		}                                                                                          \
+		ES_FWD_INT_NM(name##_resize_(vec, vec->size));                                             \
+		return 1;                                                                                  \
+	}
+
+#define VEC_SMALL_CLEANUP(name) CLEANUP(name##_destroy)
+
+/* VEC_TYPED_FOREACH for vectors from VEC_SMALL_DEFINE */
+#define VEC_SMALL_FOREACH(name, vec_p, iter)                                                       \
+	for (iter = name##_data(vec_p); iter != name##_data(vec_p) + (vec_p)->size; iter++)
+
+/*
+ * Emit a small vector `name##_st` holding up to n_inline elements inside the struct and spilling to
+ * the heap past that, for short lived vectors on the stack or embedded in another struct. A zeroed
+ * struct is an empty vector, name##_destroy frees the spill and leaves it empty again:
+ *
+ *     VEC_SMALL_CLEANUP(ids) ids_st ids = {};
+ *
+ * Functions: name##_init, name##_destroy, name##_reserve, name##_push_back, name##_emplace_back,
+ * name##_pop_back, name##_at, name##_back, name##_data, name##_size, name##_append_n,
+ * name##_clear. Element pointers are invalidated when the vector spills. A copy of the struct
+ * shares a spilled array with the original, only one of them may be destroyed.
+ */
+#define VEC_SMALL_DEFINE(name, type, n_inline)                                                     \
+	_Static_assert((n_inline) > 0, "Small vectors need inline capacity");                          \
+                                                                                                   \
+	typedef struct name##_s                                                                        \
+	{                                                                                              \
+		size_t size;                                                                               \
+		/* 0 while the elements are inline */                                                      \
+		size_t heap_capacity;                                                                      \
+		union                                                                                      \
+		{                                                                                          \
+			type *heap;                                                                            \
+			type inline_[n_inline];                                                                \
+		};                                                                                         \
+	} name##_st;                                                                                   \
+                                                                                                   \
+	static inline void name##_init(name##_st *vec)                                                 \
+	{                                                                                              \
+		vec->size          = 0;                                                                    \
+		vec->heap_capacity = 0;                                                                    \
+	}                                                                                              \
+                                                                                                   \
+	static inline void name##_destroy(name##_st *vec)                                              \
+	{                                                                                              \
+		if (vec->heap_capacity)                                                                    \
+			free(vec->heap);                                                                       \
+		name##_init(vec);                                                                          \
+	}                                                                                              \
+                                                                                                   \
+	static inline type *name##_data(name##_st *vec)                                                \
+	{                                                                                              \
+		return vec->heap_capacity ? vec->heap : vec->inline_;                                      \
+	}                                                                                              \
+                                                                                                   \
+	static inline size_t name##_capacity_(const name##_st *vec)                                    \
+	{                                                                                              \
+		return vec->heap_capacity ? vec->heap_capacity : (size_t) (n_inline);                      \
+	}                                                                                              \
+                                                                                                   \
+	/* Make room for n elements without growing again */                                           \
+	static inline int name##_reserve(name##_st *vec, size_t n)                                     \
+	{                                                                                              \
+		type *heap;                                                                                \
+		if (n <= name##_capacity_(vec))                                                            \
+			return 1;                                                                              \
+		ES_NEW_ASRT(n <= SIZE_MAX / sizeof(type), "Capacity %zu too large", n);                    \
+		if (vec->heap_capacity) {                                                                  \
+			ES_NEW_ASRT_NM(heap = realloc(vec->heap, n * sizeof(type)));                           \
+		} else {                                                                                   \
+			ES_NEW_ASRT_NM(heap = malloc(n * sizeof(type)));                                       \
+			memcpy(heap, vec->inline_, vec->size * sizeof(type));                                  \
+		}                                                                                          \
+		vec->heap          = heap;                                                                 \
+		vec->heap_capacity = n;                                                                    \
+		return 1;                                                                                  \
+	}                                                                                              \
+                                                                                                   \
+	static inline int name##_grow_(name##_st *vec, size_t n)                                       \
+	{                                                                                              \
+		ES_NEW_ASRT(n <= SIZE_MAX - vec->size, "Size overflow");                                   \
+		if (vec->size + n <= name##_capacity_(vec))                                                \
+			return 1;                                                                              \
+		ES_FWD_INT_NM(name##_reserve(vec, MAX(name##_capacity_(vec) * 2, vec->size + n)));         \
+		return 1;                                                                                  \
+	}                                                                                              \
+                                                                                                   \
+	static inline int name##_push_back(name##_st *vec, type value)                                 \
+	{                                                                                              \
+		if (__builtin_expect(vec->size == name##_capacity_(vec), 0))                               \
+			ES_FWD_INT_NM(name##_grow_(vec, 1));                                                   \
+		name##_data(vec)[vec->size++] = value;                                                     \
+		return 1;                                                                                  \
+	}                                                                                              \
+                                                                                                   \
+	/* Append an uninitialized element and expose it through *dst */                               \
+	static inline int name##_emplace_back(name##_st *vec, type **dst)                              \
+	{                                                                                              \
+		*dst = NULL;                                                                               \
+		if (__builtin_expect(vec->size == name##_capacity_(vec), 0))                               \
+			ES_FWD_INT_NM(name##_grow_(vec, 1));                                                   \
+		*dst = &name##_data(vec)[vec->size++];                                                     \
+		return 1;                                                                                  \
+	}                                                                                              \
+                                                                                                   \
+	/* @returns false if the vector was empty */                                                   \
+	static inline bool name##_pop_back(name##_st *vec)                                             \
+	{                                                                                              \
+		if (!vec->size)                                                                            \
+			return false;                                                                          \
+		vec->size--;                                                                               \
+		return true;                                                                               \
+	}                                                                                              \
+                                                                                                   \
+	/* Inline vectors hold at most n_inline, saying so keeps -O2 bounds warnings quiet */          \
+	static inline type *name##_slot_(name##_st *vec, size_t idx)                                   \
+	{                                                                                              \
+		if (vec->heap_capacity)                                                                    \
+			return &vec->heap[idx];                                                                \
+		if (idx >= (size_t) (n_inline))                                                            \
+			__builtin_unreachable();                                                               \
+		return &vec->inline_[idx];                                                                 \
+	}                                                                                              \
+                                                                                                   \
+	/* @returns NULL if idx is out of range */                                                     \
+	static inline type *name##_at(name##_st *vec, size_t idx)                                      \
+	{                                                                                              \
+		return idx < vec->size ? name##_slot_(vec, idx) : NULL;                                    \
+	}                                                                                              \
+                                                                                                   \
+	static inline type *name##_back(name##_st *vec)                                                \
+	{                                                                                              \
+		return vec->size ? name##_slot_(vec, vec->size - 1) : NULL;                                \
+	}                                                                                              \
+                                                                                                   \
+	static inline size_t name##_size(const name##_st *vec)                                         \
+	{                                                                                              \
+		return vec->size;                                                                          \
+	}                                                                                              \
+                                                                                                   \
+	/* Copy n elements from src to the end. src must not point into the vector. */                 \
+	static inline int name##_append_n(name##_st *vec, const type *src, size_t n)                   \
+	{                                                                                              \
+		ES_FWD_INT_NM(name##_grow_(vec, n));                                                       \
+		if (n)                                                                                     \
+			memcpy(name##_data(vec) + vec->size, src, n * sizeof(type));                           \
+		vec->size += n;                                                                            \
+		return 1;                                                                                  \
+	}                                                                                              \
+                                                                                                   \
+	/* Keeps any spilled array for reuse */                                                        \
+	static inline void name##_clear(name##_st *vec)                                                \
+	{                                                                                              \
+		vec->size = 0;                                                                             \
+	}
@@ -12,14 +12,15 @@
 #include <stdlib.h>
 #include <sys/epoll.h>
 
-#include "data-structures/hashtable.h"
+#include "data-structures/concurrent_hashtable.h"
 #include "errstack.h"
 #include "util.h"
 
 struct eh_ctx_s
 {
 	int epoll_fd;
-	ht_st *hooks;
+	/* Shared with the epoll threads, lookups must not block on registration */
+	cht_st *hooks;
 	bool threaded;
 	bool oneshot;
 };
@@ -77,7 +78,7 @@ int eh_ctx_alloc(eh_ctx_st **const dst, const bool threaded, const bool oneshot)
 	tmp->threaded = threaded;
 	tmp->oneshot  = oneshot;
 	ES_NEW_INT_NM(tmp->epoll_fd = epoll_create1(EPOLL_CLOEXEC));
-	ES_FWD_INT_NM(ht_int_alloc(&tmp->hooks, 0, NULL, NULL));
+	ES_FWD_INT_NM(cht_int_alloc(&tmp->hooks, 0, NULL, NULL));
 	*dst = MOVE_PZ(tmp);
 	return 0;
 }
@@ -155,7 +156,7 @@ int eh_ctx_reg_hook(eh_ctx_st *const ctx, eh_hook_st *const hook)
 	struct epoll_event to_add = {};
 	ES_NEW_ASRT_NM(ctx);
 	ES_NEW_ASRT_NM(hook && hook->owner == NULL);
-	ES_NEW_ASRT_NM(!ht_int_get(ctx->hooks, hook->fd));
+	ES_NEW_ASRT_NM(!cht_int_get(ctx->hooks, hook->fd));
 	hook->owner     = ctx;
 	to_add.data.ptr = hook;
 	to_add.events   = _get_epoll_flags(hook, EH_OPS_END);
@@ -166,7 +167,7 @@ int eh_ctx_reg_hook(eh_ctx_st *const ctx, eh_hook_st *const hook)
 		to_add.events |= EPOLLONESHOT;
 	}
 	ES_NEW_INT_ERRNO(epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, hook->fd, &to_add));
-	ES_NEW_INT_NM(ht_int_set(ctx->hooks, hook->fd, hook));
+	ES_FWD_INT_NM(cht_int_set(ctx->hooks, hook->fd, hook));
 	return 0;
 }
 
@@ -180,10 +181,10 @@ void eh_ctx_unreg_hook(eh_ctx_st *const ctx, eh_hook_st *const hook)
 		/*No need to handle errors, if it couldn't be deleted, it couldn't have been added*/
 		epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, hook->fd, NULL);
 	}
-	ht_int_delete(ctx->hooks, hook->fd);
+	cht_int_delete(ctx->hooks, hook->fd);
 }
 
-static int _ctx_cleanup_foreach(UNUSED const ht_st *ht,
+static int _ctx_cleanup_foreach(UNUSED const cht_st *ht,
                                 UNUSED void *key,
                                 void *value,
                                 UNUSED void *data)
@@ -202,7 +203,8 @@ void eh_ctx_cleanup(eh_ctx_st **const dst)
 		(*dst)->epoll_fd = -1;
 	}
 	if ((*dst)->hooks) {
-		ht_foreach((*dst)->hooks, _ctx_cleanup_foreach, *dst);
+		cht_foreach((*dst)->hooks, _ctx_cleanup_foreach, *dst);
+		cht_free(&(*dst)->hooks);
 	}
 	free(*dst);
 	*dst = NULL;
@@ -0,0 +1,136 @@
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "data-structures/concurrent_hashtable.h"
+#include "errstack.h"
+#include "test_utils.h"
+#include "util.h"
+
+#define N         20000
+#define N_READERS 3
+
+int test_1_basic(void)
+{
+	CHT_CLEANUP cht_st *t = NULL;
+	long i;
+	long value = 7;
+	ES_FWD_INT(cht_int_alloc(&t, 0, NULL, NULL), "Failed to alloc");
+	for (i = 0; i < N; i++) {
+		ES_NEW_ASRT_NM(cht_int_set(t, i, i) == 1);
+	}
+	ES_NEW_ASRT_NM(cht_int_set(t, 5, 55) == 0);
+	ES_NEW_ASRT(cht_size(t) == N, "Size %zu", cht_size(t));
+	for (i = 0; i < N; i++) {
+		long got = (long) cht_int_get(t, i);
+		ES_NEW_ASRT(got == (i == 5 ? 55 : i), "Bad value %ld for %ld", got, i);
+	}
+	for (i = 0; i < N; i += 2) {
+		cht_int_delete(t, i);
+	}
+	ES_NEW_ASRT_NM(cht_size(t) == N / 2);
+	ES_NEW_ASRT_NM(!cht_has(t, (void *) 0) && cht_has(t, (void *) 1));
+	cht_free(&t);
+
+	/* Owned values are replaced and deleted through the retire list */
+	ES_FWD_INT(cht_int_alloc(&t, sizeof(long), NULL, NULL), "Failed to alloc");
+	for (i = 0; i < 1000; i++) {
+		ES_FWD_INT_NM(cht_int_set(t, i, &value));
+		ES_FWD_INT_NM(cht_int_set(t, i, &i));
+	}
+	for (i = 0; i < 500; i++) {
+		cht_int_delete(t, i);
+	}
+	ES_NEW_ASRT_NM(cht_size(t) == 500 && *(long *) cht_int_get(t, 999) == 999);
+	return 1;
+}
+
+static int _count(UNUSED const cht_st *ht, UNUSED void *key, UNUSED void *value, void *data)
+{
+	(*(size_t *) data)++;
+	return 1;
+}
+
+static int _delete_all(const cht_st *ht, void *key, UNUSED void *value, UNUSED void *data)
+{
+	cht_delete((cht_st *) ht, key);
+	return 1;
+}
+
+int test_2_foreach(void)
+{
+	CHT_CLEANUP cht_st *t = NULL;
+	size_t count          = 0;
+	long i;
+	ES_FWD_INT(cht_int_alloc(&t, 0, NULL, NULL), "Failed to alloc");
+	for (i = 1; i <= N; i++) {
+		ES_FWD_INT_NM(cht_int_set(t, i, i));
+	}
+	ES_FWD_INT_NM(cht_foreach(t, _count, &count));
+	ES_NEW_ASRT(count == N, "Counted %zu", count);
+	ES_FWD_INT_NM(cht_foreach(t, _delete_all, NULL));
+	ES_NEW_ASRT_NM(cht_size(t) == 0 && !cht_has(t, (void *) 1));
+	return 1;
+}
+
+typedef struct
+{
+	cht_st *t;
+	atomic_bool done;
+	atomic_size_t errors;
+} _shared_t;
+
+/* Even keys are stable and always map to themselves, odd keys churn */
+static void *_reader(void *arg)
+{
+	_shared_t *s = arg;
+	long i       = 0;
+	while (!atomic_load(&s->done)) {
+		long key = (i % N) & ~1L;
+		if ((long) cht_int_get(s->t, key) != key + 1)
+			atomic_fetch_add(&s->errors, 1);
+		i += 7;
+	}
+	return NULL;
+}
+
+int test_3_threads(void)
+{
+	CHT_CLEANUP cht_st *t = NULL;
+	_shared_t s           = {};
+	pthread_t readers[N_READERS];
+	long i;
+	size_t j;
+	ES_FWD_INT(cht_int_alloc(&t, 0, NULL, NULL), "Failed to alloc");
+	for (i = 0; i < N; i += 2) {
+		ES_FWD_INT_NM(cht_int_set(t, i, i + 1));
+	}
+	s.t = t;
+	for (j = 0; j < N_READERS; j++) {
+		ES_NEW_ASRT_NM(!pthread_create(&readers[j], NULL, _reader, &s));
+	}
+	/* Insert and remove the odd keys, growing the table under the readers */
+	for (j = 0; j < 3; j++) {
+		for (i = 1; i < N * 4; i += 2) {
+			if (cht_int_set(t, i, i) < 0)
+				atomic_fetch_add(&s.errors, 1);
+		}
+		for (i = 1; i < N * 4; i += 2) {
+			cht_int_delete(t, i);
+		}
+	}
+	atomic_store(&s.done, true);
+	for (j = 0; j < N_READERS; j++) {
+		pthread_join(readers[j], NULL);
+	}
+	ES_NEW_ASRT(atomic_load(&s.errors) == 0, "%zu bad reads", atomic_load(&s.errors));
+	ES_NEW_ASRT(cht_size(t) == N / 2, "Size %zu", cht_size(t));
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_basic,
+    test_2_foreach,
+    test_3_threads,
+};
+
+TESTER_MAIN(tests);
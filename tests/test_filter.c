@@ -0,0 +1,107 @@
+#include <stdlib.h>
+
+#include "data-structures/filter.h"
+#include "errstack.h"
+#include "test_utils.h"
+#include "util.h"
+
+#define N 100000
+
+/* Sequential hashes, the filters must spread them on their own */
+int test_1_bloom(void)
+{
+	BLOOM_CLEANUP bloom_st *bf = NULL;
+	size_t false_positives     = 0;
+	uint64_t i;
+	ES_NEW_ASRT_NM(bloom_alloc(&bf, N, 0) < 0);
+	ES_FWD_INT_NM(bloom_alloc(&bf, N, 10));
+	ES_NEW_ASRT_NM(bloom_bytes(bf) >= N * 10 / 8 && bloom_bytes(bf) < N * 10 / 8 + 128);
+	for (i = 0; i < N; i++) {
+		bloom_add(bf, i);
+	}
+	for (i = 0; i < N; i++) {
+		ES_NEW_ASRT(bloom_may_contain(bf, i), "Lost %lu", i);
+	}
+	for (i = N; i < 11 * N; i++) {
+		false_positives += bloom_may_contain(bf, i);
+	}
+	ES_NEW_ASRT(false_positives < N * 10 * 2 / 100, "%zu false positives", false_positives);
+	bloom_clear(bf);
+	ES_NEW_ASRT_NM(!bloom_may_contain(bf, 1));
+	return 1;
+}
+
+int test_2_cuckoo(void)
+{
+	CUCKOO_CLEANUP cuckoo_st *cf = NULL;
+	size_t false_positives       = 0;
+	uint64_t i;
+	ES_FWD_INT_NM(cuckoo_alloc(&cf, N));
+	ES_NEW_ASRT_NM(cuckoo_capacity(cf) >= N && cuckoo_bytes(cf) < N * 8);
+	for (i = 0; i < N; i++) {
+		ES_NEW_ASRT(cuckoo_add(cf, i) == 1, "Full after %lu", i);
+	}
+	for (i = N; i < 11 * N; i++) {
+		false_positives += cuckoo_may_contain(cf, i);
+	}
+	ES_NEW_ASRT(false_positives < N * 10 / 1000, "%zu false positives", false_positives);
+	for (i = 0; i < N; i += 2) {
+		ES_NEW_ASRT_NM(cuckoo_remove(cf, i));
+	}
+	ES_NEW_ASRT_NM(cuckoo_size(cf) == N / 2);
+	for (i = 1; i < N; i += 2) {
+		ES_NEW_ASRT(cuckoo_may_contain(cf, i), "Lost %lu", i);
+	}
+	cuckoo_clear(cf);
+	ES_NEW_ASRT_NM(!cuckoo_size(cf) && !cuckoo_may_contain(cf, 1));
+	return 1;
+}
+
+int test_3_cuckoo_full(void)
+{
+	CUCKOO_CLEANUP cuckoo_st *cf   = NULL;
+	CUCKOO_CLEANUP cuckoo_st *tiny = NULL;
+	uint64_t added                 = 0;
+	uint64_t i, h;
+	ES_FWD_INT_NM(cuckoo_alloc(&cf, 1000));
+	while (cuckoo_add(cf, added)) {
+		added++;
+	}
+	/* Kicking gives out close to the target load, and nothing was lost on the way */
+	ES_NEW_ASRT(added >= cuckoo_capacity(cf) * 9 / 10, "Full at %lu", added);
+	ES_NEW_ASRT_NM(cuckoo_size(cf) == added && cuckoo_add(cf, added) == 0);
+	for (i = 0; i < added; i++) {
+		ES_NEW_ASRT(cuckoo_may_contain(cf, i), "Lost %lu", i);
+	}
+	/* A removal makes room for the parked fingerprint */
+	ES_NEW_ASRT_NM(cuckoo_remove(cf, 0));
+	for (i = 1; i < added; i++) {
+		ES_NEW_ASRT(cuckoo_may_contain(cf, i), "Lost %lu", i);
+	}
+
+	/*
+	 * Copies of one hash fill its two buckets, then the victim slot. In the smallest filter one
+	 * fingerprint in eight is a multiple of the bucket count, its buckets must still be distinct.
+	 */
+	ES_FWD_INT_NM(cuckoo_alloc(&tiny, 4));
+	for (h = 0; h < 64; h++) {
+		cuckoo_clear(tiny);
+		for (i = 0; cuckoo_add(tiny, h); i++) {
+			ES_NEW_ASRT_NM(i < 100);
+		}
+		ES_NEW_ASRT(i == 9, "%lu copies of %lu", i, h);
+		for (; i > 0; i--) {
+			ES_NEW_ASRT_NM(cuckoo_remove(tiny, h));
+		}
+		ES_NEW_ASRT_NM(!cuckoo_may_contain(tiny, h) && !cuckoo_remove(tiny, h));
+	}
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_bloom,
+    test_2_cuckoo,
+    test_3_cuckoo_full,
+};
+
+TESTER_MAIN(tests);
@@ -1,3 +1,7 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
 #include "data-structures/hashtable.h"
 #include "errstack.h"
 #include "test_utils.h"
@@ -52,9 +56,845 @@ int test_2_large_insert(void)
 	return 1;
 }
 
+static int _count_and_delete_odd(const ht_st *ht, void *key, UNUSED void *value, void *data)
+{
+	(*(long *) data)++;
+	if ((long) key % 2) {
+		ht_delete((ht_st *) ht, key);
+	}
+	return 1;
+}
+
+int test_3_flat(void)
+{
+	long i, counter = 0;
+	void **slot;
+	HT_CLEANUP ht_st *t;
+	HT_CLEANUP ht_st *s;
+	ES_FWD_INT(ht_alloc_flags(&t, HT_FLAT, ht_int_hash, ht_int_cmp, 0, NULL, NULL, 0, NULL, NULL),
+	           "Failed to alloc");
+
+	for (i = 0; i < N; i++) {
+		ES_FWD_INT_NM(ht_int_set(t, i, i * i));
+	}
+	ES_FWD_INT_NM(ht_int_set(t, 7, 7));
+	ES_NEW_ASRT_NM(ht_size(t) == N);
+	ES_NEW_ASRT_NM(ht_density(t) < 1.0);
+	for (i = 0; i < N; i++) {
+		ES_NEW_ASRT(ht_has(t, (void *) i), "Missing %ld", i);
+		ES_NEW_ASRT_NM((long) ht_int_get(t, i) == (i == 7 ? 7 : i * i));
+	}
+	ES_NEW_ASRT_NM(!ht_has(t, (void *) (long) N));
+
+	ES_FWD_INT_NM(ht_foreach(t, _count_and_delete_odd, &counter));
+	ES_NEW_ASRT(counter == N, "Visited %ld", counter);
+	ES_NEW_ASRT_NM(ht_size(t) == N / 2);
+	for (i = 0; i < N; i += 2) {
+		ES_NEW_ASRT_NM((long) ht_take(t, (void *) i) == i * i);
+	}
+	ES_NEW_ASRT_NM(ht_size(t) == 0);
+
+	ES_FWD_INT(ht_alloc_flags(&s,
+	                          HT_FLAT,
+	                          ht_str_hash,
+	                          ht_str_cmp,
+	                          0,
+	                          ht_str_copy,
+	                          ht_str_free,
+	                          sizeof(long),
+	                          NULL,
+	                          NULL),
+	           "Failed to alloc");
+	for (i = 0; i < 1000; i++) {
+		char key[SMALL_BUF_SZ];
+		snprintf(key, sizeof(key), "key%ld", i);
+		ES_FWD_INT_NM(ht_str_set(s, key, &i));
+	}
+	ES_NEW_ASRT_NM(*(long *) ht_str_get(s, "key999") == 999);
+	ES_NEW_ASRT_NM(!ht_str_get(s, "key1000"));
+	ES_NEW_ASRT_NM(slot = ht_emplace(s, "new"));
+	ES_NEW_ASRT_NM(*slot == NULL);
+	ES_NEW_ASRT_NM(ht_size(s) == 1001);
+	ht_purge(s);
+	ES_NEW_ASRT_NM(ht_size(s) == 0 && !ht_str_get(s, "key1"));
+	return 1;
+}
+
+static int _count(UNUSED const ht_st *ht, UNUSED void *key, UNUSED void *value, void *data)
+{
+	(*(long *) data)++;
+	return 1;
+}
+
+int test_4_incremental(void)
+{
+	long i, counter;
+	HT_CLEANUP ht_st *t;
+	ES_NEW_ASRT_NM(ht_alloc_flags(&t,
+	                              HT_INCREMENTAL | HT_FLAT,
+	                              ht_int_hash,
+	                              ht_int_cmp,
+	                              0,
+	                              NULL,
+	                              NULL,
+	                              0,
+	                              NULL,
+	                              NULL) < 0);
+	ES_FWD_INT(ht_alloc_flags(
+	               &t, HT_INCREMENTAL, ht_int_hash, ht_int_cmp, 0, NULL, NULL, 0, NULL, NULL),
+	           "Failed to alloc");
+
+	for (i = 0; i < N; i++) {
+		ES_FWD_INT_NM(ht_int_set(t, i, i + 1));
+		ES_NEW_ASRT(ht_int_get(t, i / 2) == (void *) (i / 2 + 1), "Lost %ld at %ld", i / 2, i);
+		if (i % 997 == 0) {
+			counter = 0;
+			ES_FWD_INT_NM(ht_foreach(t, _count, &counter));
+			ES_NEW_ASRT(counter == i + 1, "Visited %ld of %ld", counter, i + 1);
+		}
+	}
+	ES_NEW_ASRT_NM(ht_size(t) == N);
+	for (i = 0; i < N; i++) {
+		ES_NEW_ASRT_NM((long) ht_int_get(t, i) == i + 1);
+	}
+
+	counter = 0;
+	ES_FWD_INT_NM(ht_foreach(t, _count_and_delete_odd, &counter));
+	ES_NEW_ASRT_NM(counter == N && ht_size(t) == N / 2);
+	for (i = 0; i < N; i += 2) {
+		ht_int_delete(t, i);
+		ES_NEW_ASRT_NM(!ht_has(t, (void *) (i + 1)) && ht_has(t, (void *) (N - 2)) == (i < N - 2));
+	}
+	ES_NEW_ASRT_NM(ht_size(t) == 0);
+	return 1;
+}
+
+int test_5_pow2(void)
+{
+	long i;
+	size_t buckets;
+	HT_CLEANUP ht_st *t;
+	HT_CLEANUP ht_st *s;
+	ES_FWD_INT(ht_alloc_flags(&t,
+	                          HT_POW2 | HT_INCREMENTAL,
+	                          ht_int_hash,
+	                          ht_int_cmp,
+	                          0,
+	                          NULL,
+	                          NULL,
+	                          0,
+	                          NULL,
+	                          NULL),
+	           "Failed to alloc");
+	for (i = 0; i < N; i++) {
+		ES_FWD_INT_NM(ht_int_set(t, i << 16, i));
+	}
+	buckets = ht_buckets(t);
+	ES_NEW_ASRT(!(buckets & (buckets - 1)), "%zu buckets", buckets);
+	ES_NEW_ASRT_NM(ht_density(t) <= 2.0);
+	for (i = 0; i < N; i++) {
+		ES_NEW_ASRT_NM((long) ht_int_get(t, i << 16) == i);
+		ht_int_delete(t, i << 16);
+	}
+	ES_NEW_ASRT_NM(ht_size(t) == 0);
+
+	ES_FWD_INT(ht_alloc_flags(&s,
+	                          HT_POW2,
+	                          ht_str_hash,
+	                          ht_str_cmp,
+	                          0,
+	                          ht_str_copy,
+	                          ht_str_free,
+	                          0,
+	                          NULL,
+	                          NULL),
+	           "Failed to alloc");
+	for (i = 0; i < 1000; i++) {
+		char key[SMALL_BUF_SZ];
+		snprintf(key, sizeof(key), "%ld", i);
+		ES_FWD_INT_NM(ht_str_set(s, key, i));
+	}
+	for (i = 0; i < 1000; i++) {
+		char key[SMALL_BUF_SZ];
+		snprintf(key, sizeof(key), "%ld", i);
+		ES_NEW_ASRT_NM((long) ht_str_get(s, key) == i);
+	}
+	return 1;
+}
+
+int test_6_take_overwrite_purge(void)
+{
+	long i, value = 5;
+	HT_CLEANUP ht_st *t;
+	HT_CLEANUP ht_st *owned;
+	ES_FWD_INT(ht_int_alloc(&t, 0, NULL, NULL), "Failed to alloc");
+	for (i = 0; i < N; i++) {
+		ES_FWD_INT_NM(ht_int_set(t, i, i + 1));
+	}
+	ES_NEW_ASRT_NM(ht_int_set(t, 3, 42) == 0);
+	ES_NEW_ASRT(ht_size(t) == N, "Overwrite changed size to %zu", ht_size(t));
+	for (i = 0; i < N; i += 2) {
+		ES_NEW_ASRT_NM((long) ht_take(t, (void *) i) == i + 1);
+		ES_NEW_ASRT_NM(!ht_has(t, (void *) i));
+		ES_NEW_ASRT_NM((long) ht_int_get(t, i + 1) == (i + 1 == 3 ? 42 : i + 2));
+	}
+	ES_NEW_ASRT(ht_size(t) == N / 2, "Size %zu after take", ht_size(t));
+	ht_purge(t);
+	ES_NEW_ASRT_NM(ht_size(t) == 0 && !ht_has(t, (void *) 1));
+	for (i = 0; i < N; i++) {
+		ES_FWD_INT_NM(ht_int_set(t, i, i));
+	}
+	ES_NEW_ASRT_NM(ht_size(t) == N && (long) ht_int_get(t, N - 1) == N - 1);
+
+	ES_FWD_INT(ht_int_alloc(&owned, sizeof(long), NULL, NULL), "Failed to alloc");
+	for (i = 0; i < 1000; i++) {
+		ES_FWD_INT_NM(ht_int_set(owned, i, &value));
+		ES_FWD_INT_NM(ht_int_set(owned, i, &i));
+	}
+	ES_NEW_ASRT_NM(ht_size(owned) == 1000 && *(long *) ht_int_get(owned, 999) == 999);
+	ht_purge(owned);
+	ES_FWD_INT_NM(ht_int_set(owned, 1, &value));
+	return 1;
+}
+
+/* Batched calls must agree with the single key calls on every layout, including mid migration */
+int test_7_batched(void)
+{
+	static const uint32_t flags[] = {HT_DEFAULT, HT_FLAT, HT_INCREMENTAL, HT_POW2};
+	void *keys[300];
+	void *values[300];
+	bool found[300];
+	size_t f;
+	long i;
+	for (f = 0; f < ARRAY_SIZE(flags); f++) {
+		HT_CLEANUP ht_st *t = NULL;
+		ES_FWD_INT_NM(ht_alloc_flags(
+		    &t, flags[f], ht_int_hash, ht_int_cmp, 0, NULL, NULL, 0, NULL, NULL));
+		for (i = 0; i < 300; i++) {
+			keys[i]   = (void *) (i * 2);
+			values[i] = (void *) (i + 1);
+		}
+		ES_NEW_ASRT_NM(ht_set_many(t, keys, values, 300) == 300);
+		ES_NEW_ASRT_NM(ht_set_many(t, keys, values, 10) == 0);
+		/* Odd keys are absent */
+		for (i = 0; i < 300; i++) {
+			keys[i] = (void *) i;
+		}
+		ht_get_many(t, keys, 300, values);
+		ht_has_many(t, keys, 300, found);
+		for (i = 0; i < 300; i++) {
+			ES_NEW_ASRT(found[i] == !(i & 1) && values[i] == ht_get(t, keys[i]),
+			            "Flags %u key %ld",
+			            flags[f],
+			            i);
+		}
+		ES_NEW_ASRT_NM(ht_size(t) == 300);
+	}
+	return 1;
+}
+
+int test_8_seeded_hash(void)
+{
+	HT_CLEANUP ht_st *t    = NULL;
+	HT_CLEANUP ht_st *seen = NULL;
+	uint8_t buf[256];
+	char key[32];
+	size_t i;
+	for (i = 0; i < sizeof(buf); i++) {
+		buf[i] = i * 31;
+	}
+	/* Every length and every seed must give a distinct hash */
+	ES_FWD_INT_NM(ht_int_alloc(&seen, 0, NULL, NULL));
+	for (i = 0; i <= sizeof(buf); i++) {
+		ES_NEW_ASRT(ht_int_set(seen, ht_hash_bytes(buf, i, 1), i) == 1, "Collision at %zu", i);
+		ES_NEW_ASRT(ht_int_set(seen, ht_hash_bytes(buf, i, 2), i) == 1, "Collision at %zu", i);
+	}
+	ES_NEW_ASRT_NM(ht_str_hash("abc") == ht_str_hash("abc"));
+	ES_NEW_ASRT_NM(ht_str_hash("abc") != ht_str_hash("abd"));
+	ES_NEW_ASRT_NM(ht_str_hash_seeded("abc", 1) != ht_str_hash_seeded("abc", 2));
+
+	ES_FWD_INT_NM(ht_str_alloc(&t, 0, NULL, NULL));
+	for (i = 0; i < N; i++) {
+		snprintf(key, sizeof(key), "key-%zu", i);
+		ES_FWD_INT_NM(ht_str_set(t, key, i));
+	}
+	for (i = 0; i < N; i++) {
+		snprintf(key, sizeof(key), "key-%zu", i);
+		ES_NEW_ASRT((size_t) ht_str_get(t, key) == i, "Lost %s", key);
+	}
+	return 1;
+}
+
+int test_9_reserve_thresholds(void)
+{
+	static const uint32_t flags[] = {HT_DEFAULT, HT_FLAT, HT_INCREMENTAL, HT_POW2};
+	static void *keys[N];
+	size_t f, buckets;
+	long i;
+	for (i = 0; i < N; i++) {
+		keys[i] = (void *) i;
+	}
+	for (f = 0; f < ARRAY_SIZE(flags); f++) {
+		HT_CLEANUP ht_st *t = NULL;
+		ES_FWD_INT_NM(ht_alloc_flags(
+		    &t, flags[f], ht_int_hash, ht_int_cmp, 0, NULL, NULL, 0, NULL, NULL));
+		/* Start mid migration for HT_INCREMENTAL */
+		for (i = 0; i < 1000; i++) {
+			ES_FWD_INT_NM(ht_int_set(t, i, i));
+		}
+		ES_FWD_INT_NM(ht_reserve(t, N));
+		buckets = ht_buckets(t);
+		ES_NEW_ASRT(ht_bulk_load(t, keys, keys, N) == N - 1000, "Flags %u", flags[f]);
+		ES_NEW_ASRT(ht_buckets(t) == buckets, "Flags %u grew past its reservation", flags[f]);
+		for (i = 0; i < N; i++) {
+			ES_NEW_ASRT_NM((long) ht_int_get(t, i) == i);
+		}
+		for (i = 0; i < N; i++) {
+			ht_int_delete(t, i);
+		}
+		ES_NEW_ASRT(ht_buckets(t) == buckets, "Flags %u shrank below its reservation", flags[f]);
+	}
+	return 1;
+}
+
+int test_10_never_shrink(void)
+{
+	HT_CLEANUP ht_st *t = NULL;
+	static void *keys[N];
+	size_t buckets;
+	long i;
+	for (i = 0; i < N; i++) {
+		keys[i] = (void *) i;
+	}
+	ES_FWD_INT_NM(ht_int_alloc(&t, 0, NULL, NULL));
+	ES_NEW_ASRT_NM(ht_set_thresholds(t, 1.0, 0.5) < 0);
+	ES_FWD_INT_NM(ht_set_thresholds(t, 1.0, 0));
+	ES_NEW_ASRT_NM(ht_bulk_load(t, keys, keys, N) == N);
+	ES_NEW_ASRT(ht_density(t) < 1.0, "Density %f", ht_density(t));
+	buckets = ht_buckets(t);
+	for (i = 0; i < N; i++) {
+		ht_int_delete(t, i);
+	}
+	ES_NEW_ASRT_NM(ht_size(t) == 0 && ht_buckets(t) == buckets);
+	return 1;
+}
+
+typedef struct
+{
+	uint64_t id[2];
+} _key16_t;
+
+typedef struct
+{
+	uint64_t words[8];
+} _value64_t;
+
+static size_t _key16_hash(const void *key)
+{
+	return ht_arb_hash_util((void *) key, sizeof(_key16_t));
+}
+
+static int64_t _key16_cmp(const void *key1, const void *key2)
+{
+	return ht_arb_cmp_util((void *) key1, (void *) key2, sizeof(_key16_t));
+}
+
+int test_11_inline(void)
+{
+	static const uint32_t flags[] = {HT_INLINE, HT_INLINE | HT_INCREMENTAL | HT_POW2};
+	size_t f;
+	uint64_t i;
+	for (f = 0; f < ARRAY_SIZE(flags); f++) {
+		HT_CLEANUP ht_st *t = NULL;
+		_value64_t *taken   = NULL;
+		_value64_t v        = {};
+		_key16_t k          = {};
+		ES_FWD_INT_NM(ht_alloc_flags(&t,
+		                             flags[f],
+		                             _key16_hash,
+		                             _key16_cmp,
+		                             sizeof(_key16_t),
+		                             NULL,
+		                             NULL,
+		                             sizeof(_value64_t),
+		                             NULL,
+		                             NULL));
+		for (i = 0; i < N; i++) {
+			k.id[1]    = i;
+			v.words[7] = i;
+			ES_NEW_ASRT_NM(ht_set(t, &k, &v) == 1);
+		}
+		/* Overwrite and emplace write into the node */
+		k.id[1]    = 5;
+		v.words[7] = 50;
+		ES_NEW_ASRT_NM(ht_set(t, &k, &v) == 0);
+		k.id[1] = N;
+		((_value64_t *) *ht_emplace(t, &k))->words[7] = N;
+		for (i = 0; i <= N; i++) {
+			_value64_t *got;
+			k.id[1] = i;
+			got     = ht_get(t, &k);
+			ES_NEW_ASRT(got && got->words[7] == (i == 5 ? 50 : i), "Flags %u key %lu", flags[f], i);
+		}
+		k.id[1] = 7;
+		ES_NEW_ASRT_NM((taken = ht_take(t, &k)) && taken->words[7] == 7 && !ht_has(t, &k));
+		free(taken);
+		for (i = 0; i < N; i += 2) {
+			k.id[1] = i;
+			ht_delete(t, &k);
+		}
+		ES_NEW_ASRT_NM(ht_size(t) == N / 2);
+	}
+	return 1;
+}
+
+static int _strn_check(UNUSED const ht_st *ht, void *key, void *value, void *data)
+{
+	ht_strn_st k = ht_strn_key(key);
+	ES_NEW_ASRT(k.len == (size_t) value && strlen(k.str) == k.len, "Bad key of %zu", k.len);
+	(*(size_t *) data)++;
+	return 1;
+}
+
+int test_12_strn(void)
+{
+	HT_CLEANUP ht_st *t = NULL;
+	size_t count = 0;
+	ht_stats_st stats;
+	char buf[128];
+	size_t len;
+	/* No NUL anywhere, every key is a slice of the same buffer */
+	memset(buf, 'a', sizeof(buf));
+	ES_NEW_ASRT_NM(ht_strn_alloc(&t, HT_FLAT, 0, NULL, NULL) < 0);
+	ES_FWD_INT_NM(ht_strn_alloc(&t, HT_DEFAULT, 0, NULL, NULL));
+	/* Straddles HT_STRN_INLINE so both storage kinds are used */
+	for (len = 1; len <= 64; len++) {
+		ES_NEW_ASRT_NM(ht_strn_set(t, buf + len, len, len) == 1);
+	}
+	ES_NEW_ASRT_NM(ht_strn_set(t, buf, 23, 23) == 0 && ht_strn_set(t, buf, 24, 24) == 0);
+	for (len = 1; len <= 64; len++) {
+		ES_NEW_ASRT(ht_strn_get(t, buf, len) == (void *) len, "Missing key of %zu", len);
+	}
+	ES_NEW_ASRT_NM(!ht_strn_has(t, buf, 0) && !ht_strn_has(t, buf, 65));
+	buf[10] = 'b';
+	ES_NEW_ASRT_NM(!ht_strn_has(t, buf, 11) && !ht_strn_has(t, buf, 40));
+	buf[10] = 'a';
+	ES_FWD_INT_NM(ht_foreach(t, _strn_check, &count));
+	ES_NEW_ASRT(count == 64, "Counted %zu", count);
+	for (len = 1; len <= 64; len += 2) {
+		ht_strn_delete(t, buf, len);
+	}
+	ES_NEW_ASRT_NM(ht_size(t) == 32 && ht_strn_has(t, buf, 30) && !ht_strn_has(t, buf, 31));
+	ht_purge(t);
+	/* Many distinct keys, owned values */
+	ht_free(&t);
+	ES_FWD_INT_NM(ht_strn_alloc(&t, HT_INCREMENTAL, sizeof(size_t), NULL, NULL));
+	for (len = 0; len < N; len++) {
+		char key[32];
+		int n = snprintf(key, sizeof(key), "key-%zu%s", len, len % 3 ? "" : "-with-a-long-tail");
+		ES_NEW_ASRT_NM(ht_strn_set(t, key, n, &len) == 1);
+	}
+	for (len = 0; len < N; len++) {
+		char key[32];
+		int n = snprintf(key, sizeof(key), "key-%zu%s", len, len % 3 ? "" : "-with-a-long-tail");
+		size_t *got;
+		got = ht_strn_get(t, key, n);
+		ES_NEW_ASRT(got && *got == len, "Bad value for %s", key);
+	}
+	/* Values are only inline when asked for */
+	ES_FWD_INT_NM(ht_stats(t, &stats));
+	ES_NEW_ASRT(stats.value_bytes == N * sizeof(size_t), "%zu value bytes", stats.value_bytes);
+	ht_free(&t);
+	ES_FWD_INT_NM(ht_strn_alloc(&t, HT_INLINE, sizeof(size_t), NULL, NULL));
+	ES_NEW_ASRT_NM(ht_strn_set(t, buf, 40, &count) == 1);
+	ES_FWD_INT_NM(ht_stats(t, &stats));
+	ES_NEW_ASRT_NM(stats.value_bytes == 0 && *(size_t *) ht_strn_get(t, buf, 40) == count);
+	return 1;
+}
+
+#define SCAN_STABLE (20000)
+#define SCAN_CHURN  (2000)
+
+static int _scan_mark(UNUSED const ht_st *ht, void *key, UNUSED void *value, void *data)
+{
+	if ((size_t) key < SCAN_STABLE)
+		((uint8_t *) data)[(size_t) key]++;
+	return 1;
+}
+
+static int _scan_stop(UNUSED const ht_st *ht, UNUSED void *key, UNUSED void *value, void *data)
+{
+	(*(size_t *) data)++;
+	return 0;
+}
+
+int test_13_scan(void)
+{
+	static const uint32_t flags[] = {HT_POW2, HT_POW2 | HT_INCREMENTAL};
+	static uint8_t seen[SCAN_STABLE];
+	HT_CLEANUP ht_st *prime = NULL;
+	size_t cursor           = 0;
+	size_t f;
+	ES_FWD_INT_NM(ht_int_alloc(&prime, 0, NULL, NULL));
+	ES_NEW_ASRT_NM(ht_scan(prime, &cursor, 1, _scan_mark, seen) < 0);
+	for (f = 0; f < ARRAY_SIZE(flags); f++) {
+		HT_CLEANUP ht_st *t = NULL;
+		size_t churned      = 0;
+		size_t resizes      = 0;
+		size_t steps        = 0;
+		size_t calls        = 0;
+		size_t buckets;
+		size_t i;
+		ES_FWD_INT_NM(ht_alloc_flags(
+		    &t, flags[f], ht_int_hash, ht_int_cmp, 0, NULL, NULL, 0, NULL, NULL));
+		ES_FWD_INT_NM(ht_set_thresholds(t, 1.0, 0.45));
+		for (i = 0; i < SCAN_STABLE; i++) {
+			ES_FWD_INT_NM(ht_int_set(t, i, i));
+		}
+		memset(seen, 0, sizeof(seen));
+		buckets = ht_buckets(t);
+		cursor  = 0;
+		/* Churn keys come and go in waves between steps, growing and shrinking the table */
+		do {
+			ES_FWD_INT_NM(ht_scan(t, &cursor, 64, _scan_mark, seen));
+			for (i = 0; i < SCAN_CHURN; i++) {
+				if (steps / 25 % 2 == 0) {
+					ES_FWD_INT_NM(ht_int_set(t, SCAN_STABLE + churned, 0));
+					churned++;
+				} else if (churned) {
+					churned--;
+					ht_int_delete(t, SCAN_STABLE + churned);
+				}
+			}
+			resizes += ht_buckets(t) != buckets;
+			buckets = ht_buckets(t);
+			steps++;
+		} while (cursor);
+		ES_NEW_ASRT(resizes >= 10, "Flags %u only %zu resizes", flags[f], resizes);
+		for (i = 0; i < SCAN_STABLE; i++) {
+			ES_NEW_ASRT(seen[i], "Flags %u missed %zu in %zu steps", flags[f], i, steps);
+		}
+		/* A body returning 0 stops the step and leaves the cursor on its bucket */
+		ES_NEW_ASRT_NM(ht_scan(t, &cursor, 64, _scan_stop, &calls) == 0 && calls == 1);
+		steps = cursor;
+		ES_NEW_ASRT_NM(ht_scan(t, &cursor, 64, _scan_stop, &calls) == 0 && cursor == steps);
+	}
+	return 1;
+}
+
+/* Map a fixed key snapshot and check none of keys 0..n-1 is found */
+static int _snapshot_all_missing(const char *path, long n)
+{
+	HT_CLEANUP ht_st *mapped = NULL;
+	_key16_t k               = {};
+	long i;
+	ES_FWD_INT_NM(ht_snapshot_map(&mapped, path));
+	for (i = 0; i < n; i++) {
+		k.id[0] = i;
+		ES_NEW_ASRT(!ht_get(mapped, &k) && !ht_has(mapped, &k), "Found %ld", i);
+	}
+	return 1;
+}
+
+int test_14_snapshot(void)
+{
+	HT_CLEANUP ht_st *ints   = NULL;
+	HT_CLEANUP ht_st *strs   = NULL;
+	HT_CLEANUP ht_st *fixed  = NULL;
+	HT_CLEANUP ht_st *mapped = NULL;
+	char path[64];
+	_key16_t k = {};
+	char key[32];
+	uint8_t junk[4096];
+	off_t size;
+	long i;
+	int fd;
+	snprintf(path, sizeof(path), "/tmp/test_hashmap_%d.snap", getpid());
+	/* Pointer sized keys and values */
+	ES_FWD_INT_NM(ht_int_alloc(&ints, 0, NULL, NULL));
+	for (i = 0; i < N; i++) {
+		ES_FWD_INT_NM(ht_int_set(ints, i * 3, i));
+	}
+	ES_FWD_INT_NM(ht_snapshot_write(ints, path));
+	ES_FWD_INT_NM(ht_snapshot_map(&mapped, path));
+	ES_NEW_ASRT_NM(ht_size(mapped) == N);
+	for (i = 0; i < N * 3; i++) {
+		void *got = ht_int_get(mapped, i);
+		ES_NEW_ASRT(got == (void *) (i % 3 ? 0 : i / 3), "Bad value for %ld", i);
+		ES_NEW_ASRT_NM(ht_has(mapped, (void *) i) == !(i % 3));
+	}
+	ES_NEW_ASRT_NM(ht_int_set(mapped, 1, 1) < 0 && !ht_has(mapped, (void *) 1));
+	ht_int_delete(mapped, 3);
+	ES_NEW_ASRT_NM(ht_int_get(mapped, 3) == (void *) 1);
+	ES_NEW_ASRT_NM(ht_foreach(mapped, _count, &(size_t){0}) < 0);
+	ht_free(&mapped);
+
+	/* String slice keys with string values, across the inline/heap key boundary */
+	ES_FWD_INT_NM(ht_strn_alloc(&strs, HT_DEFAULT, 0, ht_str_copy, ht_str_free));
+	for (i = 0; i < 1000; i++) {
+		int n = snprintf(key, sizeof(key), "key-%ld%s", i, i % 2 ? "" : "-past-the-inline-size");
+		ES_FWD_INT_NM(ht_strn_set(strs, key, n, key));
+	}
+	ES_FWD_INT_NM(ht_strn_set(strs, "", 0, ""));
+	ES_FWD_INT_NM(ht_snapshot_write(strs, path));
+	ES_FWD_INT_NM(ht_snapshot_map(&mapped, path));
+	for (i = 0; i < 1000; i++) {
+		int n = snprintf(key, sizeof(key), "key-%ld%s", i, i % 2 ? "" : "-past-the-inline-size");
+		const char *got = ht_strn_get(mapped, key, n);
+		ES_NEW_ASRT(got && !strcmp(got, key), "Bad value for %s", key);
+	}
+	ES_NEW_ASRT_NM(!strcmp(ht_strn_get(mapped, "", 0), "") && !ht_strn_has(mapped, "key-1", 4));
+	ht_free(&mapped);
+
+	/* Fixed size keys and values, a NULL value stays NULL */
+	ES_FWD_INT_NM(ht_alloc(
+	    &fixed, _key16_hash, _key16_cmp, sizeof(k), NULL, NULL, sizeof(_value64_t), NULL, NULL));
+	for (i = 0; i < 1000; i++) {
+		_value64_t v = {.words = {[7] = i}};
+		k.id[0]      = i;
+		ES_FWD_INT_NM(ht_set(fixed, &k, i ? &v : NULL));
+	}
+	ES_FWD_INT_NM(ht_snapshot_write(fixed, path));
+	ES_FWD_INT_NM(ht_snapshot_map(&mapped, path));
+	for (i = 0; i < 1000; i++) {
+		_value64_t *got;
+		k.id[0] = i;
+		got     = ht_get(mapped, &k);
+		ES_NEW_ASRT(i ? got && got->words[7] == (uint64_t) i : !got && ht_has(mapped, &k),
+		            "Bad value for %ld",
+		            i);
+	}
+	ht_free(&mapped);
+
+	/* Slots follow the 64 byte header, 2048 of them for 1000 entries */
+	ES_NEW_INT_ERRNO(fd = open(path, O_RDWR));
+	ES_NEW_INT_ERRNO(size = lseek(fd, 0, SEEK_END));
+	for (i = 0; i < 2048; i++) {
+		uint64_t slot[2];
+		ES_NEW_ASRT_NM(pread(fd, slot, sizeof(slot), 64 + i * sizeof(slot)) == sizeof(slot));
+		/* Records claimed to run past the end of the file read as missing keys */
+		slot[1] = slot[1] ? (uint64_t) size - 8 : 0;
+		ES_NEW_ASRT_NM(pwrite(fd, slot, sizeof(slot), 64 + i * sizeof(slot)) == sizeof(slot));
+	}
+	ES_NEW_ASRT_NM(_snapshot_all_missing(path, 1000) > 0);
+	/* So do lookups in a file with no empty slot to end the probe */
+	memset(junk, 0xFF, sizeof(junk));
+	for (i = 0; i < 8; i++) {
+		ES_NEW_ASRT_NM(pwrite(fd, junk, sizeof(junk), 64 + i * sizeof(junk)) == sizeof(junk));
+	}
+	close(fd);
+	ES_NEW_ASRT_NM(_snapshot_all_missing(path, 1000) > 0);
+
+	/* Truncated and missing files are refused */
+	ES_NEW_ASRT_NM(truncate(path, sizeof(size_t) * 8) == 0);
+	ES_NEW_ASRT_NM(ht_snapshot_map(&mapped, path) < 0 && !mapped);
+	unlink(path);
+	ES_NEW_ASRT_NM(ht_snapshot_map(&mapped, path) < 0);
+	return 1;
+}
+
+static size_t _constant_hash(UNUSED const void *key)
+{
+	return 42;
+}
+
+static size_t _hist_sum(const ht_stats_st *stats)
+{
+	size_t sum = 0;
+	size_t i;
+	for (i = 0; i < HT_STATS_HIST; i++) {
+		sum += stats->chain_hist[i];
+	}
+	return sum;
+}
+
+int test_15_stats(void)
+{
+	HT_CLEANUP ht_st *t    = NULL;
+	HT_CLEANUP ht_st *bad  = NULL;
+	HT_CLEANUP ht_st *flat = NULL;
+	HT_CLEANUP ht_st *strs = NULL;
+	ht_stats_st stats;
+	size_t key_bytes = 0, node_bytes, buckets;
+	char key[32];
+	long i;
+	ES_FWD_INT_NM(ht_int_alloc(&t, 0, NULL, NULL));
+	for (i = 0; i < N; i++) {
+		ES_FWD_INT_NM(ht_int_set(t, i, i));
+	}
+	ht_stats_reset(t);
+	for (i = 0; i < 2 * N; i++) {
+		ht_int_get(t, i);
+	}
+	ES_FWD_INT_NM(ht_stats(t, &stats));
+	ES_NEW_ASRT_NM(_hist_sum(&stats) == ht_buckets(t) && stats.max_chain < HT_STATS_HIST);
+	ES_NEW_ASRT_NM(stats.node_bytes >= N * sizeof(void *) * 4 && stats.key_bytes == 0);
+#ifdef HT_STATS
+	ES_NEW_ASRT_NM(stats.counting && stats.hits == N && stats.misses == N);
+	ES_NEW_ASRT_NM(stats.compares >= N && stats.probes >= stats.compares && !stats.resizes);
+#else
+	ES_NEW_ASRT_NM(!stats.counting && !stats.hits && !stats.misses && !stats.resizes);
+#endif
+	/* Draining keeps the node slabs for the next entries, ht_purge releases them */
+	node_bytes = stats.node_bytes;
+	for (i = 0; i < N; i++) {
+		ht_int_delete(t, i);
+	}
+	ES_FWD_INT_NM(ht_int_set(t, 1, 1));
+	ES_FWD_INT_NM(ht_stats(t, &stats));
+	ES_NEW_ASRT(stats.node_bytes == node_bytes, "%zu node bytes", stats.node_bytes);
+	ht_purge(t);
+	ES_FWD_INT_NM(ht_stats(t, &stats));
+	ES_NEW_ASRT_NM(stats.node_bytes == 0);
+
+	/* A degenerate hash shows up as one long chain */
+	ES_FWD_INT_NM(ht_alloc(&bad, _constant_hash, ht_int_cmp, 0, NULL, NULL, 0, NULL, NULL));
+	for (i = 0; i < 1000; i++) {
+		ES_FWD_INT_NM(ht_int_set(bad, i, i));
+	}
+	ES_FWD_INT_NM(ht_stats(bad, &stats));
+	ES_NEW_ASRT(stats.max_chain == 1000, "Longest chain %zu", stats.max_chain);
+	ES_NEW_ASRT_NM(stats.chain_hist[0] == ht_buckets(bad) - 1);
+#ifdef HT_STATS
+	ES_NEW_ASRT(stats.compares >= 1000 * 999 / 2, "Only %lu compares", stats.compares);
+#endif
+
+	ES_FWD_INT_NM(ht_alloc_flags(
+	    &flat, HT_FLAT, ht_int_hash, ht_int_cmp, 0, NULL, NULL, 0, NULL, NULL));
+	for (i = 0; i < N; i++) {
+		ES_FWD_INT_NM(ht_int_set(flat, i, i));
+	}
+	ES_FWD_INT_NM(ht_stats(flat, &stats));
+	ES_NEW_ASRT_NM(_hist_sum(&stats) == N && stats.chain_hist[0] > N / 2);
+#ifdef HT_STATS
+	ES_NEW_ASRT_NM(stats.resizes > 0);
+#endif
+
+	ES_FWD_INT_NM(ht_str_alloc(&strs, 0, NULL, NULL));
+	for (i = 0; i < 1000; i++) {
+		key_bytes += snprintf(key, sizeof(key), "key-%ld", i) + 1;
+		ES_FWD_INT_NM(ht_str_set(strs, key, i));
+	}
+	ES_FWD_INT_NM(ht_stats(strs, &stats));
+	ES_NEW_ASRT(stats.key_bytes == key_bytes, "Keys %zu != %zu", stats.key_bytes, key_bytes);
+	/* A table due a resize is reported as it is, not resized by ht_stats */
+	buckets = ht_buckets(strs);
+	ES_FWD_INT_NM(ht_set_thresholds(strs, 0.2, 0.05));
+	ES_FWD_INT_NM(ht_stats(strs, &stats));
+	ES_NEW_ASRT(ht_buckets(strs) == buckets, "%zu buckets, was %zu", ht_buckets(strs), buckets);
+	ES_NEW_ASRT_NM(_hist_sum(&stats) == buckets);
+	return 1;
+}
+
+/* Every table answers the same with either filter, in every layout */
+static int _check_filtered(uint32_t flags)
+{
+	HT_CLEANUP ht_st *t = NULL;
+	void *keys[64];
+	bool found[64];
+	long i;
+	ES_FWD_INT_NM(ht_alloc_flags(&t, flags, ht_int_hash, ht_int_cmp, 0, NULL, NULL, 0, NULL, NULL));
+	for (i = 0; i < N; i++) {
+		ES_FWD_INT_NM(ht_int_set(t, i * 2, i));
+	}
+	for (i = 0; i < 2 * N; i++) {
+		ES_NEW_ASRT(ht_has(t, (void *) i) == !(i & 1), "Flags %x key %ld", flags, i);
+	}
+	for (i = 0; i < N; i += 4) {
+		ES_NEW_ASRT_NM((long) ht_take(t, (void *) (i * 2)) == i);
+		ht_delete(t, (void *) (i * 2 + 2));
+	}
+	for (i = 0; i < 64; i++) {
+		keys[i] = (void *) (i * 2);
+	}
+	ht_has_many(t, keys, 64, found);
+	for (i = 0; i < 64; i++) {
+		ES_NEW_ASRT_NM(found[i] == (i % 4 == 2 || i % 4 == 3));
+	}
+	ES_NEW_ASRT_NM(ht_size(t) == N / 2 && !ht_int_get(t, 0) && ht_int_get(t, 5) == NULL);
+	ht_purge(t);
+	ES_FWD_INT_NM(ht_int_set(t, 7, 7));
+	ES_NEW_ASRT_NM(ht_has(t, (void *) 7) && !ht_has(t, (void *) 8));
+	return 1;
+}
+
+int test_16_filter(void)
+{
+	static const uint32_t layouts[] = {
+	    HT_DEFAULT,
+	    HT_FLAT,
+	    HT_INCREMENTAL | HT_POW2,
+	    HT_INLINE,
+	};
+	HT_CLEANUP ht_st *t   = NULL;
+	HT_CLEANUP ht_st *bad = NULL;
+	ht_stats_st stats;
+	long i;
+	size_t j;
+	ES_NEW_ASRT_NM(ht_alloc_flags(&t,
+	                              HT_FILTER_BLOOM | HT_FILTER_CUCKOO,
+	                              ht_int_hash,
+	                              ht_int_cmp,
+	                              0,
+	                              NULL,
+	                              NULL,
+	                              0,
+	                              NULL,
+	                              NULL) < 0);
+	for (j = 0; j < ARRAY_SIZE(layouts); j++) {
+		ES_FWD_INT_NM(_check_filtered(layouts[j] | HT_FILTER_BLOOM));
+		ES_FWD_INT_NM(_check_filtered(layouts[j] | HT_FILTER_CUCKOO));
+	}
+
+	/* Misses stop at the filter */
+	ES_FWD_INT_NM(ht_alloc_flags(
+	    &t, HT_FILTER_CUCKOO, ht_int_hash, ht_int_cmp, 0, NULL, NULL, 0, NULL, NULL));
+	ES_FWD_INT_NM(ht_reserve(t, N));
+	for (i = 0; i < N; i++) {
+		ES_FWD_INT_NM(ht_int_set(t, i, i));
+	}
+	ht_stats_reset(t);
+	for (i = N; i < 2 * N; i++) {
+		ES_NEW_ASRT_NM(!ht_int_get(t, i));
+	}
+	ES_FWD_INT_NM(ht_stats(t, &stats));
+	ES_NEW_ASRT_NM(stats.filter_bytes >= N * 2 && stats.filter_bytes <= N * 5);
+#ifdef HT_STATS
+	ES_NEW_ASRT(stats.filtered > N * 99 / 100, "Filtered %lu", stats.filtered);
+	ES_NEW_ASRT_NM(stats.misses == N && stats.compares < N / 100);
+#endif
+
+	/* One hash for every key can't fit two cuckoo buckets, the table carries on without */
+	ES_FWD_INT_NM(ht_alloc_flags(
+	    &bad, HT_FILTER_CUCKOO, _constant_hash, ht_int_cmp, 0, NULL, NULL, 0, NULL, NULL));
+	for (i = 0; i < 100; i++) {
+		ES_FWD_INT_NM(ht_int_set(bad, i, i));
+	}
+	for (i = 0; i < 200; i++) {
+		ES_NEW_ASRT_NM(ht_has(bad, (void *) i) == (i < 100));
+	}
+	ES_FWD_INT_NM(ht_stats(bad, &stats));
+	ES_NEW_ASRT_NM(stats.filter_bytes == 0);
+	return 1;
+}
+
 static test_function tests[] = {
     test_1_basic,
     test_2_large_insert,
+    test_3_flat,
+    test_4_incremental,
+    test_5_pow2,
+    test_6_take_overwrite_purge,
+    test_7_batched,
+    test_8_seeded_hash,
+    test_9_reserve_thresholds,
+    test_10_never_shrink,
+    test_11_inline,
+    test_12_strn,
+    test_13_scan,
+    test_14_snapshot,
+    test_15_stats,
+    test_16_filter,
 };
 
 TESTER_MAIN(tests);
\ No newline at end of file
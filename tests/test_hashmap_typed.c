@@ -0,0 +1,90 @@
+#include "data-structures/hashtable_typed.h"
+#include "errstack.h"
+#include "test_utils.h"
+#include "util.h"
+
+typedef struct
+{
+	uint64_t a;
+	uint32_t b;
+	uint16_t c;
+} _value_t;
+
+HT_DEFINE(ii, uint64_t, uint64_t, ht_typed_int_hash, HT_TYPED_EQ)
+HT_DEFINE(is, uint64_t, _value_t, ht_typed_int_hash, HT_TYPED_EQ)
+
+#define N 100000
+
+int test_1_basic(void)
+{
+	HT_TYPED_CLEANUP(ii) ii_st *t = NULL;
+	uint64_t i;
+	ES_FWD_INT(ii_alloc(&t), "Failed to alloc");
+	for (i = 0; i < N; i++) {
+		ES_NEW_ASRT_NM(ii_set(t, i, i * 3) == 1);
+	}
+	ES_NEW_ASRT_NM(ii_set(t, 7, 1) == 0 && *ii_get(t, 7) == 1);
+	ES_NEW_ASRT(ii_size(t) == N, "Size %zu", ii_size(t));
+	for (i = 0; i < N; i++) {
+		ES_NEW_ASRT(i == 7 || *ii_get(t, i) == i * 3, "Bad value for %lu", i);
+	}
+	ES_NEW_ASRT_NM(!ii_get(t, N) && !ii_has(t, N) && ii_has(t, N - 1));
+	ii_purge(t);
+	ES_NEW_ASRT_NM(ii_size(t) == 0 && !ii_has(t, 1));
+	return 1;
+}
+
+/* Deletion shifts entries back, every survivor must stay reachable */
+int test_2_delete(void)
+{
+	HT_TYPED_CLEANUP(is) is_st *t = NULL;
+	uint64_t i;
+	ES_FWD_INT(is_alloc(&t), "Failed to alloc");
+	ES_FWD_INT_NM(is_reserve(t, N));
+	for (i = 0; i < N; i++) {
+		_value_t v = {.a = i, .b = i + 1, .c = i & 0xFFFF};
+		ES_FWD_INT_NM(is_set(t, i, v));
+	}
+	for (i = 0; i < N; i += 3) {
+		ES_NEW_ASRT_NM(is_delete(t, i));
+	}
+	ES_NEW_ASRT_NM(!is_delete(t, 0));
+	for (i = 0; i < N; i++) {
+		_value_t *v = is_get(t, i);
+		if (i % 3 == 0) {
+			ES_NEW_ASRT(!v, "%lu survived delete", i);
+		} else {
+			ES_NEW_ASRT(v && v->a == i && v->b == i + 1, "Lost %lu", i);
+		}
+	}
+	ES_NEW_ASRT_NM(is_size(t) == N - (N + 2) / 3);
+	return 1;
+}
+
+static int _sum(uint64_t *key, uint64_t *value, void *data)
+{
+	*(uint64_t *) data += *key + *value;
+	return 1;
+}
+
+int test_3_foreach(void)
+{
+	HT_TYPED_CLEANUP(ii) ii_st *t = NULL;
+	uint64_t sum                  = 0;
+	uint64_t i;
+	ES_FWD_INT(ii_alloc(&t), "Failed to alloc");
+	for (i = 1; i <= 1000; i++) {
+		ES_FWD_INT_NM(ii_set(t, i, i));
+	}
+	ES_FWD_INT_NM(ii_foreach(t, _sum, &sum));
+	ES_NEW_ASRT(sum == 1000 * 1001, "Sum %lu", sum);
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_basic,
+    test_2_delete,
+    test_3_foreach,
+};
+
+TESTER_MAIN(tests);
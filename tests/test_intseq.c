@@ -0,0 +1,138 @@
+#include <stdlib.h>
+
+#include "data-structures/intseq.h"
+#include "errstack.h"
+#include "test_utils.h"
+#include "util.h"
+
+/* Several blocks and a partial one */
+#define N (INTSEQ_BLOCK * 9 + 77)
+
+static uint64_t _rng = 88172645463325252ULL;
+static uint64_t _ref[N];
+static uint64_t _out[40000];
+
+static uint64_t _next(void)
+{
+	_rng ^= _rng << 13;
+	_rng ^= _rng >> 7;
+	_rng ^= _rng << 17;
+	return _rng;
+}
+
+/* Gaps of every width: runs of equal values, dense ids, sparse ids and one jump to the top */
+static uint64_t _gap(size_t i)
+{
+	switch (i / INTSEQ_BLOCK) {
+	case 0:
+		return 0;
+	case 1:
+		return 1 + (_next() & 3);
+	case 2:
+		return _next() & 0xFFFF;
+	case 3:
+		return i % INTSEQ_BLOCK == 5 ? UINT64_C(1) << 63 : _next() & 1;
+	default:
+		return _next() % 64;
+	}
+}
+
+static int _fill(intseq_st *seq)
+{
+	uint64_t value = 1000;
+	size_t i;
+	for (i = 0; i < N; i++) {
+		value += _gap(i);
+		_ref[i] = value;
+		ES_FWD_INT_NM(intseq_append(seq, value));
+	}
+	return 1;
+}
+
+int test_1_decode(void)
+{
+	INTSEQ_CLEANUP intseq_st *seq = NULL;
+	intseq_simd_t best            = intseq_simd_level(), level;
+	uint64_t value;
+	size_t i;
+	ES_FWD_INT_NM(intseq_alloc(&seq));
+	ES_NEW_ASRT_NM(intseq_blocks(seq) == 0 && !intseq_at(seq, 0, &value));
+	ES_NEW_ASRT_NM(intseq_decode_block(seq, 0, _out) == 0);
+	ES_FWD_INT_NM(_fill(seq));
+	ES_NEW_ASRT_NM(intseq_append(seq, _ref[N - 1] - 1) < 0 && intseq_size(seq) == N);
+	ES_NEW_ASRT_NM(intseq_blocks(seq) == 10 && intseq_decode_block(seq, 9, _out) == 77);
+	ES_NEW_ASRT_NM(intseq_decode_block(seq, 10, _out) == 0);
+	/* Every level the CPU has decodes the same values */
+	for (level = INTSEQ_SIMD_SCALAR; level <= best; level++) {
+		ES_NEW_ASRT_NM(intseq_simd_set(level) == level);
+		memset(_out, 0, sizeof(_out));
+		intseq_copy_out(seq, _out);
+		for (i = 0; i < N; i++) {
+			ES_NEW_ASRT(_out[i] == _ref[i], "Value %zu wrong at level %d", i, level);
+		}
+	}
+	for (i = 0; i < N; i += 31) {
+		ES_NEW_ASRT_NM(intseq_at(seq, i, &value) && value == _ref[i]);
+	}
+	ES_NEW_ASRT_NM(!intseq_at(seq, N, &value));
+	return 1;
+}
+
+int test_2_search(void)
+{
+	INTSEQ_CLEANUP intseq_st *a     = NULL;
+	INTSEQ_CLEANUP intseq_st *b     = NULL;
+	INTSEQ_CLEANUP intseq_st *both  = NULL;
+	INTSEQ_CLEANUP intseq_st *empty = NULL;
+	uint64_t value;
+	size_t i, j, k, lb, n;
+	ES_FWD_INT_NM(intseq_alloc(&a));
+	ES_FWD_INT_NM(intseq_alloc(&b));
+	ES_FWD_INT_NM(intseq_alloc(&empty));
+	ES_NEW_ASRT_NM(intseq_lower_bound(a, 0) == 0);
+	/* Multiples of 3 with some repeated, and multiples of 5 in two dense stretches far apart */
+	for (i = 0; i < 30000; i++) {
+		ES_FWD_INT_NM(intseq_append(a, i * 3));
+		if (i % 7 == 0)
+			ES_FWD_INT_NM(intseq_append(a, i * 3));
+	}
+	for (i = 0; i < 8000; i++) {
+		ES_FWD_INT_NM(intseq_append(b, i < 4000 ? i * 5 : 60000 + i * 5));
+		if (i % 3 == 0)
+			ES_FWD_INT_NM(intseq_append(b, i < 4000 ? i * 5 : 60000 + i * 5));
+	}
+	for (i = 0; i < 91000; i += 7) {
+		lb = intseq_lower_bound(a, i);
+		ES_NEW_ASRT(!intseq_at(a, lb, &value) || value >= i, "lower_bound(%zu) = %zu", i, lb);
+		ES_NEW_ASRT(!lb || (intseq_at(a, lb - 1, &value) && value < i), "lower_bound(%zu)", i);
+		ES_NEW_ASRT_NM(lb < intseq_size(a) || i > 89997);
+	}
+
+	ES_FWD_INT_NM(intseq_intersect(a, empty, &both));
+	ES_NEW_ASRT_NM(intseq_size(both) == 0);
+	intseq_free(&both);
+	ES_FWD_INT_NM(intseq_intersect(a, b, &both));
+	n = intseq_size(both);
+	ES_NEW_ASRT_NM(n <= ARRAY_SIZE(_out));
+	intseq_copy_out(both, _out);
+	/* Multiples of 15 below 20000 and in [80000, 90000), repeated when both repeat them */
+	for (i = 0, k = 0; i < 90000; i += 15) {
+		size_t in_a = i / 3 % 7 == 0 ? 2 : 1, in_b = 0;
+		if (i < 20000)
+			in_b = i / 5 % 3 == 0 ? 2 : 1;
+		else if (i >= 80000)
+			in_b = (i - 60000) / 5 % 3 == 0 ? 2 : 1;
+		for (j = 0; j < MIN(in_a, in_b); j++, k++) {
+			ES_NEW_ASRT(k < n && _out[k] == i, "Intersection missing %zu", i);
+		}
+	}
+	ES_NEW_ASRT(k == n, "Intersection has %zu values, expected %zu", n, k);
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_decode,
+    test_2_search,
+};
+
+TESTER_MAIN(tests);
@@ -0,0 +1,191 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "data-structures/lru.h"
+#include "errstack.h"
+#include "test_utils.h"
+#include "util.h"
+
+#define N         10000
+#define N_THREADS 4
+
+typedef struct
+{
+	size_t evicted;
+	long last_key;
+	long last_value;
+} _evictions_t;
+
+static void _on_evict(void *key, void *value, void *data)
+{
+	_evictions_t *ev = data;
+	ev->evicted++;
+	ev->last_key   = (long) key;
+	ev->last_value = (long) value;
+}
+
+int test_1_exact(void)
+{
+	_evictions_t ev       = {};
+	LRU_CLEANUP lru_st *c = NULL;
+	lru_stats_st stats;
+	long i;
+	ES_NEW_ASRT_NM(lru_int_alloc(&c, LRU_DEFAULT, 0, 0, NULL, NULL) < 0);
+	ES_FWD_INT_NM(lru_int_alloc(&c, LRU_DEFAULT, 3, 0, _on_evict, &ev));
+	for (i = 1; i <= 3; i++) {
+		ES_NEW_ASRT_NM(lru_int_put(c, i, i * 10, 0) == 1);
+	}
+	/* 1 becomes the most recent, 2 is evicted next */
+	ES_NEW_ASRT_NM(lru_int_get(c, 1) == (void *) 10);
+	ES_FWD_INT_NM(lru_int_put(c, 4, 40, 0));
+	ES_NEW_ASRT(ev.evicted == 1 && ev.last_key == 2, "Evicted %ld", ev.last_key);
+	ES_NEW_ASRT_NM(!lru_int_get(c, 2) && lru_int_get(c, 3) == (void *) 30);
+	/* Replacing hands the old value over, putting the same value again doesn't */
+	ES_FWD_INT_NM(lru_int_put(c, 4, 41, 0));
+	ES_NEW_ASRT_NM(ev.evicted == 2 && ev.last_value == 40);
+	ES_FWD_INT_NM(lru_int_put(c, 4, 41, 0));
+	ES_NEW_ASRT_NM(ev.evicted == 2);
+	lru_delete(c, (void *) 3);
+	ES_NEW_ASRT_NM(ev.evicted == 3 && !lru_has(c, (void *) 3));
+	lru_stats(c, &stats);
+	ES_NEW_ASRT_NM(stats.entries == 2 && stats.hits == 2 && stats.misses == 1);
+	ES_NEW_ASRT_NM(stats.evictions == 1);
+	lru_free(&c);
+	ES_NEW_ASRT_NM(ev.evicted == 5);
+	return 1;
+}
+
+int test_2_bytes(void)
+{
+	_evictions_t ev       = {};
+	LRU_CLEANUP lru_st *c = NULL;
+	lru_stats_st stats;
+	long i;
+	ES_FWD_INT_NM(lru_int_alloc(&c, LRU_DEFAULT, 0, 1000, _on_evict, &ev));
+	for (i = 0; i < 10; i++) {
+		ES_FWD_INT_NM(lru_int_put(c, i, i, 100));
+	}
+	lru_stats(c, &stats);
+	ES_NEW_ASRT_NM(stats.bytes == 1000 && stats.entries == 10 && !ev.evicted);
+	/* One large entry pushes out the three oldest */
+	ES_FWD_INT_NM(lru_int_put(c, 10, 10, 300));
+	lru_stats(c, &stats);
+	ES_NEW_ASRT(stats.bytes == 1000 && stats.entries == 8, "%zu bytes", stats.bytes);
+	ES_NEW_ASRT_NM(!lru_has(c, (void *) 2) && lru_has(c, (void *) 3));
+	/* Larger than the budget: rejected and handed back, the old value with it */
+	ES_NEW_ASRT_NM(lru_int_put(c, 5, 55, 1001) == 0);
+	ES_NEW_ASRT_NM(ev.last_value == 55 && !lru_has(c, (void *) 5));
+	return 1;
+}
+
+int test_3_clock(void)
+{
+	_evictions_t ev       = {};
+	LRU_CLEANUP lru_st *c = NULL;
+	long i;
+	ES_FWD_INT_NM(lru_int_alloc(&c, LRU_CLOCK, 4, 0, _on_evict, &ev));
+	for (i = 0; i < 4; i++) {
+		ES_FWD_INT_NM(lru_int_put(c, i, i, 0));
+	}
+	/* Referenced entries get a second chance, the oldest unreferenced one goes */
+	lru_int_get(c, 0);
+	lru_int_get(c, 1);
+	ES_FWD_INT_NM(lru_int_put(c, 4, 4, 0));
+	ES_NEW_ASRT(ev.last_key == 2, "Evicted %ld", ev.last_key);
+	ES_FWD_INT_NM(lru_int_put(c, 5, 5, 0));
+	ES_NEW_ASRT(ev.last_key == 3, "Evicted %ld", ev.last_key);
+	/* Their chance is used up, without new hits they go in order */
+	ES_FWD_INT_NM(lru_int_put(c, 6, 6, 0));
+	ES_NEW_ASRT(ev.last_key == 4, "Evicted %ld", ev.last_key);
+	ES_FWD_INT_NM(lru_int_put(c, 7, 7, 0));
+	ES_NEW_ASRT(ev.last_key == 0, "Evicted %ld", ev.last_key);
+
+	/* Many keys through a small cache keep it at capacity */
+	for (i = 0; i < N; i++) {
+		ES_FWD_INT_NM(lru_int_put(c, i + 100, i, 0));
+		if (i % 3 == 0)
+			lru_int_get(c, i + 99);
+	}
+	ES_NEW_ASRT_NM(ev.evicted == N + 4);
+	return 1;
+}
+
+int test_4_str(void)
+{
+	LRU_CLEANUP lru_st *c = NULL;
+	char key[32];
+	long i;
+	ES_FWD_INT_NM(lru_str_alloc(&c, LRU_DEFAULT, 100, 0, NULL, NULL));
+	for (i = 0; i < 1000; i++) {
+		snprintf(key, sizeof(key), "key-%ld", i);
+		ES_FWD_INT_NM(lru_put(c, key, (void *) i, 0));
+	}
+	for (i = 0; i < 1000; i++) {
+		snprintf(key, sizeof(key), "key-%ld", i);
+		ES_NEW_ASRT(lru_has(c, key) == (i >= 900), "Wrong residency of %s", key);
+	}
+	return 1;
+}
+
+typedef struct
+{
+	lru_sharded_st *c;
+	atomic_size_t errors;
+} _shared_t;
+
+static void _check(const void *key, void *value, void *data)
+{
+	if ((long) key != (long) value)
+		atomic_fetch_add(&((_shared_t *) data)->errors, 1);
+}
+
+static void *_worker(void *arg)
+{
+	_shared_t *s = arg;
+	long i;
+	for (i = 0; i < N * 4; i++) {
+		long key = (i * 7919) % N;
+		if (!lru_sharded_get(s->c, (void *) key, _check, s)) {
+			if (lru_sharded_put(s->c, (void *) key, (void *) key, 1) < 0)
+				atomic_fetch_add(&s->errors, 1);
+		}
+	}
+	return NULL;
+}
+
+int test_5_sharded(void)
+{
+	LRU_SHARDED_CLEANUP lru_sharded_st *c = NULL;
+	_shared_t s                           = {};
+	pthread_t threads[N_THREADS];
+	lru_stats_st stats;
+	size_t i;
+	ES_FWD_INT_NM(lru_sharded_alloc(
+	    &c, 6, LRU_CLOCK, N / 4, 0, ht_int_hash, ht_int_cmp, 0, NULL, NULL, NULL, NULL));
+	s.c = c;
+	for (i = 0; i < N_THREADS; i++) {
+		ES_NEW_ASRT_NM(!pthread_create(&threads[i], NULL, _worker, &s));
+	}
+	for (i = 0; i < N_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	lru_sharded_stats(c, &stats);
+	ES_NEW_ASRT(atomic_load(&s.errors) == 0, "%zu errors", atomic_load(&s.errors));
+	ES_NEW_ASRT(stats.hits + stats.misses == N * 4 * N_THREADS, "%lu lookups", stats.hits);
+	/* 8 shards, each rounded up to its share */
+	ES_NEW_ASRT(stats.entries <= N / 4 + 8 && stats.entries > N / 8, "%zu", stats.entries);
+	lru_sharded_delete(c, (void *) 1);
+	ES_NEW_ASRT_NM(!lru_sharded_get(c, (void *) 1, NULL, NULL));
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_exact,
+    test_2_bytes,
+    test_3_clock,
+    test_4_str,
+    test_5_sharded,
+};
+
+TESTER_MAIN(tests);
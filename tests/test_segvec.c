@@ -0,0 +1,80 @@
+#include <stdlib.h>
+
+#include "data-structures/segvec.h"
+#include "errstack.h"
+#include "test_utils.h"
+#include "util.h"
+
+#define N 100000
+
+int test_1_stable(void)
+{
+	SEGVEC_CLEANUP segvec_st *sv = NULL;
+	size_t *first, *mid, i;
+	ES_NEW_ASRT_NM(segvec_alloc(&sv, 0) < 0);
+	ES_FWD_INT_NM(segvec_alloc(&sv, sizeof(size_t)));
+	ES_NEW_ASRT_NM(!segvec_back(sv) && !segvec_at(sv, 0) && !segvec_pop_back(sv));
+	for (i = 0; i < N; i++) {
+		size_t *dst;
+		ES_FWD_INT_NM(segvec_emplace_back(sv, (void **) &dst));
+		*dst = i;
+	}
+	first = segvec_at(sv, 0);
+	mid   = segvec_at(sv, N / 2);
+	/* Growth across many blocks leaves earlier elements where they were */
+	for (i = N; i < N * 10; i++) {
+		ES_FWD_INT_NM(segvec_push_back(sv, &i));
+	}
+	ES_NEW_ASRT_NM(first == segvec_at(sv, 0) && *first == 0);
+	ES_NEW_ASRT_NM(mid == segvec_at(sv, N / 2) && *mid == N / 2);
+	ES_NEW_ASRT(segvec_size(sv) == N * 10, "Size %zu", segvec_size(sv));
+	for (i = 0; i < N * 10; i++) {
+		ES_NEW_ASRT(*(size_t *) segvec_at(sv, i) == i, "Wrong value at %zu", i);
+	}
+	ES_NEW_ASRT_NM(!segvec_at(sv, N * 10) && *(size_t *) segvec_back(sv) == N * 10 - 1);
+	/* Popping frees blocks, pushing again refills the same indices */
+	while (segvec_size(sv) > 3) {
+		ES_NEW_ASRT_NM(segvec_pop_back(sv));
+	}
+	for (i = 3; i < N; i++) {
+		ES_FWD_INT_NM(segvec_push_back(sv, &i));
+	}
+	for (i = 0; i < N; i++) {
+		ES_NEW_ASRT(*(size_t *) segvec_at(sv, i) == i, "Wrong value at %zu", i);
+	}
+	return 1;
+}
+
+static int _count(size_t idx, void *elm, void *data)
+{
+	size_t *seen = data;
+	if (idx != *seen || *(size_t *) elm != idx)
+		return -1;
+	return ++*seen < N / 2 ? 1 : 0;
+}
+
+int test_2_foreach_take(void)
+{
+	SEGVEC_CLEANUP segvec_st *sv = NULL;
+	size_t *data, size, seen = 0, i;
+	ES_FWD_INT_NM(segvec_alloc(&sv, sizeof(size_t)));
+	ES_NEW_ASRT_NM(!segvec_take_data(&sv, &size) && sv);
+	for (i = 0; i < N; i++) {
+		ES_FWD_INT_NM(segvec_push_back(sv, &i));
+	}
+	ES_NEW_ASRT(segvec_foreach(sv, _count, &seen) == 0 && seen == N / 2, "Saw %zu", seen);
+	ES_NEW_ASRT_NM(data = segvec_take_data(&sv, &size));
+	ES_NEW_ASRT_NM(!sv && size == N);
+	for (i = 0; i < N; i++) {
+		ES_NEW_ASRT(data[i] == i, "Wrong value at %zu", i);
+	}
+	free(data);
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_stable,
+    test_2_foreach_take,
+};
+
+TESTER_MAIN(tests);
@@ -0,0 +1,135 @@
+#include <stdlib.h>
+
+#include "data-structures/slotmap.h"
+#include "errstack.h"
+#include "test_utils.h"
+#include "util.h"
+
+#define N 10000
+
+typedef struct
+{
+	long id;
+	char name[20];
+} _obj_t;
+
+int test_1_basic(void)
+{
+	SLOTMAP_CLEANUP slotmap_st *sm = NULL;
+	static slotmap_handle_t handles[N];
+	slotmap_handle_t reused;
+	_obj_t obj = {};
+	long i;
+	ES_NEW_ASRT_NM(slotmap_alloc(&sm, 0, 0) < 0);
+	ES_FWD_INT_NM(slotmap_alloc(&sm, sizeof(_obj_t), 0));
+	ES_NEW_ASRT_NM(!slotmap_get(sm, SLOTMAP_NULL) && !slotmap_has(sm, 12345));
+	for (i = 0; i < N; i++) {
+		obj.id = i;
+		ES_FWD_INT_NM(slotmap_insert(sm, &obj, &handles[i]));
+		ES_NEW_ASRT_NM(handles[i] != SLOTMAP_NULL);
+	}
+	for (i = 0; i < N; i += 2) {
+		ES_NEW_ASRT_NM(slotmap_remove(sm, handles[i]));
+		ES_NEW_ASRT_NM(!slotmap_remove(sm, handles[i]));
+	}
+	ES_NEW_ASRT_NM(slotmap_size(sm) == N / 2);
+	for (i = 0; i < N; i++) {
+		_obj_t *got = slotmap_get(sm, handles[i]);
+		if (i & 1) {
+			ES_NEW_ASRT(got && got->id == i, "Lost %ld", i);
+		} else {
+			ES_NEW_ASRT(!got, "Stale handle %ld resolved", i);
+		}
+	}
+	/* Freed slots come back under a new generation, the old handle stays dead */
+	obj.id = -1;
+	ES_FWD_INT_NM(slotmap_insert(sm, &obj, &reused));
+	ES_NEW_ASRT_NM((uint32_t) reused == (uint32_t) handles[N - 2] && reused != handles[N - 2]);
+	ES_NEW_ASRT_NM(!slotmap_get(sm, handles[N - 2]));
+	ES_NEW_ASRT_NM(((_obj_t *) slotmap_get(sm, reused))->id == -1);
+
+	slotmap_clear(sm);
+	ES_NEW_ASRT_NM(slotmap_size(sm) == 0 && !slotmap_has(sm, reused));
+	ES_NEW_ASRT_NM(!slotmap_has(sm, handles[1]));
+	return 1;
+}
+
+static int _sum(UNUSED slotmap_handle_t handle, void *value, void *data)
+{
+	*(long *) data += ((_obj_t *) value)->id;
+	return ((_obj_t *) value)->id != 7;
+}
+
+int test_2_iteration(void)
+{
+	SLOTMAP_CLEANUP slotmap_st *sm = NULL;
+	_obj_t obj                     = {};
+	slotmap_handle_t handle;
+	_obj_t *values;
+	long sum = 0;
+	long i;
+	size_t j;
+	ES_FWD_INT_NM(slotmap_alloc(&sm, sizeof(_obj_t), N));
+	for (i = 0; i < N; i++) {
+		obj.id = i;
+		ES_FWD_INT_NM(slotmap_insert(sm, &obj, &handle));
+		if (i % 3 == 0)
+			slotmap_remove(sm, handle);
+	}
+	/* Live values are packed, each handle finds its own value */
+	values = slotmap_values(sm);
+	for (j = 0; j < slotmap_size(sm); j++) {
+		ES_NEW_ASRT_NM(slotmap_get(sm, slotmap_handle_at(sm, j)) == &values[j]);
+		ES_NEW_ASRT_NM(values[j].id % 3 != 0);
+		sum += values[j].id;
+	}
+	ES_NEW_ASRT(sum == (long) N * (N - 1) / 2 - 3L * (N / 3) * (N / 3 + 1) / 2, "Sum %ld", sum);
+	/* Stops at id 7, which sits wherever the removals moved it */
+	sum = 0;
+	ES_NEW_ASRT_NM(slotmap_foreach(sm, _sum, &sum) == 0 && sum > 0);
+	return 1;
+}
+
+/* Random inserts and removals checked against a plain array of what should be live */
+int test_3_churn(void)
+{
+	SLOTMAP_CLEANUP slotmap_st *sm = NULL;
+	static slotmap_handle_t live[N];
+	static slotmap_handle_t dead[N];
+	size_t n_live = 0, n_dead = 0;
+	uint64_t rng  = 88172645463325252ULL;
+	size_t i;
+	ES_FWD_INT_NM(slotmap_alloc(&sm, sizeof(long), 0));
+	for (i = 0; i < N * 20; i++) {
+		rng ^= rng << 13;
+		rng ^= rng >> 7;
+		rng ^= rng << 17;
+		if (n_live < N && (rng % 3 || !n_live)) {
+			long value = (long) i;
+			ES_FWD_INT_NM(slotmap_insert(sm, &value, &live[n_live]));
+			ES_NEW_ASRT_NM(*(long *) slotmap_get(sm, live[n_live]) == value);
+			n_live++;
+		} else {
+			size_t victim = (rng >> 8) % n_live;
+			ES_NEW_ASRT_NM(slotmap_remove(sm, live[victim]));
+			dead[n_dead++ % N] = live[victim];
+			live[victim]       = live[--n_live];
+		}
+	}
+	ES_NEW_ASRT_NM(slotmap_size(sm) == n_live);
+	for (i = 0; i < n_live; i++) {
+		ES_NEW_ASRT_NM(slotmap_has(sm, live[i]));
+	}
+	for (i = 0; i < MIN(n_dead, (size_t) N); i++) {
+		ES_NEW_ASRT_NM(!slotmap_has(sm, dead[i]));
+	}
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_basic,
+    test_2_iteration,
+    test_3_churn,
+};
+
+TESTER_MAIN(tests);
@@ -0,0 +1,149 @@
+#include <stdlib.h>
+
+#include "data-structures/soa.h"
+#include "errstack.h"
+#include "test_utils.h"
+#include "util.h"
+
+/* Odd so every vector width leaves a remainder */
+#define N 10007
+
+enum
+{
+	COL_ID,
+	COL_PRICE,
+	COL_TAG,
+};
+
+int test_1_rows(void)
+{
+	const size_t widths[] = {sizeof(int32_t), sizeof(double), 3};
+	SOA_CLEANUP soa_st *soa = NULL;
+	int32_t *ids;
+	double *prices;
+	size_t i, row;
+	ES_NEW_ASRT_NM(soa_alloc(&soa, widths, 0) < 0);
+	ES_FWD_INT_NM(soa_alloc(&soa, widths, ARRAY_SIZE(widths)));
+	ES_NEW_ASRT_NM(!soa_at(soa, COL_ID, 0) && !soa_pop_row(soa));
+	for (i = 0; i < N; i++) {
+		int32_t id   = i;
+		double price = i * 0.5;
+		char tag[3]  = {'a', 'b', i & 0x7F};
+		if (i % 2) {
+			const void *fields[] = {&id, &price, tag};
+			ES_FWD_INT_NM(soa_push_row(soa, fields));
+		} else {
+			ES_FWD_INT_NM(soa_emplace_row(soa, &row));
+			*(int32_t *) soa_at(soa, COL_ID, row)   = id;
+			*(double *) soa_at(soa, COL_PRICE, row) = price;
+			memcpy(soa_at(soa, COL_TAG, row), tag, sizeof(tag));
+		}
+	}
+	ES_NEW_ASRT(soa_size(soa) == N, "Size %zu", soa_size(soa));
+	ids    = soa_column(soa, COL_ID);
+	prices = soa_column(soa, COL_PRICE);
+	ES_NEW_ASRT_NM(((uintptr_t) ids | (uintptr_t) prices) % 64 == 0 && !soa_column(soa, 3));
+	for (i = 0; i < N; i++) {
+		const char *tag = soa_at(soa, COL_TAG, i);
+		ES_NEW_ASRT(ids[i] == (int32_t) i && prices[i] == i * 0.5, "Bad row %zu", i);
+		ES_NEW_ASRT(tag[0] == 'a' && tag[2] == (char) (i & 0x7F), "Bad tag at %zu", i);
+	}
+	ES_NEW_ASRT_NM(!soa_at(soa, COL_ID, N) && !soa_at(soa, 3, 0));
+	ES_NEW_ASRT_NM(soa_pop_row(soa) && soa_size(soa) == N - 1);
+	ES_FWD_INT_NM(soa_reserve(soa, N * 4));
+	ES_NEW_ASRT_NM(((int32_t *) soa_column(soa, COL_ID))[N - 2] == N - 2);
+	soa_clear(soa);
+	ES_NEW_ASRT_NM(soa_size(soa) == 0);
+	return 1;
+}
+
+static int _check_kernels(const int32_t *ints, const double *dbls, uint32_t *rows, void *out)
+{
+	int32_t lo = -1000, hi = 5000, imin = INT32_MAX, imax = INT32_MIN, got_imin, got_imax;
+	double dmin = 1e300, dmax = -1e300, dsum = 0, got_dmin, got_dmax, diff;
+	int64_t isum = 0;
+	size_t i, matches = 0, got;
+	for (i = 0; i < N; i++) {
+		isum += ints[i];
+		dsum += dbls[i];
+		imin = MIN(imin, ints[i]);
+		imax = MAX(imax, ints[i]);
+		dmin = MIN(dmin, dbls[i]);
+		dmax = MAX(dmax, dbls[i]);
+	}
+	ES_NEW_ASRT(soa_sum_i32(ints, N) == isum, "Sum at level %d", soa_simd_level());
+	diff = soa_sum_f64(dbls, N) - dsum;
+	ES_NEW_ASRT(diff < 1e-6 && diff > -1e-6, "Sum off by %g", diff);
+	soa_minmax_i32(ints, N, &got_imin, &got_imax);
+	ES_NEW_ASRT_NM(got_imin == imin && got_imax == imax);
+	soa_minmax_f64(dbls, N, &got_dmin, &got_dmax);
+	ES_NEW_ASRT_NM(got_dmin == dmin && got_dmax == dmax);
+	soa_minmax_i32(ints, 0, &got_imin, &got_imax);
+	ES_NEW_ASRT_NM(got_imin == INT32_MAX && got_imax == INT32_MIN);
+
+	got = soa_filter_i32(ints, N, lo, hi, rows);
+	for (i = 0; i < N; i++) {
+		if (ints[i] < lo || ints[i] > hi)
+			continue;
+		ES_NEW_ASRT(matches < got && rows[matches] == i, "Missed row %zu", i);
+		matches++;
+	}
+	ES_NEW_ASRT(got == matches, "Got %zu rows, expected %zu", got, matches);
+	soa_gather_i32(ints, rows, got, out);
+	for (i = 0; i < got; i++) {
+		ES_NEW_ASRT_NM(((int32_t *) out)[i] == ints[rows[i]]);
+	}
+
+	got     = soa_filter_f64(dbls, N, 0.25, 0.5, rows);
+	matches = 0;
+	for (i = 0; i < N; i++) {
+		if (dbls[i] < 0.25 || dbls[i] > 0.5)
+			continue;
+		ES_NEW_ASRT(matches < got && rows[matches] == i, "Missed row %zu", i);
+		matches++;
+	}
+	ES_NEW_ASRT(got == matches, "Got %zu rows, expected %zu", got, matches);
+	soa_gather_f64(dbls, rows, got, out);
+	for (i = 0; i < got; i++) {
+		ES_NEW_ASRT_NM(((double *) out)[i] == dbls[rows[i]]);
+	}
+	return 1;
+}
+
+/* Every level the CPU has agrees with plain loops, remainders included */
+int test_2_kernels(void)
+{
+	const size_t widths[]   = {sizeof(int32_t), sizeof(double), sizeof(uint32_t), sizeof(double)};
+	SOA_CLEANUP soa_st *soa = NULL;
+	soa_simd_t best = soa_simd_level(), level;
+	int32_t *ints;
+	double *dbls;
+	size_t i, row;
+	ES_FWD_INT_NM(soa_alloc(&soa, widths, ARRAY_SIZE(widths)));
+	for (i = 0; i < N; i++) {
+		ES_FWD_INT_NM(soa_emplace_row(soa, &row));
+	}
+	ints = soa_column(soa, 0);
+	dbls = soa_column(soa, 1);
+	srand(7);
+	for (i = 0; i < N; i++) {
+		ints[i] = rand() % 20000 - 10000;
+		dbls[i] = (double) rand() / RAND_MAX;
+	}
+	ints[N - 1] = INT32_MIN;
+	ints[N - 2] = INT32_MAX;
+	for (level = SOA_SIMD_SCALAR; level <= best; level++) {
+		ES_NEW_ASRT_NM(soa_simd_set(level) == level);
+		ES_FWD_INT(_check_kernels(ints, dbls, soa_column(soa, 2), soa_column(soa, 3)),
+		           "Kernels failed at level %d",
+		           level);
+	}
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_rows,
+    test_2_kernels,
+};
+
+TESTER_MAIN(tests);
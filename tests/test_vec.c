@@ -7,7 +7,6 @@
 int test_1_create(void)
 {
 	VEC_CLEANUP vec_t *v;
-	vec_alloc(&v, sizeof(int));
 	ES_FWD_INT(vec_alloc(&v, sizeof(int)), "Failed to alloc");
 	ES_NEW_ASRT(vec_size(v) == 0, "Size wasn't zero");
 	return 0;
@@ -96,11 +95,43 @@ int test_4_foreach(void)
 	return 1;
 }
 
+/* Shrinking releases pages, growing back must see the same values below size */
+int _test_mmap(int flags)
+{
+	VEC_CLEANUP vec_t *v = NULL;
+	size_t i, *at;
+	ES_FWD_INT_NM(vec_alloc_flags(&v, sizeof(size_t), flags));
+	for (i = 0; i < N * 10; i++) {
+		ES_FWD_INT_NM(vec_push_back(v, &i));
+	}
+	while (vec_size(v) > 100) {
+		ES_FWD_INT_NM(vec_pop_back(v));
+	}
+	for (i = 100; i < N; i++) {
+		ES_FWD_INT_NM(vec_push_back(v, &i));
+	}
+	for (i = 0; i < N; i++) {
+		ES_NEW_ASRT((at = vec_at(v, i)) && *at == i, "Wrong value at %zu", i);
+	}
+	ES_NEW_ASRT_NM(!vec_take_data(&v, NULL, NULL) && vec_size(v) == N);
+	return 1;
+}
+
+int test_5_mmap(void)
+{
+	VEC_CLEANUP vec_t *v = NULL;
+	ES_NEW_ASRT_NM(vec_alloc_flags(&v, sizeof(int), 1 << 7) < 0 && !v);
+	ES_FWD_INT_NM(_test_mmap(VEC_MMAP));
+	ES_FWD_INT_NM(_test_mmap(VEC_HUGEPAGE));
+	return 1;
+}
+
 static test_function tests[] = {
     test_1_create,
     test_2_push_back_pop_back,
     test_3_take_data,
     test_4_foreach,
+    test_5_mmap,
 };
 
 TESTER_MAIN(tests);
@@ -0,0 +1,132 @@
+#include <stdlib.h>
+
+#include "data-structures/vec_sort.h"
+#include "errstack.h"
+#include "test_utils.h"
+#include "util.h"
+
+static uint64_t _rng = 88172645463325252ULL;
+
+static uint64_t _next(void)
+{
+	_rng ^= _rng << 13;
+	_rng ^= _rng >> 7;
+	_rng ^= _rng << 17;
+	return _rng;
+}
+
+static int _fill(vec_t *v, size_t n, uint64_t mask)
+{
+	size_t i;
+	for (i = 0; i < n; i++) {
+		uint64_t x = _next() & mask;
+		void *dst;
+		ES_FWD_INT_NM(vec_emplace_back(v, &dst));
+		memcpy(dst, &x, vec_elm_size(v));
+	}
+	return 1;
+}
+
+/* Sizes around the small sort cutoff, the network blocks, and radix sized inputs */
+static const size_t _sizes[] = {0, 1, 2, 7, 8, 9, 17, 63, 64, 65, 1000, 100000};
+
+int test_1_sort_unsigned(void)
+{
+	size_t s, i;
+	for (s = 0; s < ARRAY_SIZE(_sizes); s++) {
+		VEC_CLEANUP vec_t *a = NULL;
+		VEC_CLEANUP vec_t *b = NULL;
+		uint64_t sum = 0, sorted_sum = 0;
+		ES_FWD_INT_NM(vec_alloc(&a, sizeof(uint32_t)));
+		ES_FWD_INT_NM(vec_alloc(&b, sizeof(uint64_t)));
+		ES_FWD_INT_NM(_fill(a, _sizes[s], UINT32_MAX));
+		/* Only the low bytes vary, so most radix passes are skipped */
+		ES_FWD_INT_NM(_fill(b, _sizes[s], s % 2 ? 0xFFFF : UINT64_MAX));
+		for (i = 0; i < _sizes[s]; i++) {
+			sum += *(uint32_t *) vec_at(a, i);
+		}
+		ES_FWD_INT_NM(vec_sort_u32(a));
+		ES_FWD_INT_NM(vec_sort_u64(b));
+		for (i = 0; i < _sizes[s]; i++) {
+			uint32_t *x = vec_at(a, i);
+			uint64_t *y = vec_at(b, i);
+			sorted_sum += *x;
+			ES_NEW_ASRT(!i || x[-1] <= x[0], "u32 out of order at %zu of %zu", i, _sizes[s]);
+			ES_NEW_ASRT(!i || y[-1] <= y[0], "u64 out of order at %zu of %zu", i, _sizes[s]);
+		}
+		ES_NEW_ASRT_NM(sum == sorted_sum && vec_size(a) == _sizes[s]);
+	}
+	return 1;
+}
+
+int test_2_sort_signed(void)
+{
+	VEC_CLEANUP vec_t *a = NULL;
+	VEC_CLEANUP vec_t *b = NULL;
+	const double specials[] = {-1.0 / 0.0, 1.0 / 0.0, -0.0, 0.0, -1e-300, 1e300};
+	size_t i;
+	ES_FWD_INT_NM(vec_alloc(&a, sizeof(int64_t)));
+	ES_FWD_INT_NM(vec_alloc(&b, sizeof(double)));
+	ES_NEW_ASRT_NM(vec_sort_u32(a) < 0);
+	for (i = 0; i < 10000; i++) {
+		int64_t x = _next();
+		double y  = i < ARRAY_SIZE(specials) ? specials[i] : (double) x / (1 + (_next() & 0xFF));
+		ES_FWD_INT_NM(vec_push_back(a, &x));
+		ES_FWD_INT_NM(vec_push_back(b, &y));
+	}
+	ES_FWD_INT_NM(vec_sort_i64(a));
+	ES_FWD_INT_NM(vec_sort_f64(b));
+	for (i = 1; i < 10000; i++) {
+		int64_t *x = vec_at(a, i);
+		double *y  = vec_at(b, i);
+		ES_NEW_ASRT(x[-1] <= x[0], "i64 out of order at %zu", i);
+		ES_NEW_ASRT(y[-1] <= y[0], "f64 out of order at %zu", i);
+	}
+	ES_NEW_ASRT_NM(*(double *) vec_front(b) == -1.0 / 0.0 && *(double *) vec_back(b) == 1.0 / 0.0);
+	return 1;
+}
+
+int test_3_unique_search(void)
+{
+	VEC_CLEANUP vec_t *v   = NULL;
+	VEC_CLEANUP vec_t *eyt = NULL;
+	uint64_t x, *data;
+	size_t i, n;
+	ES_FWD_INT_NM(vec_alloc(&v, sizeof(uint64_t)));
+	ES_NEW_ASRT_NM(vec_lower_bound_u64(v, 5) == 0);
+	ES_FWD_INT_NM(vec_eytzinger_u64(v, &eyt));
+	ES_NEW_ASRT_NM(vec_eytzinger_search_u64(eyt, 5) == 0);
+	vec_cleanup(&eyt);
+	/* Even numbers below 2000, each several times */
+	ES_FWD_INT_NM(_fill(v, 20000, 0x7FF));
+	for (i = 0; i < vec_size(v); i++) {
+		*(uint64_t *) vec_at(v, i) &= ~(uint64_t) 1;
+	}
+	ES_FWD_INT_NM(vec_sort_u64(v));
+	n    = vec_unique(v);
+	data = vec_front(v);
+	ES_NEW_ASRT(n == vec_size(v) && n > 900 && n <= 1024, "%zu unique", n);
+	for (i = 1; i < n; i++) {
+		ES_NEW_ASRT(data[i - 1] < data[i], "Duplicate at %zu", i);
+	}
+	ES_FWD_INT_NM(vec_eytzinger_u64(v, &eyt));
+	ES_NEW_ASRT_NM(vec_size(eyt) == n + 1);
+	for (x = 0; x <= 2048; x++) {
+		size_t lb = vec_lower_bound_u64(v, x), e = vec_eytzinger_search_u64(eyt, x);
+		ES_NEW_ASRT(lb == n || data[lb] >= x, "lower_bound(%lu) = %zu", x, lb);
+		ES_NEW_ASRT(lb == 0 || data[lb - 1] < x, "lower_bound(%lu) = %zu", x, lb);
+		/* Both find the same element, or both find none */
+		ES_NEW_ASRT(lb == n ? e == 0 : e && *(uint64_t *) vec_at(eyt, e) == data[lb],
+		            "Eytzinger search for %lu",
+		            x);
+	}
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_sort_unsigned,
+    test_2_sort_signed,
+    test_3_unique_search,
+};
+
+TESTER_MAIN(tests);
@@ -0,0 +1,149 @@
+#include "data-structures/vec_typed.h"
+#include "errstack.h"
+#include "test_utils.h"
+#include "util.h"
+
+typedef struct
+{
+	uint64_t a;
+	uint64_t b[4];
+	uint32_t c;
+} _value_t;
+
+VEC_DEFINE(vi, int64_t)
+VEC_DEFINE(vs, _value_t)
+VEC_SMALL_DEFINE(sm, int64_t, 4)
+
+#define N 100000
+
+int test_1_basic(void)
+{
+	VEC_TYPED_CLEANUP(vi) vi_st *v = NULL;
+	int64_t *it;
+	int64_t i, sum = 0;
+	ES_FWD_INT(vi_alloc(&v, 0), "Failed to alloc");
+	ES_NEW_ASRT_NM(!vi_back(v) && !vi_at(v, 0) && !vi_pop_back(v));
+	for (i = 0; i < N; i++) {
+		ES_FWD_INT_NM(vi_push_back(v, i));
+	}
+	ES_NEW_ASRT(vi_size(v) == N, "Size %zu", vi_size(v));
+	ES_NEW_ASRT_NM(*vi_at(v, 7) == 7 && *vi_back(v) == N - 1 && !vi_at(v, N));
+	VEC_TYPED_FOREACH(v, it)
+	{
+		sum += *it;
+	}
+	ES_NEW_ASRT(sum == (int64_t) N * (N - 1) / 2, "Sum %ld", sum);
+	ES_NEW_ASRT_NM(vi_pop_back(v) && vi_size(v) == N - 1);
+	vi_clear(v);
+	ES_NEW_ASRT_NM(vi_size(v) == 0 && v->capacity >= N);
+	ES_FWD_INT_NM(vi_shrink_to_fit(v));
+	ES_NEW_ASRT_NM(v->capacity == 0 && !v->data);
+	ES_FWD_INT_NM(vi_push_back(v, 3));
+	ES_NEW_ASRT_NM(*vi_at(v, 0) == 3);
+	return 1;
+}
+
+/* Bulk operations keep the surrounding elements in order */
+int test_2_ranges(void)
+{
+	VEC_TYPED_CLEANUP(vi) vi_st *v = NULL;
+	int64_t src[] = {100, 101, 102};
+	size_t i;
+	ES_FWD_INT_NM(vi_alloc(&v, 4));
+	ES_NEW_ASRT_NM(v->capacity == 4);
+	for (i = 0; i < 10; i++) {
+		ES_FWD_INT_NM(vi_push_back(v, i));
+	}
+	ES_FWD_INT_NM(vi_append_n(v, src, ARRAY_SIZE(src)));
+	ES_NEW_ASRT_NM(vi_size(v) == 13 && *vi_back(v) == 102);
+	/* 0 1 100 101 102 2 3 ... */
+	ES_FWD_INT_NM(vi_insert_range(v, 2, src, ARRAY_SIZE(src)));
+	ES_NEW_ASRT_NM(vi_size(v) == 16 && v->data[1] == 1 && v->data[2] == 100);
+	ES_NEW_ASRT_NM(v->data[4] == 102 && v->data[5] == 2 && v->data[12] == 9);
+	ES_FWD_INT_NM(vi_insert_range(v, vi_size(v), src, 1));
+	ES_NEW_ASRT_NM(*vi_back(v) == 100);
+	ES_NEW_ASRT_NM(vi_insert_range(v, vi_size(v) + 1, src, 1) < 0);
+	/* Back to 0..9 followed by the appended range */
+	ES_NEW_ASRT_NM(vi_erase_range(v, 2, 3) && vi_erase_range(v, vi_size(v) - 1, 1));
+	for (i = 0; i < 10; i++) {
+		ES_NEW_ASRT(v->data[i] == (int64_t) i, "Bad value at %zu", i);
+	}
+	ES_NEW_ASRT_NM(vi_size(v) == 13 && v->data[10] == 100);
+	ES_NEW_ASRT_NM(!vi_erase_range(v, 12, 2) && !vi_erase_range(v, 14, 0));
+	ES_NEW_ASRT_NM(vi_erase_range(v, 13, 0) && vi_size(v) == 13);
+	ES_FWD_INT_NM(vi_shrink_to_fit(v));
+	ES_NEW_ASRT_NM(v->capacity == 13 && v->data[12] == 102);
+	ES_FWD_INT_NM(vi_reserve(v, 1000));
+	ES_NEW_ASRT_NM(v->capacity == 1000 && vi_size(v) == 13);
+	return 1;
+}
+
+int test_3_struct(void)
+{
+	VEC_TYPED_CLEANUP(vs) vs_st *v = NULL;
+	_value_t *it;
+	uint64_t i;
+	ES_FWD_INT_NM(vs_alloc(&v, N));
+	for (i = 0; i < N; i++) {
+		_value_t *dst;
+		if (i % 2) {
+			ES_FWD_INT_NM(vs_emplace_back(v, &dst));
+			*dst = (_value_t){.a = i, .b = {i, i + 1}, .c = i & 0xFF};
+		} else {
+			ES_FWD_INT_NM(vs_push_back(v, (_value_t){.a = i, .b = {i, i + 1}, .c = i & 0xFF}));
+		}
+	}
+	ES_NEW_ASRT_NM(v->capacity == N);
+	i = 0;
+	VEC_TYPED_FOREACH(v, it)
+	{
+		ES_NEW_ASRT(it->a == i && it->b[1] == i + 1 && it->c == (i & 0xFF), "Bad value %lu", i);
+		i++;
+	}
+	ES_NEW_ASRT_NM(i == N);
+	return 1;
+}
+
+/* Inline up to 4, then spilled to the heap with the inline elements carried over */
+int test_4_small(void)
+{
+	VEC_SMALL_CLEANUP(sm) sm_st v = {};
+	int64_t src[] = {10, 11, 12, 13, 14, 15};
+	int64_t *it, *inline_data = sm_data(&v);
+	int64_t i, sum = 0;
+	ES_NEW_ASRT_NM(!sm_back(&v) && !sm_at(&v, 0) && !sm_pop_back(&v));
+	for (i = 0; i < 4; i++) {
+		ES_FWD_INT_NM(sm_push_back(&v, i));
+	}
+	ES_NEW_ASRT_NM(sm_data(&v) == inline_data && !v.heap_capacity);
+	ES_FWD_INT_NM(sm_append_n(&v, src, ARRAY_SIZE(src)));
+	ES_NEW_ASRT_NM(sm_data(&v) != inline_data && v.heap_capacity >= 10);
+	ES_NEW_ASRT_NM(sm_size(&v) == 10 && *sm_at(&v, 3) == 3 && *sm_back(&v) == 15);
+	VEC_SMALL_FOREACH(sm, &v, it)
+	{
+		sum += *it;
+	}
+	ES_NEW_ASRT(sum == 6 + 75, "Sum %ld", sum);
+	for (i = 0; i < N; i++) {
+		int64_t *dst;
+		ES_FWD_INT_NM(sm_emplace_back(&v, &dst));
+		*dst = i;
+	}
+	ES_NEW_ASRT_NM(sm_size(&v) == N + 10 && *sm_at(&v, N + 9) == N - 1);
+	/* Destroyed vectors are empty and inline again */
+	sm_destroy(&v);
+	ES_NEW_ASRT_NM(sm_size(&v) == 0 && sm_data(&v) == inline_data);
+	ES_FWD_INT_NM(sm_reserve(&v, 2));
+	ES_FWD_INT_NM(sm_push_back(&v, 7));
+	ES_NEW_ASRT_NM(sm_data(&v) == inline_data && *sm_at(&v, 0) == 7);
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_basic,
+    test_2_ranges,
+    test_3_struct,
+    test_4_small,
+};
+
+TESTER_MAIN(tests);